@@ -2,25 +2,47 @@
 // Attributes that the engine Shader class will pass to this shader.  Do NOT
 // change the location numbers; they are expected by the engine Shader class.
 layout (location = 0) in vec3 point_position;
+layout (location = 1) in vec3 point_normal;
+layout (location = 2) in vec2 point_lightmap_uv;
 
 // Primary matrix transforms
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// Where the point sits on its face's lightmap atlas page
+out vec2 lightmap_uv;
+out vec3 normal;
+
 void main() {
     gl_Position = projection * view * model * vec4(point_position, 1.0);
+    normal = mat3(model) * point_normal;
+    lightmap_uv = point_lightmap_uv;
 }
 #endif
 
 
 #ifdef FRAGMENT_SHADER
 
+// Lightmap atlas page, used when the face has a lightmap
+uniform bool lightmapped;
+uniform sampler2D lightmap;
+in vec2 lightmap_uv;
+
+// Unlit faces get shaded by a fixed light so their shape still shows
+in vec3 normal;
+const vec3 light_direction = vec3(0.267, 0.535, 0.802);
+
 // Color that will be assigned to the fragment this shader is processing
 uniform vec3 face_color;
 out vec4 final_color;
 
 void main() {
-    final_color = vec4(face_color, 1.0);
+    if (lightmapped) {
+        final_color = vec4(texture(lightmap, lightmap_uv).rgb, 1.0);
+    } else {
+        float shade = 0.6 + 0.4 * abs(dot(normalize(normal), light_direction));
+        final_color = vec4(face_color * shade, 1.0);
+    }
 }
 #endif
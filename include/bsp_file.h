@@ -26,6 +26,7 @@
 
 #define BSP_FILE_IDENTIFIER	(('P' << 24) + ( 'S' << 16) + ('B' << 8) + 'V')
 #define BSP_TOTAL_LUMPS 64
+#define LZMA_IDENTIFIER (('A' << 24) | ('M' << 16) | ('Z' << 8) | 'L')
 
 #define LUMP_ENTITIES 0
 #define LUMP_PLANES 1
@@ -109,6 +110,14 @@ struct bsp_lump_t {
   uint32_t identifier;  // Lump identifier code
 } __attribute__((packed));
 
+/* Sits in front of a lump's data when the lump is LZMA compressed */
+struct lzma_header_t {
+  uint32_t identifier;  // Should be equal to LZMA_IDENTIFIER
+  uint32_t actual_size;  // Size of the data once decompressed
+  uint32_t lzma_size;  // Size of the compressed data following this header
+  uint8_t properties[5];  // LZMA coder properties (lc/lp/pb byte + dictionary size)
+} __attribute__((packed));
+
 struct bsp_header_t {
   uint32_t file_identifier;  // Should be equal to BSP_FILE_IDENTIFIER
   uint32_t version;  // Version of the BSP file format we're using
@@ -148,4 +157,158 @@ struct bsp_face_t {
   uint32_t smoothing_groups;
 } __attribute__((packed));
 
+struct bsp_plane_t {
+  float normal[3];
+  float dist;
+  int32_t type;  // Axis the plane faces along, if it's axial
+} __attribute__((packed));
+
+/* Negative children are leafs, numbered -(leaf + 1) */
+struct bsp_node_t {
+  int32_t plane_index;
+  int32_t children[2];  // Front, then back
+  int16_t mins[3];
+  int16_t maxs[3];
+  uint16_t first_face;
+  uint16_t num_faces;
+  int16_t area;
+  int16_t padding;
+} __attribute__((packed));
+
+/* Version 1 leaf.  Version 0 leafs have 24 bytes of ambient lighting
+   between leaf_water_data_id and padding, see BSP_LEAF_V0_SIZE */
+struct bsp_leaf_t {
+  int32_t contents;
+  int16_t cluster;
+  uint16_t area_flags;  // area:9, flags:7
+  int16_t mins[3];
+  int16_t maxs[3];
+  uint16_t first_leaf_face;
+  uint16_t num_leaf_faces;
+  uint16_t first_leaf_brush;
+  uint16_t num_leaf_brushes;
+  int16_t leaf_water_data_id;
+  int16_t padding;
+} __attribute__((packed));
+
+#define BSP_LEAF_V0_SIZE 56
+
+/* LUMP_VERTNORMALINDICES has one entry per face corner, faces in lump order
+   and corners in surfedge order.  Each picks a normal out of LUMP_VERTNORMALS
+   with the face's smoothing groups already applied */
+struct bsp_vertnormal_t {
+  float x;
+  float y;
+  float z;
+} __attribute__((packed));
+
+typedef uint16_t bsp_vertnormal_index_t;
+
+/* Model 0 is the world, the rest are brush entities ("model" "*N").  Each
+   one owns a contiguous run of faces */
+struct bsp_model_t {
+  float mins[3];
+  float maxs[3];
+  float origin[3];
+  int32_t head_node;  // Root of the model's BSP tree
+  int32_t first_face;  // Index into LUMP_FACES
+  int32_t num_faces;
+} __attribute__((packed));
+
+/* s/t = dot(vec.xyz, point) + vec.w, in texels for texture_vecs and
+   luxels for lightmap_vecs */
+struct bsp_texinfo_t {
+  float texture_vecs[2][4];
+  float lightmap_vecs[2][4];
+  int32_t flags;  // SURF_ flags
+  int32_t texdata;
+} __attribute__((packed));
+
+struct bsp_texdata_t {
+  float reflectivity[3];
+  int32_t name_string_table_id;  // Index into LUMP_TEXDATA_STRING_TABLE
+  int32_t width;
+  int32_t height;
+  int32_t view_width;
+  int32_t view_height;
+} __attribute__((packed));
+
+/* LUMP_TEXDATA_STRING_TABLE holds offsets into LUMP_TEXDATA_STRING_DATA,
+   which holds the NUL terminated material names */
+typedef int32_t bsp_string_table_t;
+
+#define DISP_MAX_POWER 4  // Displacements are at most (2^4 + 1)^2 vertices
+#define DISP_NO_INFO 0xFFFF  // bsp_face_t::disp_info of a face that isn't a displacement
+
+/* Which neighbor (and how much of it) touches part of a displacement edge */
+struct bsp_disp_sub_neighbor_t {
+  uint16_t neighbor;  // Dispinfo index, 0xFFFF if there's none
+  uint8_t neighbor_orientation;
+  uint8_t span;
+  uint8_t neighbor_span;
+  uint8_t padding;
+} __attribute__((packed));
+
+struct bsp_disp_corner_neighbors_t {
+  uint16_t neighbors[4];  // Dispinfo indices
+  uint8_t num_neighbors;
+  uint8_t padding;
+} __attribute__((packed));
+
+struct bsp_dispinfo_t {
+  float start_position[3];  // Lands on the base face corner the grid starts at
+  int32_t disp_vert_start;  // Index into LUMP_DISP_VERTS
+  int32_t disp_tri_start;  // Index into LUMP_DISP_TRIS
+  int32_t power;  // Grid is (2^power + 1) vertices square
+  int32_t min_tess;
+  float smoothing_angle;
+  int32_t contents;
+  uint16_t map_face;  // Face this displaces
+  uint16_t padding;
+  int32_t lightmap_alpha_start;
+  int32_t lightmap_sample_position_start;
+  bsp_disp_sub_neighbor_t edge_neighbors[4][2];
+  bsp_disp_corner_neighbors_t corner_neighbors[4];
+  uint32_t allowed_verts[10];
+} __attribute__((packed));
+
+/* A displaced grid vertex sits at its base position + vec * dist */
+struct bsp_disp_vert_t {
+  float vec[3];  // Normalized offset direction
+  float dist;
+  float alpha;  // Blend between the material's two textures, 0-255
+} __attribute__((packed));
+
+/* Flags for each triangle of a displacement's grid */
+typedef uint16_t bsp_disp_tri_t;
+
+#define GAMELUMP_COMPRESSED 0x0001  // Game lump data is LZMA compressed
+#define GAMELUMP_STATIC_PROPS (('s' << 24) + ('p' << 16) + ('r' << 8) + 'p')
+#define STATIC_PROP_NAME_LENGTH 128
+
+/* LUMP_GAME_LUMP is an int32 count followed by this many of these */
+struct bsp_gamelump_t {
+  int32_t id;  // Four character code, like GAMELUMP_STATIC_PROPS
+  uint16_t flags;
+  uint16_t version;
+  int32_t file_offset;  // From the start of the bsp file, not the lump
+  int32_t file_length;
+} __attribute__((packed));
+
+/* The part of a static prop every version of the sprp game lump shares.
+   Later versions add fields on the end, see StaticProps for the ones we use */
+struct bsp_static_prop_t {
+  float origin[3];
+  float angles[3];  // Pitch, yaw, roll in degrees
+  uint16_t prop_type;  // Index into the model dictionary
+  uint16_t first_leaf;  // Index into the prop leaf list
+  uint16_t leaf_count;
+  uint8_t solid;
+  uint8_t flags;
+  int32_t skin;
+  float fade_min_dist;
+  float fade_max_dist;
+  float lighting_origin[3];
+} __attribute__((packed));
+
 #endif // BSP_FILE_H
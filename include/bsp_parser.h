@@ -21,13 +21,27 @@
  *
  */
 
+#ifndef BSP_PARSER_H
+#define BSP_PARSER_H
+
 #include <stdint.h>
+#include <array>
 #include <string>
 #include <vector>
+#include <memory>
+#include <mutex>
 #include <glm/glm.hpp>
 #include "bsp_file.h"
+#include "lump_view.h"
+#include "mapped_file.h"
+#include "pak_file.h"
+#include "entity_lump.h"
+#include "visibility_lump.h"
+#include "game_lump.h"
+#include "thread_pool.h"
 #include "map.h"
 
+#define BSP_STREAM_MEMORY_LIMIT ((size_t)1 << 30)  // Default cap on what a MODE_STREAM parser keeps
 
 /**
  *
@@ -48,22 +62,199 @@ class BSPParserException : public std::exception {
 
 
 /**
+ * Parses a BSP file.
+ *
+ * Opening a file only reads and indexes the header's lump directory.  Each
+ * lump is read and decoded the first time something asks for it and cached
+ * after that, so header queries like Version() or LumpInfo() never touch the
+ * rest of the file.
+ *
+ * In MODE_MMAP (the default) the file is memory mapped and the decoded lumps
+ * are views straight into the mapping.  In MODE_READ each lump is read into
+ * its own buffer when it's first needed.  MODE_STREAM parsers are built from
+ * a file descriptor that can't seek, the lumps to keep have to be named up
+ * front and are decoded as they come off the stream.  Either way nothing is
+ * copied out of the lump data and the views are only valid while the parser
+ * is alive, call Copy() on them if you need the data to stick around.
+ *
+ * LZMA compressed lumps are decompressed when they're read, which means
+ * they get an owned buffer even in MODE_MMAP.
+ *
+ * A MODE_STREAM parser holds every requested lump for its whole life, since
+ * the views point into them.  Once the header is in it adds up what those
+ * lumps will take, compressed ones at their decompressed size plus room to
+ * decompress the biggest, and throws before reading any lump data if that's
+ * over its memory limit.  Peak memory is bounded by the limit however big
+ * the file is.
  *
+ * Lumps don't depend on each other, so DecodeLumps() can decode a batch of
+ * them (decompression included) across a ThreadPool.  All accessors are safe
+ * to call from several threads at once.
  */
 class BSPParser {
   public:
-    BSPParser(std::string path);
+    enum Mode {
+      MODE_READ,
+      MODE_MMAP,
+      MODE_STREAM
+    };
+
+    BSPParser(std::string path, Mode mode=MODE_MMAP, bool verbose=true);
+    BSPParser(int stream_fd, const std::vector<uint32_t>& lump_types, bool verbose=true,
+              size_t memory_limit=BSP_STREAM_MEMORY_LIMIT);
+    ~BSPParser();
+
+    BSPParser(const BSPParser&) = delete;
+    BSPParser& operator=(const BSPParser&) = delete;
+
+    static void CheckHeader(const bsp_header_t& header);
+
+    /* Header info, these don't read anything past the header */
+    uint32_t Version() const;
+    uint32_t Revision() const;
+    size_t FileSize() const;
+    const bsp_lump_t& LumpInfo(uint32_t lump_type) const;
+
+    /* Raw contents of a lump */
+    LumpView<uint8_t> LumpData(uint32_t lump_type);
 
-    std::vector<glm::vec3> vertices;
-    std::vector<bsp_edge_t> map_edges;
-    std::vector<bsp_surfedge_t> map_surfedges;
-    std::vector<bsp_face_t> map_faces;
+    /* Decode a set of lumps ahead of time, in parallel if given a pool */
+    void DecodeLumps(const std::vector<uint32_t>& lump_types, ThreadPool* pool=nullptr);
+
+    /* Decoded lumps */
+    const LumpView<bsp_vertex_t>& Vertices();
+    const LumpView<bsp_edge_t>& Edges();
+    const LumpView<bsp_surfedge_t>& Surfedges();
+    const LumpView<bsp_face_t>& Faces();
+    const LumpView<bsp_model_t>& Models();
+    const LumpView<bsp_vertnormal_t>& VertNormals();
+    const LumpView<bsp_vertnormal_index_t>& VertNormalIndices();
+    const LumpView<bsp_plane_t>& Planes();
+    const LumpView<bsp_node_t>& Nodes();
+    const LumpView<bsp_leaf_t>& Leafs();
+    const LumpView<bsp_texinfo_t>& TexInfo();
+    const LumpView<bsp_texdata_t>& TexData();
+    const LumpView<bsp_string_table_t>& TexDataStringTable();
+    const LumpView<uint8_t>& TexDataStringData();
+    const LumpView<uint8_t>& Lighting();
+    const LumpView<bsp_dispinfo_t>& DispInfo();
+    const LumpView<bsp_disp_vert_t>& DispVerts();
+    const LumpView<bsp_disp_tri_t>& DispTris();
+    const PakFile& Pakfile();
+    const EntityLump& Entities();
+    const VisibilityLump& Visibility();
+    const GameLump& GameLumps();
 
  private:
-    void processHeader(uint8_t* data, size_t data_len);
-    void processLump(uint8_t* data, size_t data_len, uint32_t lump_type, bsp_lump_t* lump);
-    void processVertexLump(uint8_t* data, size_t data_len, bsp_lump_t* lump);
-    void processEdgeLump(uint8_t* data, size_t data_len, bsp_lump_t* lump);
-    void processSurfedgeLump(uint8_t* data, size_t data_len, bsp_lump_t* lump);
-    void processFaceLump(uint8_t* data, size_t data_len, bsp_lump_t* lump);
+    Mode mode;
+    bool verbose;
+    int fd;  // File we read lumps out of in MODE_READ
+    size_t file_size;
+    bsp_header_t header;
+    std::unique_ptr<MappedFile> mapping;  // Backing store in MODE_MMAP
+
+    /* Per lump cache state */
+    std::once_flag lump_read[BSP_TOTAL_LUMPS];
+    std::once_flag lump_decoded[BSP_TOTAL_LUMPS];
+    bool lump_streamed[BSP_TOTAL_LUMPS];
+    LumpView<uint8_t> lump_data[BSP_TOTAL_LUMPS];  // Uncompressed lump contents
+    std::vector<uint8_t> lump_buffers[BSP_TOTAL_LUMPS];  // When we can't point into the file
+
+    LumpView<bsp_vertex_t> vertices;
+    LumpView<bsp_edge_t> map_edges;
+    LumpView<bsp_surfedge_t> map_surfedges;
+    LumpView<bsp_face_t> map_faces;
+    LumpView<bsp_model_t> map_models;
+    LumpView<bsp_vertnormal_t> map_vert_normals;
+    LumpView<bsp_vertnormal_index_t> map_vert_normal_indices;
+    LumpView<bsp_plane_t> map_planes;
+    LumpView<bsp_node_t> map_nodes;
+    LumpView<bsp_leaf_t> map_leafs;
+    std::vector<bsp_leaf_t> leaf_buffer;  // Version 0 leafs, repacked
+    LumpView<bsp_texinfo_t> map_texinfo;
+    LumpView<bsp_texdata_t> map_texdata;
+    LumpView<bsp_string_table_t> map_string_table;
+    LumpView<uint8_t> map_string_data;
+    LumpView<uint8_t> map_lighting;
+    LumpView<bsp_dispinfo_t> map_dispinfo;
+    LumpView<bsp_disp_vert_t> map_disp_verts;
+    LumpView<bsp_disp_tri_t> map_disp_tris;
+    std::unique_ptr<PakFile> pakfile;
+    std::unique_ptr<EntityLump> entities;
+    std::unique_ptr<VisibilityLump> visibility;
+    std::unique_ptr<GameLump> game_lumps;
+
+    void log(const char* fmt, ...);
+    void processHeader();
+    const uint8_t* fetchLump(uint32_t lump_type, const bsp_lump_t* lump);
+    const LumpView<uint8_t>& readLump(uint32_t lump_type);
+    void decodeLump(uint32_t lump_type);
+    void processLump(uint32_t lump_type);
+
+    /* How each lump gets decoded, indexed by lump type.  Lumps nothing
+       uses yet have no decoder */
+    struct LumpDecoder {
+        const char* name;  // For log and error messages
+        uint32_t version;  // Newest lump version whose layout the decoder knows
+        void (BSPParser::*decode)(uint32_t lump_type, const LumpView<uint8_t>& data);
+    };
+
+    /* Lumps that are just an array of T get viewed in place */
+    template <typename T, LumpView<T> BSPParser::*view>
+    void decodeArray(uint32_t lump_type, const LumpView<uint8_t>& data);
+
+    void processLeafLump(uint32_t lump_type, const LumpView<uint8_t>& data);
+    void processPakfileLump(uint32_t lump_type, const LumpView<uint8_t>& data);
+    void processEntityLump(uint32_t lump_type, const LumpView<uint8_t>& data);
+    void processVisibilityLump(uint32_t lump_type, const LumpView<uint8_t>& data);
+    void processGameLump(uint32_t lump_type, const LumpView<uint8_t>& data);
+
+    /* Adding a lump is one line here plus its accessor.  Built at compile
+       time, so picking a decoder is a single indexed load */
+    static constexpr std::array<LumpDecoder, BSP_TOTAL_LUMPS> lump_decoders = [] {
+        std::array<LumpDecoder, BSP_TOTAL_LUMPS> decoders = {};
+        decoders[LUMP_ENTITIES] = { "entity", 0, &BSPParser::processEntityLump };
+        decoders[LUMP_PLANES] = { "plane", 0,
+            &BSPParser::decodeArray<bsp_plane_t, &BSPParser::map_planes> };
+        decoders[LUMP_TEXDATA] = { "texdata", 0,
+            &BSPParser::decodeArray<bsp_texdata_t, &BSPParser::map_texdata> };
+        decoders[LUMP_VERTEXES] = { "vertex", 0,
+            &BSPParser::decodeArray<bsp_vertex_t, &BSPParser::vertices> };
+        decoders[LUMP_VISIBILITY] = { "visibility", 0, &BSPParser::processVisibilityLump };
+        decoders[LUMP_NODES] = { "node", 0,
+            &BSPParser::decodeArray<bsp_node_t, &BSPParser::map_nodes> };
+        decoders[LUMP_TEXINFO] = { "texinfo", 0,
+            &BSPParser::decodeArray<bsp_texinfo_t, &BSPParser::map_texinfo> };
+        decoders[LUMP_FACES] = { "face", 1,
+            &BSPParser::decodeArray<bsp_face_t, &BSPParser::map_faces> };
+        /* ColorRGBExp32 samples, faces point into it by byte offset */
+        decoders[LUMP_LIGHTING] = { "lighting", 1,
+            &BSPParser::decodeArray<uint8_t, &BSPParser::map_lighting> };
+        decoders[LUMP_LEAFS] = { "leaf", 1, &BSPParser::processLeafLump };
+        decoders[LUMP_EDGES] = { "edge", 0,
+            &BSPParser::decodeArray<bsp_edge_t, &BSPParser::map_edges> };
+        decoders[LUMP_SURFEDGES] = { "surfedge", 0,
+            &BSPParser::decodeArray<bsp_surfedge_t, &BSPParser::map_surfedges> };
+        decoders[LUMP_MODELS] = { "model", 0,
+            &BSPParser::decodeArray<bsp_model_t, &BSPParser::map_models> };
+        decoders[LUMP_DISPINFO] = { "dispinfo", 0,
+            &BSPParser::decodeArray<bsp_dispinfo_t, &BSPParser::map_dispinfo> };
+        decoders[LUMP_VERTNORMALS] = { "vertex normal", 0,
+            &BSPParser::decodeArray<bsp_vertnormal_t, &BSPParser::map_vert_normals> };
+        decoders[LUMP_VERTNORMALINDICES] = { "vertex normal index", 0,
+            &BSPParser::decodeArray<bsp_vertnormal_index_t, &BSPParser::map_vert_normal_indices> };
+        decoders[LUMP_DISP_VERTS] = { "displacement vertex", 0,
+            &BSPParser::decodeArray<bsp_disp_vert_t, &BSPParser::map_disp_verts> };
+        decoders[LUMP_GAME_LUMP] = { "game", 0, &BSPParser::processGameLump };
+        decoders[LUMP_PAKFILE] = { "pakfile", 0, &BSPParser::processPakfileLump };
+        decoders[LUMP_TEXDATA_STRING_DATA] = { "texdata string data", 0,
+            &BSPParser::decodeArray<uint8_t, &BSPParser::map_string_data> };
+        decoders[LUMP_TEXDATA_STRING_TABLE] = { "texdata string table", 0,
+            &BSPParser::decodeArray<bsp_string_table_t, &BSPParser::map_string_table> };
+        decoders[LUMP_DISP_TRIS] = { "displacement triangle", 0,
+            &BSPParser::decodeArray<bsp_disp_tri_t, &BSPParser::map_disp_tris> };
+        return decoders;
+    }();
 };
+
+#endif // BSP_PARSER_H
@@ -0,0 +1,72 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Reads lumps out of a BSP file that can only be read front to back.
+ *
+ */
+
+#ifndef BSP_STREAM_PARSER_H
+#define BSP_STREAM_PARSER_H
+
+#include <stdint.h>
+#include <vector>
+#include <functional>
+#include "bsp_file.h"
+
+
+/**
+ * Pulls lumps out of a pipe, socket or anything else that can't seek.
+ *
+ * The header is read first, then the requested lumps are read in the order
+ * they sit in the file.  Bytes between them are read into a small scratch
+ * buffer and thrown away, so the stream itself never holds more than the
+ * largest requested lump.
+ *
+ * Each lump is handed to the callback as soon as its bytes are in.  The
+ * buffer is reused for the next lump, so a callback that wants to keep the
+ * data should std::move it out.  Whatever the callback keeps is on top of
+ * that, so callers that keep lumps can ReadHeader() first and check the lump
+ * directory before any lump data is read.
+ */
+class BSPStreamParser {
+public:
+    typedef std::function<void(uint32_t lump_type, const bsp_lump_t& lump,
+                               std::vector<uint8_t>& data)> LumpCallback;
+
+    BSPStreamParser(int fd);
+
+    void Request(uint32_t lump_type);
+    const bsp_header_t& ReadHeader();
+    void Run(LumpCallback callback);
+
+    const bsp_header_t& Header() const;
+    size_t BytesRead() const;
+
+private:
+    int fd;
+    bsp_header_t header;
+    bool header_read;
+    size_t bytes_read;
+    std::vector<uint32_t> requested;
+
+    void readFully(uint8_t* out, size_t amt);
+    void skip(size_t amt);
+};
+
+#endif // BSP_STREAM_PARSER_H
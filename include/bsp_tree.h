@@ -0,0 +1,124 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief The map's BSP tree, laid out for fast traversal.
+ *
+ */
+
+#ifndef BSP_TREE_H
+#define BSP_TREE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <exception>
+#include <glm/glm.hpp>
+#include "bsp_file.h"
+#include "lump_view.h"
+
+class BSPParser;
+
+
+class BSPTreeException : public std::exception {
+public:
+    BSPTreeException(std::string msg) {
+        this->msg = msg;
+    }
+
+    const char* what() const throw() {
+        return this->msg.c_str();
+    }
+
+private:
+    std::string msg;
+};
+
+
+/**
+ * Everything a traversal step touches: the node's plane copied in so
+ * there's no hop through the plane lump, and its children.  Negative
+ * children are leafs, numbered -(leaf + 1) like in the file.
+ */
+struct BSPTreeNode {
+    float normal[3];
+    float dist;
+    int32_t children[2];  // Front, then back
+};
+
+/* The parts of a node traversals don't need */
+struct BSPTreeNodeInfo {
+    int16_t mins[3];
+    int16_t maxs[3];
+    uint16_t first_face;
+    uint16_t num_faces;
+};
+
+struct BSPTreeLeaf {
+    int32_t contents;
+    int16_t cluster;  // Visibility cluster, -1 if the leaf isn't in one
+    uint16_t area;
+    int16_t mins[3];
+    int16_t maxs[3];
+    uint16_t first_leaf_face;
+    uint16_t num_leaf_faces;
+    uint16_t first_leaf_brush;
+    uint16_t num_leaf_brushes;
+};
+
+
+/**
+ * Flat BSP tree built from the plane, node and leaf lumps.
+ *
+ * Nodes sit in one contiguous array in the order vbsp wrote them, which is
+ * depth first so a node's front child usually follows it.  Each node is 24
+ * bytes holding only what's needed to pick a child, everything else is kept
+ * off to the side in node_info.
+ *
+ * Every index is checked when the tree is built, and every child node has to
+ * come after its parent (vbsp always writes them that way), so queries never
+ * need bounds checks and can't loop forever on a corrupt map.
+ */
+class BSPTree {
+public:
+    BSPTree(const LumpView<bsp_plane_t>& planes, const LumpView<bsp_node_t>& nodes,
+            const LumpView<bsp_leaf_t>& leafs);
+
+    static BSPTree FromBSP(BSPParser* parser);
+
+    /* Leaf holding a point, starting from the given node (model 0's head
+       node is 0).  -1 if the tree has no leafs */
+    int32_t FindLeaf(const glm::vec3& point, int32_t head_node=0) const;
+
+    /* FindLeaf over many points, walking several at once to hide cache misses */
+    void FindLeafs(const glm::vec3* points, size_t count, int32_t* leafs,
+                   int32_t head_node=0) const;
+
+    size_t NodeCount() const;
+    size_t LeafCount() const;
+    const std::vector<BSPTreeNode>& Nodes() const;
+    const std::vector<BSPTreeNodeInfo>& NodeInfo() const;
+    const std::vector<BSPTreeLeaf>& Leafs() const;
+
+private:
+    std::vector<BSPTreeNode> nodes;
+    std::vector<BSPTreeNodeInfo> node_info;
+    std::vector<BSPTreeLeaf> leafs;
+};
+
+#endif // BSP_TREE_H
@@ -0,0 +1,119 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Tessellates displacement surfaces into render ready grids.
+ *
+ */
+
+#ifndef DISPLACEMENT_H
+#define DISPLACEMENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <exception>
+#include <glm/glm.hpp>
+#include "bsp_file.h"
+#include "lump_view.h"
+
+#define DISPLACEMENT_NONE 0xFFFFFFFF  // Face that isn't a displacement
+
+class BSPParser;
+class ThreadPool;
+
+
+class DisplacementException : public std::exception {
+public:
+    DisplacementException(std::string msg) {
+        this->msg = msg;
+    }
+
+    const char* what() const throw() {
+        return this->msg.c_str();
+    }
+
+private:
+    std::string msg;
+};
+
+
+/* A displacement and where its tessellated grid goes.  Vertex and index
+   offsets are relative to the buffers handed to Tessellate(). */
+struct DisplacementSurface {
+    uint32_t face;  // Face the displacement replaces
+    uint32_t dispinfo;
+    uint32_t power;  // Grid is (2^power + 1) vertices square
+    uint32_t first_vertex;
+    uint32_t vertex_count;
+    uint32_t first_index;
+    uint32_t index_count;  // Triangle list, two per grid cell
+    glm::vec3 corners[4];  // Base face corners, starting with the dispinfo's start position
+};
+
+
+/**
+ * Every displacement in a map, checked and laid out up front.
+ *
+ * Each surface's vertex and index counts only depend on its power, so the
+ * constructor works out where every surface goes in the output buffers.
+ * Tessellate() can then build each surface as its own job, writing straight
+ * into its slice of the caller's buffers with no locking or merging.
+ * Indices are relative to the surface's first vertex, so they always fit in
+ * 16 bits.
+ *
+ * This keeps a view of the displacement vertex lump, so the BSPParser it
+ * came from must outlive it.
+ */
+class Displacements {
+public:
+    Displacements(const LumpView<bsp_dispinfo_t>& dispinfo,
+                  const LumpView<bsp_disp_vert_t>& disp_verts,
+                  const LumpView<bsp_disp_tri_t>& disp_tris,
+                  const LumpView<bsp_face_t>& faces,
+                  const LumpView<bsp_surfedge_t>& surfedges,
+                  const LumpView<bsp_edge_t>& edges,
+                  const LumpView<bsp_vertex_t>& vertices);
+
+    static Displacements FromBSP(BSPParser* parser);
+
+    size_t Count() const;
+    const std::vector<DisplacementSurface>& Surfaces() const;
+    uint32_t FaceSurface(size_t face) const;  // DISPLACEMENT_NONE if it isn't one
+    size_t VertexCount() const;  // Across every surface
+    size_t IndexCount() const;
+
+    /* positions and normals need room for VertexCount(), indices for
+       IndexCount() */
+    void Tessellate(glm::vec3* positions, glm::vec3* normals, uint16_t* indices,
+                    ThreadPool* pool=nullptr) const;
+
+private:
+    LumpView<bsp_disp_vert_t> disp_verts;
+    std::vector<uint32_t> vert_starts;  // Per surface, into disp_verts
+    std::vector<DisplacementSurface> surfaces;
+    std::vector<uint32_t> face_surfaces;
+    size_t vertex_count;
+    size_t index_count;
+
+    void tessellate(size_t surface, glm::vec3* positions, glm::vec3* normals,
+                    uint16_t* indices) const;
+};
+
+#endif // DISPLACEMENT_H
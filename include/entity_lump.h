@@ -0,0 +1,117 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Parser for the KeyValues text in a map's entity lump.
+ *
+ */
+
+#ifndef ENTITY_LUMP_H
+#define ENTITY_LUMP_H
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <exception>
+#include "lump_view.h"
+
+
+class EntityLumpException : public std::exception {
+public:
+    EntityLumpException(std::string msg) {
+        this->msg = msg;
+    }
+
+    const char* what() const throw() {
+        return this->msg.c_str();
+    }
+
+private:
+    std::string msg;
+};
+
+
+struct EntityKeyValue {
+    std::string_view key;
+    std::string_view value;
+};
+
+/* An entity is a run of key/values in the pair array */
+struct Entity {
+    uint32_t first_pair;
+    uint32_t pair_count;
+    std::string_view classname;  // Empty if the entity has none
+    std::string_view targetname;
+};
+
+/* One entry in a name index, sorted by name hash */
+struct EntityIndexEntry {
+    uint64_t hash;
+    std::string_view name;
+    uint32_t entity;
+};
+
+/* Entries in a name index that share a name */
+struct EntityMatches {
+    const EntityIndexEntry* first;
+    const EntityIndexEntry* last;
+
+    const EntityIndexEntry* begin() const { return first; }
+    const EntityIndexEntry* end() const { return last; }
+    size_t size() const { return last - first; }
+    bool empty() const { return first == last; }
+};
+
+
+/**
+ * Entities from LUMP_ENTITIES.
+ *
+ * The lump is tokenized in place: every key and value is a string_view into
+ * the lump data, entities are runs in one flat pair array, and the classname
+ * and targetname indexes are arrays sorted by name hash rather than hash
+ * tables.  The only allocations are those few arrays and the scratch space
+ * for sorting the indexes, so nothing is allocated per key.  Like the lump
+ * views, nothing here is valid once the lump data goes away.
+ *
+ * Keys and the names in the indexes are both matched case insensitively
+ * (ASCII only) like the engine does.
+ */
+class EntityLump {
+public:
+    EntityLump(const LumpView<uint8_t>& data);
+
+    size_t Count() const;
+    const Entity& operator[](size_t entity) const;
+    const std::vector<Entity>& Entities() const;
+    const std::vector<EntityKeyValue>& Pairs() const;
+
+    std::string_view Get(size_t entity, std::string_view key) const;
+    EntityMatches FindByClassname(std::string_view classname) const;
+    EntityMatches FindByTargetname(std::string_view targetname) const;
+
+private:
+    std::vector<Entity> entities;
+    std::vector<EntityKeyValue> pairs;
+    std::vector<EntityIndexEntry> classname_index;
+    std::vector<EntityIndexEntry> targetname_index;
+
+    static EntityMatches find(const std::vector<EntityIndexEntry>& index, std::string_view name);
+};
+
+#endif // ENTITY_LUMP_H
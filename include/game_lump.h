@@ -0,0 +1,78 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Directory of the game specific lumps inside LUMP_GAME_LUMP.
+ *
+ */
+
+#ifndef GAME_LUMP_H
+#define GAME_LUMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <exception>
+#include "bsp_file.h"
+#include "lump_view.h"
+
+
+class GameLumpException : public std::exception {
+public:
+    GameLumpException(std::string msg) {
+        this->msg = msg;
+    }
+
+    const char* what() const throw() {
+        return this->msg.c_str();
+    }
+
+private:
+    std::string msg;
+};
+
+
+struct GameLumpEntry {
+    uint32_t id;  // Four character code, like GAMELUMP_STATIC_PROPS
+    uint16_t flags;
+    uint16_t version;
+    LumpView<uint8_t> data;  // Already decompressed
+};
+
+
+/**
+ * The game lumps a map has.  Their offsets are from the start of the file,
+ * so the game lump's own file offset is needed to find them in its data.
+ * Compressed game lumps get decompressed when the directory is read, they're
+ * small and there's only a handful of them.
+ */
+class GameLump {
+public:
+    GameLump(const LumpView<uint8_t>& data, uint64_t file_offset);
+
+    size_t Count() const;
+    const GameLumpEntry& operator[](size_t i) const;
+    const GameLumpEntry* Find(uint32_t id) const;  // nullptr if the map doesn't have it
+
+private:
+    std::vector<GameLumpEntry> entries;
+    std::vector<std::vector<uint8_t>> buffers;  // Decompressed game lumps
+};
+
+#endif // GAME_LUMP_H
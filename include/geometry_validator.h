@@ -0,0 +1,97 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Structural validation of the lumps map geometry is built from.
+ *
+ * Faces index into the surfedge lump, surfedges into the edge lump and edges
+ * into the vertex lump, and none of those indices can be trusted in a
+ * corrupt or malicious map.  Rather than checking every index while the mesh
+ * is built, the whole chain gets validated up front and the mesh builder
+ * only runs on maps that came back clean.
+ */
+
+#ifndef GEOMETRY_VALIDATOR_H
+#define GEOMETRY_VALIDATOR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <exception>
+#include "bsp_file.h"
+#include "lump_view.h"
+
+class BSPParser;
+
+
+/* A single out of range index */
+struct GeometryViolation {
+    uint32_t lump_type;  // LUMP_MODELS, LUMP_FACES, LUMP_SURFEDGES or LUMP_EDGES
+    uint32_t index;  // Element of that lump holding the bad index
+    uint64_t value;  // The index (or face/model end) it holds
+    uint64_t limit;  // What it had to be below (at most, for ends)
+};
+
+
+/**
+ * Result of validating a map's geometry lumps.
+ *
+ * Each lump is swept once with a vectorized reduction, which is all it takes
+ * to certify a good map.  Only when a reduction shows a lump has a bad index
+ * does it get walked again to find every violation.
+ */
+class GeometryReport {
+public:
+    static GeometryReport Validate(const LumpView<bsp_vertex_t>& vertices,
+                                   const LumpView<bsp_edge_t>& edges,
+                                   const LumpView<bsp_surfedge_t>& surfedges,
+                                   const LumpView<bsp_face_t>& faces);
+    static GeometryReport Validate(BSPParser* parser);
+
+    bool Certified() const;
+    const std::vector<GeometryViolation>& Violations() const;
+    std::string Summary(size_t max_listed=8) const;
+
+    static std::string Describe(const GeometryViolation& violation);
+
+private:
+    std::vector<GeometryViolation> violations;
+};
+
+
+class GeometryValidationException : public std::exception {
+public:
+    GeometryValidationException(const GeometryReport& report) {
+        this->report = report;
+        this->msg = report.Summary();
+    }
+
+    const char* what() const throw() {
+        return this->msg.c_str();
+    }
+
+    const GeometryReport& Report() const {
+        return this->report;
+    }
+
+private:
+    GeometryReport report;
+    std::string msg;
+};
+
+#endif // GEOMETRY_VALIDATOR_H
@@ -0,0 +1,136 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Decodes face lightmaps out of the lighting lump and packs them into
+ *        atlas pages.
+ *
+ * Lightmap samples are stored as ColorRGBExp32: an 8 bit red, green and blue
+ * plus a shared signed exponent.  Decoding turns them into RGBA8 texels with
+ * an SSE2 or AVX2 kernel on x86 (AVX2 is picked at runtime if the CPU has it)
+ * and a plain C++ fallback everywhere else.
+ */
+
+#ifndef LIGHTMAP_ATLAS_H
+#define LIGHTMAP_ATLAS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <exception>
+#include <glm/glm.hpp>
+#include "bsp_file.h"
+#include "lump_view.h"
+
+#define LIGHTMAP_PAGE_SIZE 1024  // Width (and max height) of an atlas page, in luxels
+#define LIGHTMAP_PADDING 1  // Luxels of border around each face, so filtering doesn't bleed
+#define LIGHTMAP_NO_PAGE -1  // FaceLightmap::page for faces without a lightmap
+
+class BSPParser;
+class ThreadPool;
+struct TexinfoArrays;
+
+
+class LightmapAtlasException : public std::exception {
+public:
+    LightmapAtlasException(std::string msg) {
+        this->msg = msg;
+    }
+
+    const char* what() const throw() {
+        return this->msg.c_str();
+    }
+
+private:
+    std::string msg;
+};
+
+
+enum LightmapDecodePath {
+    DECODE_BEST,  // Fastest path the CPU supports
+    DECODE_SCALAR,
+    DECODE_SSE,
+    DECODE_AVX2
+};
+
+
+/* Where a face's lightmap ended up in the atlas */
+struct FaceLightmap {
+    int32_t page;  // Atlas page, or LIGHTMAP_NO_PAGE
+    uint16_t x;  // Top left luxel of the lightmap, inside the padding
+    uint16_t y;
+    uint16_t width;  // In luxels
+    uint16_t height;
+    glm::vec4 uv_s;  // Atlas u = dot(uv_s.xyz, point) + uv_s.w
+    glm::vec4 uv_t;  // Atlas v = dot(uv_t.xyz, point) + uv_t.w
+};
+
+/* An atlas page, its texels live in LightmapAtlas::Texels() */
+struct LightmapPage {
+    uint32_t width;
+    uint32_t height;
+    uint64_t first_texel;
+};
+
+
+/* Decodes count ColorRGBExp32 samples into RGBA8 texels.  The output is gamma
+   2 encoded and clamped at full brightness. */
+void DecodeLightmapSamples(const uint8_t* samples, uint32_t* texels, size_t count,
+                           LightmapDecodePath path=DECODE_BEST);
+
+bool LightmapDecodePathSupported(LightmapDecodePath path);
+
+
+/**
+ * Every face's base lightmap (style 0), packed into as few atlas pages as it
+ * takes.  Faces are packed onto shelves tallest first, which is quick and
+ * wastes little space since lightmaps come in a handful of sizes.  Packing
+ * is cheap; decoding every sample is the expensive bit, so that gets split
+ * across the pool by face.
+ */
+class LightmapAtlas {
+public:
+    LightmapAtlas(const LumpView<uint8_t>& lighting, const LumpView<bsp_face_t>& faces,
+                  const TexinfoArrays& texinfo, ThreadPool* pool=nullptr,
+                  uint32_t page_size=LIGHTMAP_PAGE_SIZE);
+
+    static LightmapAtlas FromBSP(BSPParser* parser, const TexinfoArrays& texinfo,
+                                 ThreadPool* pool=nullptr);
+
+    const std::vector<FaceLightmap>& Faces() const;  // One per face, in face lump order
+    const std::vector<LightmapPage>& Pages() const;
+    const std::vector<uint32_t>& Texels() const;  // Every page's RGBA8 texels, back to back
+    std::vector<uint32_t> ReleaseTexels();  // Moves the texels out, leaving Texels() empty
+    size_t LitFaces() const;
+    double Occupancy() const;  // Fraction of the page area covered by lightmaps
+
+private:
+    std::vector<FaceLightmap> faces;
+    std::vector<LightmapPage> pages;
+    std::vector<uint32_t> texels;
+    size_t lit_faces;
+    uint64_t used_texels;
+
+    void pack(const LumpView<bsp_face_t>& map_faces, const std::vector<uint32_t>& order,
+              uint32_t page_size);
+    void decode(const LumpView<uint8_t>& lighting, const LumpView<bsp_face_t>& map_faces,
+                const std::vector<uint32_t>& order, size_t first, size_t last);
+};
+
+#endif // LIGHTMAP_ATLAS_H
@@ -0,0 +1,138 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Typed, non-owning view over the elements of a lump.
+ *
+ */
+
+#ifndef LUMP_VIEW_H
+#define LUMP_VIEW_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <exception>
+#include <type_traits>
+
+
+class LumpViewException : public std::exception {
+public:
+    LumpViewException(std::string msg) {
+        this->msg = msg;
+    }
+
+    const char* what() const throw() {
+        return this->msg.c_str();
+    }
+
+private:
+    std::string msg;
+};
+
+
+/**
+ * Array-like view over a run of T stored in a lump.  The view doesn't own the
+ * bytes it points at, so it is only valid while whatever holds the file data
+ * (usually the BSPParser) is alive.
+ *
+ * Lumps can sit at any offset in the file, so elements are always read with
+ * memcpy rather than by dereferencing a T*.  Use Copy() if you need the
+ * elements to outlive the parser.
+ */
+template <typename T>
+class LumpView {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Lump elements must be plain data");
+
+public:
+    class Iterator {
+    public:
+        Iterator(const uint8_t* pos) : pos(pos) {}
+
+        T operator*() const {
+            T value;
+            memcpy(&value, pos, sizeof(T));
+            return value;
+        }
+        Iterator& operator++() {
+            pos += sizeof(T);
+            return *this;
+        }
+        bool operator!=(const Iterator& other) const {
+            return pos != other.pos;
+        }
+
+    private:
+        const uint8_t* pos;
+    };
+
+    LumpView() : bytes(nullptr), count(0) {}
+    LumpView(const uint8_t* bytes, size_t count) : bytes(bytes), count(count) {}
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t SizeBytes() const { return count * sizeof(T); }
+    const uint8_t* Bytes() const { return bytes; }
+
+    Iterator begin() const { return Iterator(bytes); }
+    Iterator end() const { return Iterator(bytes + SizeBytes()); }
+
+    /* Unchecked element access, for hot loops over data that's been validated */
+    T operator[](size_t i) const {
+        T value;
+        memcpy(&value, bytes + i * sizeof(T), sizeof(T));
+        return value;
+    }
+
+    /* Checked element access */
+    T At(size_t i) const {
+        if (i >= count) {
+            throw LumpViewException("Lump element index out of range");
+        }
+        return (*this)[i];
+    }
+
+    /* Whether the elements can be accessed through a plain T pointer */
+    bool IsAligned() const {
+        return ((uintptr_t)bytes % alignof(T)) == 0;
+    }
+
+    const T* Data() const {
+        if (!IsAligned()) {
+            throw LumpViewException("Lump isn't aligned for direct access");
+        }
+        return (const T*)bytes;
+    }
+
+    /* Make an owned copy of the elements */
+    std::vector<T> Copy() const {
+        std::vector<T> out(count);
+        if (count > 0) {
+            memcpy(out.data(), bytes, SizeBytes());
+        }
+        return out;
+    }
+
+private:
+    const uint8_t* bytes;
+    size_t count;
+};
+
+#endif // LUMP_VIEW_H
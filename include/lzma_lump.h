@@ -0,0 +1,39 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Decompression of LZMA compressed lumps.
+ *
+ * Some games (mainly console and later branch ones) store lumps compressed.
+ * A compressed lump starts with an lzma_header_t followed by a raw LZMA
+ * stream.  Each lump is compressed on its own, so they can be decompressed
+ * independently of each other.
+ */
+
+#ifndef LZMA_LUMP_H
+#define LZMA_LUMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+bool IsLZMALump(const uint8_t* data, size_t data_len);
+size_t LZMALumpSize(const uint8_t* data, size_t data_len);
+std::vector<uint8_t> DecompressLZMALump(const uint8_t* data, size_t data_len);
+
+#endif // LZMA_LUMP_H
@@ -29,26 +29,48 @@
 #include <glm/glm.hpp>
 #include "shader.h"
 #include "mesh.h"
+#include "texture.h"
+#include "vertex_convert.h"
+#include "lightmap_atlas.h"
+#include "map_geometry.h"
 
 class BSPParser;
+class RenderCache;
 
 
 /**
- *
+ * A single face, drawn on its own when the map renders per face.
  */
 class MapFace {
   public:
-    MapFace(Shader* shader, std::vector<uint16_t>& indices);
+    MapFace(Shader* shader, const MapDrawRange& range, GLenum index_type, size_t index_offset,
+            Texture* lightmap_page);
 
     void render();
 
   private:
-    /* Opengl objects */
-    GLuint vao;
-    GLuint element_bo;
+    GLenum index_type;
+    size_t index_offset;  // Byte offset of the face's first index
     size_t index_amt;
+    GLint base_vertex;
     Shader* shader;
-    glm::vec3 face_color;
+    Texture* lightmap_page;
+};
+
+/* A model's faces that share a lightmap page, drawn with one call */
+struct MapBatch {
+    Texture* lightmap_page;  // nullptr for faces without a lightmap
+    GLenum index_type;  // Whatever its model's vertices need
+    std::vector<GLsizei> counts;
+    std::vector<const void*> offsets;  // Byte offsets into the index buffer
+    std::vector<GLint> base_vertices;
+};
+
+/* How Map::render issues its draws */
+enum MapRenderMode {
+    RENDER_BATCHED,  // One multi draw per model and lightmap page
+    RENDER_PER_FACE,  // One draw per face, kept around to compare against
+    RENDER_MESHLETS  // Like batched, but only meshlets in view and facing the camera
 };
 
 
@@ -61,12 +83,57 @@ class Map {
 
     void render(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection);
     void FromBSP(BSPParser* parser);
+    void FromGeometry(const MapGeometry& geometry);
+    void FromCache(const RenderCache& cache);
+    const VertexBounds& Bounds() const;
+
+    /* Brush models, model 0 is the world.  Each draws with its own
+       transform on top of the map's, so brush entities can move without
+       touching the buffers */
+    size_t ModelCount() const;
+    const MapModel& Model(size_t model) const;
+    void SetModelTransform(size_t model, const glm::mat4& transform);
+
+    void SetRenderMode(MapRenderMode mode);
+    MapRenderMode RenderMode() const;
+    size_t DrawCalls() const;  // Issued by the last render()
+    size_t VisibleMeshlets() const;  // Drawn by the last render(), in RENDER_MESHLETS
+    size_t MeshletCount() const;
 
   private:
     Shader* shader;
+    GLuint vao;
     GLuint vertex_bo;
+    GLuint normal_bo;
+    GLuint lightmap_uv_bo;
+    GLuint element_bo;
+    VertexBounds bounds;
 
     std::vector<MapFace> faces;
+    std::vector<Texture> lightmap_pages;
+    std::vector<MapModel> models;
+    std::vector<glm::mat4> model_transforms;  // One per model, identity until set
+    std::vector<MapBatch> batches;  // Grouped by model
+    std::vector<size_t> model_batches;  // Model i's batches start at model_batches[i]
+    std::vector<MapMeshlet> meshlets;
+    std::vector<size_t> meshlet_offsets;  // Byte offset of each meshlet's first index
+    std::vector<MapBatch> culled_batches;  // Visible meshlets per page, refilled every model
+    MapRenderMode render_mode;
+    size_t draw_calls;
+    size_t visible_meshlets;
+
+    void renderMeshlets(size_t model, const glm::mat4& transform, const glm::mat4& view_projection,
+                        const glm::vec3& camera_pos);
+
+    void upload(const void* vertices, const void* normals, const void* lightmap_uvs,
+                size_t vertices_len,
+                const void* indices, size_t indices_len,
+                const void* wide_indices, size_t wide_indices_len,
+                const std::vector<MapDrawRange>& face_ranges,
+                const std::vector<MapModel>& models,
+                const std::vector<MapMeshlet>& meshlets,
+                const std::vector<FaceLightmap>& face_lightmaps,
+                const std::vector<LightmapPage>& pages, const uint32_t* texels);
 };
 
 #endif // MAP_H
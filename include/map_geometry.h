@@ -0,0 +1,106 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief GPU ready map geometry, built on the CPU.
+ *
+ */
+
+#ifndef MAP_GEOMETRY_H
+#define MAP_GEOMETRY_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "vertex_convert.h"
+#include "lightmap_atlas.h"
+#include "mesh_optimizer.h"
+
+class BSPParser;
+class ThreadPool;
+
+
+/* Where a face's triangles sit in the map's buffers */
+struct MapDrawRange {
+    uint32_t first_index;  // Into its model's index buffer
+    uint32_t index_count;  // GL_TRIANGLES, so a multiple of 3
+    uint32_t base_vertex;  // Added to each index, its model's first vertex
+};
+
+/* A brush model's slice of the map.  Model 0 is the world, the rest belong
+   to brush entities and can be culled or moved on their own */
+struct MapModel {
+    uint32_t first_face;
+    uint32_t face_count;
+    uint32_t first_index;  // Every index of every face, displacements included
+    uint32_t index_count;
+    uint32_t index_size;  // 2 for indices, 4 for wide_indices
+    uint32_t first_vertex;  // The model's welded vertices, its faces share them
+    uint32_t vertex_count;
+    uint32_t first_meshlet;
+    uint32_t meshlet_count;
+    glm::vec3 mins;
+    glm::vec3 maxs;
+    glm::vec3 origin;  // Where the model was compiled, its vertices are already in world space
+};
+
+/* A cluster of up to MESHLET_MAX_TRIANGLES of a model's triangles, small
+   enough to cull on its own.  Its triangles all share a lightmap page and
+   sit together in the model's index buffer, but can come from more than
+   one face */
+struct MapMeshlet {
+    uint32_t first_index;  // Into its model's index buffer
+    uint32_t index_count;
+    uint32_t base_vertex;  // Its model's first vertex
+    int32_t lightmap_page;  // Or LIGHTMAP_NO_PAGE
+    MeshletBounds bounds;  // In model space
+};
+
+
+/**
+ * Vertex and index buffers for a whole map, laid out the way they get handed
+ * to OpenGL.  Building this doesn't touch OpenGL, so it can be done off the
+ * render thread or cached to disk.
+ */
+class MapGeometry {
+public:
+    static MapGeometry FromBSP(BSPParser* parser, ThreadPool* pool=nullptr,
+                               bool optimize=true);  // Throws GeometryValidationException on corrupt maps
+
+    /* Post transform cache use over every model's indices, in the order
+       they're drawn */
+    VertexCacheStats AnalyzeVertexCache() const;
+
+    std::vector<glm::vec3> vertices;  // Welded, one model after another
+    std::vector<glm::vec3> normals;  // One per vertex
+    std::vector<glm::vec2> lightmap_uvs;  // Per vertex, on its face's lightmap page
+    std::vector<uint16_t> indices;  // Models with at most 65536 vertices
+    std::vector<uint32_t> wide_indices;  // Models with more
+    std::vector<MapDrawRange> face_ranges;  // One per face, in face lump order
+    std::vector<MapModel> models;  // Model lump, or one model covering every face
+    std::vector<MapMeshlet> meshlets;  // Each model's, one model after another
+    std::vector<uint32_t> face_materials;  // Material ID for each face, or MATERIAL_NONE
+    std::vector<std::string> materials;  // Interned material names, indexed by material ID
+    VertexBounds bounds;  // Bounds of the map's vertices
+    std::vector<FaceLightmap> face_lightmaps;  // One per face, in face lump order
+    std::vector<LightmapPage> lightmap_pages;
+    std::vector<uint32_t> lightmap_texels;  // RGBA8, every page back to back
+};
+
+#endif // MAP_GEOMETRY_H
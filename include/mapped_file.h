@@ -0,0 +1,69 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Read-only memory mapping of a file on disk.
+ */
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <exception>
+
+
+class MappedFileException : public std::exception {
+public:
+    MappedFileException(std::string msg) {
+        this->msg = msg;
+    }
+
+    const char* what() const throw() {
+        return this->msg.c_str();
+    }
+
+private:
+    std::string msg;
+};
+
+
+/**
+ * Maps an entire file into memory read-only.  Pages are only faulted in when
+ * they're touched, so reading a handful of fields out of a huge file is cheap.
+ * The mapping is released when this object is destroyed.
+ */
+class MappedFile {
+public:
+    MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* Data() const;
+    size_t Size() const;
+    void Prefetch(size_t offset, size_t length) const;
+
+private:
+    uint8_t* data;
+    size_t size;
+};
+
+#endif // MAPPED_FILE_H
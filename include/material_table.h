@@ -0,0 +1,106 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Table of the materials a map's faces use.
+ *
+ */
+
+#ifndef MATERIAL_TABLE_H
+#define MATERIAL_TABLE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <exception>
+#include <unordered_map>
+#include <glm/glm.hpp>
+#include "bsp_file.h"
+#include "lump_view.h"
+
+#define MATERIAL_NONE 0xFFFFFFFF  // Face or texinfo without a material
+
+class BSPParser;
+
+
+class MaterialTableException : public std::exception {
+public:
+    MaterialTableException(std::string msg) {
+        this->msg = msg;
+    }
+
+    const char* what() const throw() {
+        return this->msg.c_str();
+    }
+
+private:
+    std::string msg;
+};
+
+
+/* Per texinfo data, one array per field, indexed by texinfo */
+struct TexinfoArrays {
+    std::vector<glm::vec4> texture_s;  // s = dot(texture_s.xyz, point) + texture_s.w
+    std::vector<glm::vec4> texture_t;
+    std::vector<glm::vec4> lightmap_s;
+    std::vector<glm::vec4> lightmap_t;
+    std::vector<int32_t> flags;
+    std::vector<uint32_t> material;  // Material ID, or MATERIAL_NONE
+};
+
+/* Per material data, one array per field, indexed by material ID */
+struct MaterialArrays {
+    std::vector<std::string> names;  // Lowercase with '/' separators
+    std::vector<int32_t> width;
+    std::vector<int32_t> height;
+    std::vector<glm::vec3> reflectivity;
+};
+
+
+/**
+ * Materials resolved from the texinfo, texdata and texdata string lumps.
+ *
+ * Material names are interned when the table is built: every distinct name
+ * (compared the way the engine does, ignoring case and slash direction) gets
+ * a dense ID starting at 0, and everything past that works with IDs.  That
+ * makes batching and sorting faces by material a matter of comparing
+ * integers.
+ */
+class MaterialTable {
+public:
+    MaterialTable(const LumpView<bsp_texinfo_t>& texinfo, const LumpView<bsp_texdata_t>& texdata,
+                  const LumpView<bsp_string_table_t>& string_table,
+                  const LumpView<uint8_t>& string_data);
+
+    static MaterialTable FromBSP(BSPParser* parser);
+
+    size_t Count() const;
+    uint32_t Find(const std::string& name) const;  // MATERIAL_NONE if the map doesn't use it
+    uint32_t TexinfoMaterial(size_t texinfo) const;  // MATERIAL_NONE if out of range
+    std::vector<uint32_t> FaceMaterials(const LumpView<bsp_face_t>& faces) const;
+
+    const TexinfoArrays& Texinfo() const;
+    const MaterialArrays& Materials() const;
+
+private:
+    TexinfoArrays texinfo;
+    MaterialArrays materials;
+    std::unordered_map<std::string, uint32_t> index;
+};
+
+#endif // MATERIAL_TABLE_H
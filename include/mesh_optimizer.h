@@ -0,0 +1,123 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Reorders triangle lists and vertices for the GPU.
+ *
+ * Three passes, run in this order:
+ *
+ *  - Vertex cache: triangles are picked greedily using Tom Forsyth's
+ *    scoring, favouring vertices that were used recently and vertices
+ *    with few triangles left.  Most vertices then get transformed once
+ *    instead of once per triangle.
+ *  - Overdraw: the cache ordered triangles are cut into clusters where
+ *    the cache starts cold anyway.  The clusters are then sorted so the
+ *    ones facing out from the middle of the mesh draw first and hide
+ *    what's behind them.  The sort is only kept if it costs little
+ *    cache efficiency.
+ *  - Vertex fetch: vertices get renumbered in the order they're first
+ *    used, so the vertex fetches walk through memory.
+ *
+ * Everything works on triangle IDs or whole clusters of triangles, so a
+ * caller can keep groups of triangles (a face, say) together.
+ *
+ * Once the order is settled, a triangle list can be cut into meshlets:
+ * runs of consecutive triangles small enough to cull on their own, each
+ * with a bounding box, a bounding sphere and a cone holding its normals.
+ */
+
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+#define MESH_CACHE_SIZE 16  // FIFO post transform cache assumed by the analysis and overdraw passes
+#define MESH_OVERDRAW_THRESHOLD 1.05f  // How much worse the ACMR may get for less overdraw
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124  // 64 vertices and 124 triangles fit common mesh shader limits
+
+
+/* How well a draw uses the post transform cache */
+struct VertexCacheStats {
+    size_t triangles;
+    size_t vertices;  // Distinct vertices referenced
+    size_t transformed;  // Cache misses, each one is a vertex shader run
+    double acmr;  // Transformed per triangle, 0.5 is ideal and 3 is the worst
+    double atvr;  // Transformed per distinct vertex, 1 is ideal
+};
+
+/* A run of triangles that has to stay together */
+struct MeshCluster {
+    uint32_t first_index;
+    uint32_t index_count;
+};
+
+
+/* What it takes to cull a meshlet.  Every triangle faces away from a
+   camera at camera_pos when
+       dot(centre - camera_pos, cone_axis) >= cone_cutoff * length(centre - camera_pos) + radius
+   which MeshletBackfacing checks.  A cone_cutoff of 1 means the normals
+   are too spread out for that to ever be true */
+struct MeshletBounds {
+    glm::vec3 mins;
+    glm::vec3 maxs;
+    glm::vec3 centre;
+    float radius;
+    glm::vec3 cone_axis;  // Average front facing normal, triangles are wound clockwise
+    float cone_cutoff;
+};
+
+
+/* Simulates a FIFO cache of cache_size over a triangle list */
+VertexCacheStats AnalyzeVertexCache(const uint32_t* indices, size_t index_count,
+                                    size_t vertex_count, size_t cache_size=MESH_CACHE_SIZE);
+
+/* Adds up stats from separate draws */
+VertexCacheStats CombineVertexCacheStats(const VertexCacheStats& a, const VertexCacheStats& b);
+
+/* Triangle IDs (index / 3) in cache friendly order */
+std::vector<uint32_t> VertexCacheOrder(const uint32_t* indices, size_t index_count,
+                                       size_t vertex_count);
+
+/* Cluster IDs in the order that draws the least overdraw, for clusters
+   already in cache friendly order.  Triangles are wound clockwise */
+std::vector<uint32_t> OverdrawOrder(const uint32_t* indices, const std::vector<MeshCluster>& clusters,
+                                    const glm::vec3* positions, size_t vertex_count,
+                                    float threshold=MESH_OVERDRAW_THRESHOLD);
+
+/* New ID for each vertex in order of first use, unused vertices go last.
+   Returns how many vertices are used */
+size_t VertexFetchRemap(uint32_t* remap, const uint32_t* indices, size_t index_count,
+                        size_t vertex_count);
+
+/* Cuts a triangle list into runs of consecutive triangles, starting a new
+   run whenever the next triangle would go over either limit */
+std::vector<MeshCluster> BuildMeshlets(const uint32_t* indices, size_t index_count,
+                                       size_t max_vertices=MESHLET_MAX_VERTICES,
+                                       size_t max_triangles=MESHLET_MAX_TRIANGLES);
+
+/* Needs at least one triangle */
+MeshletBounds ComputeMeshletBounds(const uint32_t* indices, size_t index_count,
+                                   const glm::vec3* positions);
+
+bool MeshletBackfacing(const MeshletBounds& bounds, const glm::vec3& camera_pos);
+
+#endif // MESH_OPTIMIZER_H
@@ -0,0 +1,96 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Reader for the zip file embedded in a map's pakfile lump.
+ *
+ */
+
+#ifndef PAK_FILE_H
+#define PAK_FILE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <exception>
+#include <unordered_map>
+#include "lump_view.h"
+
+#define ZIP_METHOD_STORED 0
+
+
+class PakFileException : public std::exception {
+public:
+    PakFileException(std::string msg) {
+        this->msg = msg;
+    }
+
+    const char* what() const throw() {
+        return this->msg.c_str();
+    }
+
+private:
+    std::string msg;
+};
+
+
+struct PakEntry {
+    std::string name;  // Path as it's stored in the zip
+    uint16_t method;  // Compression method, ZIP_METHOD_STORED for none
+    uint32_t crc32;
+    uint32_t compressed_size;
+    uint32_t size;
+    uint32_t header_offset;  // Where the entry's local header sits in the zip
+};
+
+
+/**
+ * Index over the files in LUMP_PAKFILE.
+ *
+ * The zip's central directory is read once when the PakFile is built and
+ * every entry is put into a hash table keyed by its lowercased path, so
+ * lookups don't depend on how many files the map packs.  Source treats paths
+ * case insensitively and with either slash, so lookups do too.
+ *
+ * Maps normally pack files uncompressed, and Open() hands those back as a
+ * view straight into the lump data.  Like the lump views, that's only valid
+ * while the lump data is.
+ */
+class PakFile {
+public:
+    PakFile(const LumpView<uint8_t>& data);
+
+    size_t Count() const;
+    const std::vector<PakEntry>& Entries() const;
+    const PakEntry* Find(const std::string& path) const;
+    LumpView<uint8_t> Open(const std::string& path) const;
+    LumpView<uint8_t> Open(const PakEntry& entry) const;
+
+    static std::string NormalizePath(const std::string& path);
+
+private:
+    LumpView<uint8_t> data;
+    std::vector<PakEntry> entries;
+    std::unordered_map<std::string, size_t> index;
+
+    uint16_t read16(size_t offset) const;
+    uint32_t read32(size_t offset) const;
+    size_t findEndOfDirectory() const;
+};
+
+#endif // PAK_FILE_H
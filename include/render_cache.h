@@ -0,0 +1,103 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief On disk cache of built map geometry.
+ *
+ */
+
+#ifndef RENDER_CACHE_H
+#define RENDER_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <exception>
+#include <glm/glm.hpp>
+#include "render_cache_file.h"
+#include "map_geometry.h"
+#include "mapped_file.h"
+#include "lump_view.h"
+
+
+class RenderCacheException : public std::exception {
+public:
+    RenderCacheException(std::string msg) {
+        this->msg = msg;
+    }
+
+    const char* what() const throw() {
+        return this->msg.c_str();
+    }
+
+private:
+    std::string msg;
+};
+
+
+/* Identifies the BSP a cache was built from */
+struct RenderCacheKey {
+    uint64_t hash;
+    uint64_t size;
+};
+
+
+/**
+ * A render cache file, mapped into memory.
+ *
+ * Caches are named after the content hash of the BSP they were built from, so
+ * an edited map just misses the cache.  Loading one only validates the
+ * header, the sections are handed out as views into the mapping and can be
+ * uploaded to OpenGL as is.
+ */
+class RenderCache {
+public:
+    RenderCache(const std::string& path);
+
+    static RenderCacheKey KeyForFile(const std::string& bsp_path);
+    static std::string PathForKey(const RenderCacheKey& key);
+    static void Write(const std::string& path, const RenderCacheKey& key,
+                      const MapGeometry& geometry);
+
+    bool Matches(const RenderCacheKey& key) const;
+    LumpView<glm::vec3> Vertices() const;
+    LumpView<glm::vec3> Normals() const;
+    LumpView<glm::vec2> LightmapUVs() const;
+    LumpView<uint16_t> Indices() const;
+    LumpView<uint32_t> WideIndices() const;
+    LumpView<MapDrawRange> FaceRanges() const;
+    LumpView<MapModel> Models() const;
+    LumpView<MapMeshlet> Meshlets() const;
+    LumpView<uint32_t> FaceMaterials() const;
+    std::vector<std::string> Materials() const;
+    VertexBounds Bounds() const;
+    LumpView<FaceLightmap> FaceLightmaps() const;
+    LumpView<LightmapPage> LightmapPages() const;
+    LumpView<uint32_t> LightmapTexels() const;
+
+private:
+    MappedFile file;
+    render_cache_header_t header;
+
+    void checkModel(const MapModel& model) const;
+
+    template <typename T>
+    LumpView<T> section(uint32_t section_type) const;
+};
+
+#endif // RENDER_CACHE_H
@@ -0,0 +1,69 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Contains definitions for constructs that exist in a render cache file.
+ *
+ * A render cache (.semrcache) holds a map's geometry after it's been built,
+ * so the next launch can hand it to OpenGL without parsing the BSP again.
+ * Like a BSP it's a header with a directory of sections, each section is
+ * aligned to RENDER_CACHE_ALIGNMENT so it can be used in place once the file
+ * is mapped.
+ */
+
+#ifndef RENDER_CACHE_FILE_H
+#define RENDER_CACHE_FILE_H
+
+#include <stdint.h>
+
+#define RENDER_CACHE_IDENTIFIER (('R' << 24) + ('M' << 16) + ('E' << 8) + 'S')
+#define RENDER_CACHE_VERSION 12  // Bump whenever the layout or contents change
+#define RENDER_CACHE_ALIGNMENT 64
+#define RENDER_CACHE_TOTAL_SECTIONS 16
+
+#define CACHE_SECTION_VERTICES 0  // glm::vec3 positions
+#define CACHE_SECTION_INDICES 1  // uint16_t indices of models with index_size 2
+#define CACHE_SECTION_FACE_RANGES 2  // MapDrawRange per face
+#define CACHE_SECTION_FACE_MATERIALS 3  // uint32_t material ID per face
+#define CACHE_SECTION_MATERIAL_NAMES 4  // NUL terminated names, back to back
+#define CACHE_SECTION_BOUNDS 5  // A single VertexBounds
+#define CACHE_SECTION_FACE_LIGHTMAPS 6  // FaceLightmap per face
+#define CACHE_SECTION_LIGHTMAP_PAGES 7  // LightmapPage per atlas page
+#define CACHE_SECTION_LIGHTMAP_TEXELS 8  // uint32_t RGBA8 texels of every page
+#define CACHE_SECTION_MODELS 9  // MapModel per brush model
+#define CACHE_SECTION_NORMALS 10  // glm::vec3 normal per vertex
+#define CACHE_SECTION_LIGHTMAP_UVS 11  // glm::vec2 lightmap page coordinates per vertex
+#define CACHE_SECTION_WIDE_INDICES 12  // uint32_t indices of models with index_size 4
+#define CACHE_SECTION_MESHLETS 13  // MapMeshlet per meshlet
+
+
+struct render_cache_section_t {
+  uint64_t file_offset;  // Where this section's data is located
+  uint64_t size;  // How many bytes the section takes up
+  uint64_t count;  // How many elements the section holds
+} __attribute__((packed));
+
+struct render_cache_header_t {
+  uint32_t file_identifier;  // Should be equal to RENDER_CACHE_IDENTIFIER
+  uint32_t version;  // Should be equal to RENDER_CACHE_VERSION
+  uint64_t source_hash;  // Content hash of the BSP this was built from
+  uint64_t source_size;  // Size of the BSP this was built from
+  render_cache_section_t sections[RENDER_CACHE_TOTAL_SECTIONS];
+} __attribute__((packed));
+
+#endif // RENDER_CACHE_FILE_H
@@ -0,0 +1,103 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Static props from the "sprp" game lump, grouped by model.
+ *
+ */
+
+#ifndef STATIC_PROPS_H
+#define STATIC_PROPS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <exception>
+#include <glm/glm.hpp>
+#include "bsp_file.h"
+#include "lump_view.h"
+
+class BSPParser;
+
+
+class StaticPropException : public std::exception {
+public:
+    StaticPropException(std::string msg) {
+        this->msg = msg;
+    }
+
+    const char* what() const throw() {
+        return this->msg.c_str();
+    }
+
+private:
+    std::string msg;
+};
+
+
+/* Every instance of one model, a run of the instance arrays */
+struct StaticPropGroup {
+    uint32_t model;  // Index into Models()
+    uint32_t first_instance;
+    uint32_t instance_count;
+};
+
+/* Per instance data, one array per field, sorted by model */
+struct StaticPropArrays {
+    std::vector<glm::mat4> transforms;  // Model to world, ready for an instance buffer
+    std::vector<glm::vec3> origins;
+    std::vector<glm::vec3> angles;  // Pitch, yaw, roll in degrees
+    std::vector<glm::vec2> fade;  // Fade start and end distance, end <= 0 never fades
+    std::vector<uint32_t> first_leaf;  // Index into Leaves()
+    std::vector<uint32_t> leaf_count;
+    std::vector<int32_t> skin;
+    std::vector<uint8_t> solid;
+    std::vector<uint8_t> flags;
+    std::vector<uint32_t> lump_index;  // Where the prop is in the game lump
+};
+
+
+/**
+ * The static props of a map, ready to be drawn instanced.
+ *
+ * The props are counting sorted by model while they're read, so every model's
+ * instances sit next to each other in the arrays and one draw call per group
+ * covers all of them.  Props keep their lump order within a group.
+ */
+class StaticProps {
+public:
+    StaticProps();
+    StaticProps(const LumpView<uint8_t>& data, uint16_t version);
+
+    static StaticProps FromBSP(BSPParser* parser);  // Empty if the map has no props
+
+    size_t Count() const;
+    const std::vector<std::string>& Models() const;  // Model paths, in dictionary order
+    const std::vector<uint16_t>& Leaves() const;  // Leafs each prop touches
+    const std::vector<StaticPropGroup>& Groups() const;  // Models with at least one instance
+    const StaticPropArrays& Instances() const;
+
+private:
+    std::vector<std::string> models;
+    std::vector<uint16_t> leaves;
+    std::vector<StaticPropGroup> groups;
+    StaticPropArrays instances;
+};
+
+#endif // STATIC_PROPS_H
@@ -23,6 +23,8 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include <stdint.h>
+#include <stddef.h>
 #include <string>
 #include <exception>
 #include <glad/glad.h>
@@ -46,6 +48,8 @@ private:
 class Texture {
 public:
     Texture(const std::string& texture_file, bool flip=false);
+    Texture(const uint8_t* image_data, size_t image_len, bool flip=false);
+    Texture(const uint32_t* rgba, int width, int height);
 
     void Use(GLenum active_texture=GL_TEXTURE0);
 
@@ -54,6 +58,9 @@ private:
     int width;
     int height;
     int channels;
+
+    void CreateFromImage(unsigned char* data);
+    void Create(const unsigned char* data, GLenum wrap, bool mipmaps);
 };
 
 
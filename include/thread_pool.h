@@ -0,0 +1,88 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Fixed size pool of worker threads.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <exception>
+#include <condition_variable>
+
+#define THREAD_POOL_CHUNKS_PER_THREAD 8  // ParallelFor tasks per pool thread, for balance
+
+/**
+ * Runs submitted tasks on a fixed set of worker threads.  Wait() blocks until
+ * every task submitted so far has finished, and rethrows the first exception
+ * any of them threw.  Don't call Wait() from inside a task.
+ *
+ * Each worker has its own queue.  Tasks submitted from outside the pool are
+ * dealt out round robin, tasks submitted by a task go on that worker's queue.
+ * Workers take their newest task first and, once they run dry, steal the
+ * oldest task from another worker, so uneven work (like maps of very
+ * different sizes) still keeps every core busy.
+ *
+ * ParallelFor() covers the common case of a range of independent items: it
+ * splits them into chunks across a pool, or runs them inline without one.
+ */
+class ThreadPool {
+public:
+    ThreadPool(unsigned int num_threads=0);  // 0 means one per core
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Submit(std::function<void()> task);
+    void Wait();
+    unsigned int Size() const;
+
+    static void ParallelFor(ThreadPool* pool, size_t count,
+                            const std::function<void(size_t, size_t)>& fn);
+
+private:
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::atomic<size_t> next_queue;  // Where the next outside task goes
+    std::mutex lock;
+    std::condition_variable task_ready;
+    std::condition_variable tasks_done;
+    size_t queued;  // Tasks sitting in a queue
+    size_t pending;  // Tasks submitted but not finished yet
+    bool stopping;
+    std::exception_ptr error;
+
+    bool TakeTask(size_t worker, std::function<void()>& task);
+    void WorkerLoop(size_t worker);
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,64 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Bulk conversion of the vertex lump into render ready buffers.
+ *
+ * Converting the vertices also works out the map's bounding box and checks
+ * for NaN/Inf coordinates, all in the same pass over the lump.  There are
+ * SSE and AVX2 versions on x86 (AVX2 is picked at runtime if the CPU has it)
+ * and a plain C++ fallback everywhere else.
+ */
+
+#ifndef VERTEX_CONVERT_H
+#define VERTEX_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <glm/glm.hpp>
+#include "bsp_file.h"
+#include "lump_view.h"
+
+
+enum VertexConvertPath {
+    CONVERT_BEST,  // Fastest path the CPU supports
+    CONVERT_SCALAR,
+    CONVERT_SSE,
+    CONVERT_AVX2
+};
+
+
+struct VertexBounds {
+    glm::vec3 mins;  // Bounds of the finite vertices
+    glm::vec3 maxs;
+    size_t non_finite;  // Vertices with a NaN or Inf coordinate
+};
+
+
+/* Interleaved output, out must have room for in.size() vertices */
+VertexBounds ConvertVertices(const LumpView<bsp_vertex_t>& in, glm::vec3* out,
+                             VertexConvertPath path=CONVERT_BEST);
+
+/* One array per axis, each must have room for in.size() floats */
+VertexBounds ConvertVerticesSoA(const LumpView<bsp_vertex_t>& in, float* xs,
+                                float* ys, float* zs,
+                                VertexConvertPath path=CONVERT_BEST);
+
+bool VertexConvertPathSupported(VertexConvertPath path);
+
+#endif // VERTEX_CONVERT_H
@@ -0,0 +1,96 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Per corner vertex normals for every face in a map.
+ *
+ * vrad bakes smoothed normals into LUMP_VERTNORMALS and
+ * LUMP_VERTNORMALINDICES, so most maps only need those looked up.  Maps
+ * that were never lit don't have them, and get the same smoothing done here
+ * instead.
+ */
+
+#ifndef VERTEX_NORMALS_H
+#define VERTEX_NORMALS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <exception>
+#include <glm/glm.hpp>
+#include "bsp_file.h"
+#include "lump_view.h"
+
+class BSPParser;
+class ThreadPool;
+
+
+class VertexNormalException : public std::exception {
+public:
+    VertexNormalException(std::string msg) {
+        this->msg = msg;
+    }
+
+    const char* what() const throw() {
+        return this->msg.c_str();
+    }
+
+private:
+    std::string msg;
+};
+
+
+/**
+ * One normal for each corner of each face, faces in lump order and each
+ * face's corners in surfedge order.  A corner sits on the start vertex of
+ * its surfedge.
+ *
+ * Recompute() does what vrad does: a corner's normal is the sum of the
+ * normals of every face on its vertex that shares a smoothing group with
+ * the corner's face.  Faces are split into chunks on the pool, and each
+ * chunk only writes its own corners.  It doesn't bounds check anything, so
+ * the lumps need to have passed GeometryReport::Validate() first.
+ */
+class VertexNormals {
+public:
+    VertexNormals(const LumpView<bsp_vertnormal_t>& normals,
+                  const LumpView<bsp_vertnormal_index_t>& normal_indices,
+                  const LumpView<bsp_face_t>& faces);
+    static VertexNormals Recompute(const LumpView<bsp_vertex_t>& vertices,
+                                   const LumpView<bsp_edge_t>& edges,
+                                   const LumpView<bsp_surfedge_t>& surfedges,
+                                   const LumpView<bsp_face_t>& faces,
+                                   ThreadPool* pool=nullptr);
+    static VertexNormals FromBSP(BSPParser* parser, ThreadPool* pool=nullptr);  // Recomputes if the lumps are missing
+
+    const std::vector<glm::vec3>& Normals() const;
+    uint32_t FaceCorner(size_t face) const;  // Index of the face's first corner
+    bool Recomputed() const;
+
+private:
+    VertexNormals();
+
+    std::vector<uint32_t> face_corners;  // One more than there are faces
+    std::vector<glm::vec3> normals;
+    bool recomputed;
+
+    void countCorners(const LumpView<bsp_face_t>& faces);
+};
+
+#endif // VERTEX_NORMALS_H
@@ -0,0 +1,63 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Merges vertices whose attributes are identical.
+ *
+ * Every face gets its own copy of its corners, so neighbouring faces that
+ * agree on a corner's normal and lightmap coordinates end up storing the
+ * same vertex twice.  Welding hashes each vertex's attributes and hands
+ * back one ID per distinct vertex, which is what decides whether a batch
+ * fits 16 bit indices.
+ */
+
+#ifndef VERTEX_WELD_H
+#define VERTEX_WELD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+/* Everything a vertex carries, two vertices weld when all of it matches */
+struct WeldVertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 lightmap_uv;
+};
+
+
+/**
+ * Open addressed hash table of the distinct vertices seen so far.  IDs
+ * count up from 0 in the order vertices are first seen.
+ */
+class VertexWelder {
+public:
+    VertexWelder(size_t max_vertices);  // Most vertices that will be passed to Weld
+
+    uint32_t Weld(const WeldVertex& vertex);  // ID of the vertex, adding it if it's new
+    const std::vector<WeldVertex>& Vertices() const;  // Indexed by ID, with -0 folded into 0
+
+private:
+    std::vector<WeldVertex> vertices;
+    std::vector<uint32_t> slots;  // Vertex ID, or WELD_EMPTY_SLOT
+    size_t mask;
+};
+
+#endif // VERTEX_WELD_H
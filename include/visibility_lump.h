@@ -0,0 +1,133 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Potentially visible sets from a map's visibility lump.
+ *
+ */
+
+#ifndef VISIBILITY_LUMP_H
+#define VISIBILITY_LUMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <exception>
+#include <unordered_map>
+#include "lump_view.h"
+
+#define VIS_DEFAULT_BUDGET (64 * 1024 * 1024)  // Bytes of decompressed sets to keep around
+
+
+class VisibilityException : public std::exception {
+public:
+    VisibilityException(std::string msg) {
+        this->msg = msg;
+    }
+
+    const char* what() const throw() {
+        return this->msg.c_str();
+    }
+
+private:
+    std::string msg;
+};
+
+
+/**
+ * One bit per cluster.  Sets from a VisibilityLump are padded out to a
+ * multiple of 4 words with the padding bits clear, so the SIMD helpers
+ * never hit their tail loops on them, but the helpers take any size.
+ */
+typedef std::vector<uint64_t> ClusterBits;
+
+/* Set helpers, all sets have to be the same size */
+void ClusterBitsUnion(ClusterBits* dst, const ClusterBits& src);
+void ClusterBitsIntersect(ClusterBits* dst, const ClusterBits& src);
+size_t ClusterBitsCount(const ClusterBits& bits);
+
+inline bool ClusterBitsTest(const ClusterBits& bits, size_t cluster) {
+    return (bits[cluster / 64] >> (cluster % 64)) & 1;
+}
+
+
+struct VisibilityStats {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t cached_sets;
+    size_t cached_bytes;
+};
+
+
+/**
+ * PVS data from LUMP_VISIBILITY.
+ *
+ * Every cluster's visible set is stored run length compressed, and fully
+ * decompressing all of them on a big map takes hundreds of MB.  So a set is
+ * only decompressed the first time it's asked for, and decompressed sets are
+ * kept in an LRU cache that's capped at a byte budget.  Sets are handed out
+ * as shared pointers, so one that gets evicted stays alive for as long as
+ * someone is still using it.
+ *
+ * Safe to query from multiple threads.  Like the lump views, it's only valid
+ * while the lump data is.
+ */
+class VisibilityLump {
+public:
+    VisibilityLump(const LumpView<uint8_t>& data, size_t budget_bytes=VIS_DEFAULT_BUDGET);
+
+    size_t ClusterCount() const;
+    size_t SetBytes() const;  // Size of one decompressed set
+
+    /* Clusters visible from a cluster.  A negative cluster (outside the map
+       or in a leaf vis wasn't run on) sees everything */
+    std::shared_ptr<const ClusterBits> PVS(int32_t cluster) const;
+    bool CanSee(int32_t from, int32_t to) const;
+
+    /* Union of the PVS of several clusters, e.g. a cluster and its neighbors */
+    ClusterBits UnionPVS(const std::vector<int32_t>& clusters) const;
+
+    void SetBudget(size_t budget_bytes);
+    VisibilityStats Stats() const;
+
+private:
+    typedef std::list<std::pair<int32_t, std::shared_ptr<const ClusterBits>>> LRUList;
+
+    LumpView<uint8_t> data;
+    size_t num_clusters;
+    size_t num_words;
+    std::vector<uint32_t> pvs_offsets;
+    std::shared_ptr<const ClusterBits> everything;
+
+    /* Cache state, guarded by lock */
+    mutable std::mutex lock;
+    mutable LRUList lru;  // Most recently used first
+    mutable std::unordered_map<int32_t, LRUList::iterator> cached;
+    mutable VisibilityStats stats;
+    size_t budget;
+
+    std::shared_ptr<const ClusterBits> decompress(int32_t cluster) const;
+    void evict() const;
+};
+
+#endif // VISIBILITY_LUMP_H
@@ -0,0 +1,599 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Benchmarks for the map loading pipeline
+ *
+ * Each benchmark runs a stage of map loading against a real map several times
+ * and reports the best time, so the numbers can be compared between changes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <functional>
+#include <random>
+#include "bsp_parser.h"
+#include "bsp_tree.h"
+#include "lzma_lump.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "vertex_convert.h"
+#include "material_table.h"
+#include "lightmap_atlas.h"
+#include "displacement.h"
+#include "vertex_normals.h"
+#include "geometry_validator.h"
+#include "map_geometry.h"
+
+#define BENCH_ITERATIONS 5
+
+
+/**
+ * Runs a function a few times and returns the fastest run in milliseconds.
+ */
+double time_best(std::function<void()> func) {
+    double best = -1.0;
+
+    for (int i=0; i < BENCH_ITERATIONS; i++) {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        auto end = std::chrono::steady_clock::now();
+
+        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        if (best < 0.0 || ms < best) {
+            best = ms;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Serial vs parallel decoding of every lump in a map.
+ */
+int bench_decode(const std::string& path, unsigned int threads) {
+    std::vector<uint32_t> lumps;
+    ThreadPool pool(threads);
+
+    for (uint32_t i=0; i < BSP_TOTAL_LUMPS; i++) {
+        lumps.push_back(i);
+    }
+
+    printf("decode: %s, %u threads\n", path.c_str(), pool.Size());
+
+    BSPParser::Mode modes[] = { BSPParser::MODE_READ, BSPParser::MODE_MMAP };
+    const char* mode_names[] = { "read", "mmap" };
+    for (int m=0; m < 2; m++) {
+        double serial = time_best([&] {
+            BSPParser parser(path, modes[m], false);
+            parser.DecodeLumps(lumps);
+        });
+        double parallel = time_best([&] {
+            BSPParser parser(path, modes[m], false);
+            parser.DecodeLumps(lumps, &pool);
+        });
+
+        printf("  %s: serial %.3f ms, parallel %.3f ms, speedup %.2fx\n",
+               mode_names[m], serial, parallel, serial / parallel);
+    }
+
+    return 0;
+}
+
+/**
+ * Decompression throughput of a map's LZMA compressed lumps, one lump at a
+ * time and all of them at once across the pool.
+ */
+int bench_lzma(const std::string& path, unsigned int threads) {
+    MappedFile file(path);
+    bsp_header_t header;
+    std::vector<uint32_t> lumps;
+    size_t compressed = 0;
+    size_t decompressed = 0;
+    ThreadPool pool(threads);
+
+    if (file.Size() < sizeof(header)) {
+        throw BSPParserException("File is too small to be a bsp.");
+    }
+    memcpy(&header, file.Data(), sizeof(header));
+    BSPParser::CheckHeader(header);
+
+    /* Find the compressed lumps */
+    for (uint32_t i=0; i < BSP_TOTAL_LUMPS; i++) {
+        const bsp_lump_t& lump = header.lumps[i];
+        if ((uint64_t)lump.file_offset + lump.size > file.Size()) {
+            continue;
+        }
+        if (IsLZMALump(file.Data() + lump.file_offset, lump.size)) {
+            lumps.push_back(i);
+            compressed += lump.size;
+            decompressed += LZMALumpSize(file.Data() + lump.file_offset, lump.size);
+        }
+    }
+
+    printf("lzma: %s, %zu compressed lumps, %zu -> %zu bytes, %u threads\n",
+           path.c_str(), lumps.size(), compressed, decompressed, pool.Size());
+    if (lumps.empty()) {
+        return 0;
+    }
+
+    auto decompress = [&](uint32_t lump_type) {
+        const bsp_lump_t& lump = header.lumps[lump_type];
+        DecompressLZMALump(file.Data() + lump.file_offset, lump.size);
+    };
+
+    double serial = time_best([&] {
+        for (uint32_t lump_type : lumps) {
+            decompress(lump_type);
+        }
+    });
+    double parallel = time_best([&] {
+        for (uint32_t lump_type : lumps) {
+            pool.Submit([&, lump_type] { decompress(lump_type); });
+        }
+        pool.Wait();
+    });
+
+    double mb = decompressed / (1024.0 * 1024.0);
+    printf("  serial:   %.3f ms, %.1f MB/s\n", serial, mb / (serial / 1000.0));
+    printf("  parallel: %.3f ms, %.1f MB/s, speedup %.2fx\n",
+           parallel, mb / (parallel / 1000.0), serial / parallel);
+
+    return 0;
+}
+
+/**
+ * Vertex lump conversion throughput for each code path, into interleaved
+ * and per axis buffers.
+ */
+int bench_vertices(const std::string& path) {
+    BSPParser parser(path, BSPParser::MODE_MMAP, false);
+    parser.DecodeLumps({ LUMP_VERTEXES });
+    const LumpView<bsp_vertex_t>& vertices = parser.Vertices();
+
+    std::vector<glm::vec3> aos(vertices.size());
+    std::vector<float> xs(vertices.size()), ys(vertices.size()), zs(vertices.size());
+
+    printf("vertices: %s, %zu vertices\n", path.c_str(), vertices.size());
+    if (vertices.empty()) {
+        return 0;
+    }
+
+    VertexConvertPath paths[] = { CONVERT_SCALAR, CONVERT_SSE, CONVERT_AVX2 };
+    const char* path_names[] = { "scalar", "sse", "avx2" };
+    for (int p=0; p < 3; p++) {
+        if (!VertexConvertPathSupported(paths[p])) {
+            printf("  %-6s  not supported on this cpu\n", path_names[p]);
+            continue;
+        }
+
+        /* Run it over enough copies of the lump to get a measurable time */
+        int repeats = 1 + (16 * 1024 * 1024) / vertices.SizeBytes();
+        double aos_ms = time_best([&] {
+            for (int i=0; i < repeats; i++) {
+                ConvertVertices(vertices, aos.data(), paths[p]);
+            }
+        }) / repeats;
+        double soa_ms = time_best([&] {
+            for (int i=0; i < repeats; i++) {
+                ConvertVerticesSoA(vertices, xs.data(), ys.data(), zs.data(), paths[p]);
+            }
+        }) / repeats;
+
+        double mb = vertices.SizeBytes() / (1024.0 * 1024.0);
+        printf("  %-6s  aos %.4f ms (%.0f MB/s), soa %.4f ms (%.0f MB/s)\n", path_names[p],
+               aos_ms, mb / (aos_ms / 1000.0), soa_ms, mb / (soa_ms / 1000.0));
+    }
+
+    return 0;
+}
+
+/**
+ * Entity lump parsing time, with the lump already read in so only the
+ * tokenizing and indexing get timed.
+ */
+int bench_entities(const std::string& path) {
+    BSPParser parser(path, BSPParser::MODE_MMAP, false);
+    LumpView<uint8_t> data = parser.LumpData(LUMP_ENTITIES);
+    size_t count = 0;
+
+    double ms = time_best([&] {
+        EntityLump entities(data);
+        count = entities.Count();
+    });
+
+    printf("entities: %s, %zu entities, %zu bytes\n", path.c_str(), count, data.size());
+    printf("  parse: %.4f ms, %.1f M entities/s, %.1f MB/s\n", ms,
+           count / (ms / 1000.0) / 1e6, data.size() / (1024.0 * 1024.0) / (ms / 1000.0));
+
+    return 0;
+}
+
+/**
+ * Point in leaf lookups per second, for random points inside the map, one
+ * at a time and batched.
+ */
+int bench_tree(const std::string& path) {
+    BSPParser parser(path, BSPParser::MODE_MMAP, false);
+    BSPTree tree = BSPTree::FromBSP(&parser);
+    const size_t num_points = 1000000;
+
+    printf("tree: %s, %zu nodes, %zu leafs\n", path.c_str(), tree.NodeCount(), tree.LeafCount());
+    if (tree.NodeCount() == 0) {
+        return 0;
+    }
+
+    /* Scatter points through the root node's bounds */
+    const BSPTreeNodeInfo& root = tree.NodeInfo()[0];
+    std::mt19937 rng(1);
+    std::vector<glm::vec3> points(num_points);
+    for (glm::vec3& point : points) {
+        for (int axis=0; axis < 3; axis++) {
+            std::uniform_real_distribution<float> coord(root.mins[axis], root.maxs[axis]);
+            point[axis] = coord(rng);
+        }
+    }
+
+    std::vector<int32_t> leafs(num_points);
+    double single = time_best([&] {
+        for (size_t i=0; i < num_points; i++) {
+            leafs[i] = tree.FindLeaf(points[i]);
+        }
+    });
+    double batched = time_best([&] {
+        tree.FindLeafs(points.data(), num_points, leafs.data());
+    });
+
+    printf("  single:  %.3f ms, %.1f M lookups/s\n", single, num_points / (single / 1000.0) / 1e6);
+    printf("  batched: %.3f ms, %.1f M lookups/s\n", batched, num_points / (batched / 1000.0) / 1e6);
+
+    return 0;
+}
+
+/**
+ * PVS decompression, cache hits, set operations, and how the LRU copes when
+ * its budget only holds part of the map.
+ */
+int bench_vis(const std::string& path) {
+    BSPParser parser(path, BSPParser::MODE_MMAP, false);
+    LumpView<uint8_t> data = parser.LumpData(LUMP_VISIBILITY);
+    VisibilityLump vis(data);
+    size_t clusters = vis.ClusterCount();
+    size_t full_bytes = clusters * vis.SetBytes();
+
+    printf("vis: %s, %zu clusters, %zu bytes compressed, %.1f MB decompressed\n",
+           path.c_str(), clusters, data.size(), full_bytes / (1024.0 * 1024.0));
+    if (clusters == 0) {
+        return 0;
+    }
+
+    double cold = time_best([&] {
+        VisibilityLump fresh(data);
+        for (size_t i=0; i < clusters; i++) {
+            fresh.PVS(i);
+        }
+    });
+    printf("  decompress: %.3f us per set\n", cold * 1000.0 / clusters);
+
+    /* Random lookups, everything fits */
+    const size_t lookups = 1000000;
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int32_t> pick(0, clusters - 1);
+    std::vector<int32_t> order(lookups);
+    for (int32_t& cluster : order) {
+        cluster = pick(rng);
+    }
+    double warm = time_best([&] {
+        for (int32_t cluster : order) {
+            vis.PVS(cluster);
+        }
+    });
+    printf("  cached lookup: %.1f ns\n", warm * 1e6 / lookups);
+
+    /* A cluster and 8 neighbors, then counting what's visible */
+    size_t visible = 0;
+    double unions = time_best([&] {
+        for (size_t i=0; i < 10000; i++) {
+            std::vector<int32_t> group;
+            for (int n=0; n < 9; n++) {
+                group.push_back(order[(i * 9 + n) % lookups]);
+            }
+            ClusterBits merged = vis.UnionPVS(group);
+            visible += ClusterBitsCount(merged);
+        }
+    });
+    printf("  union of 9 + popcount: %.2f us\n", unions * 1000.0 / 10000);
+
+    /* Budget for an eighth of the sets */
+    VisibilityLump limited(data, full_bytes / 8);
+    time_best([&] {
+        for (int32_t cluster : order) {
+            limited.PVS(cluster);
+        }
+    });
+    VisibilityStats stats = limited.Stats();
+    printf("  1/8 budget: %.1f%% hits, %zu sets cached (%.1f MB), %zu evictions\n",
+           100.0 * stats.hits / (stats.hits + stats.misses), stats.cached_sets,
+           stats.cached_bytes / (1024.0 * 1024.0), stats.evictions);
+
+    return 0;
+}
+
+/**
+ * Lightmap sample decoding per SIMD path, then the whole atlas build (packing
+ * and decoding) serial vs across the pool.
+ */
+int bench_lightmaps(const std::string& path, unsigned int threads) {
+    BSPParser parser(path, BSPParser::MODE_MMAP, false);
+    const LumpView<uint8_t>& lighting = parser.Lighting();
+    MaterialTable materials = MaterialTable::FromBSP(&parser);
+    ThreadPool pool(threads);
+
+    size_t samples = lighting.size() / 4;
+    printf("lightmaps: %s, %zu samples, %u threads\n", path.c_str(), samples, pool.Size());
+    if (samples == 0) {
+        return 0;
+    }
+
+    std::vector<uint32_t> texels(samples);
+    LightmapDecodePath paths[] = { DECODE_SCALAR, DECODE_SSE, DECODE_AVX2 };
+    const char* path_names[] = { "scalar", "sse", "avx2" };
+    for (int p=0; p < 3; p++) {
+        if (!LightmapDecodePathSupported(paths[p])) {
+            printf("  %-6s  not supported on this cpu\n", path_names[p]);
+            continue;
+        }
+
+        double ms = time_best([&] {
+            DecodeLightmapSamples(lighting.Bytes(), texels.data(), samples, paths[p]);
+        });
+        printf("  %-6s  %.4f ms, %.1f M samples/s\n", path_names[p], ms, samples / (ms / 1000.0) / 1e6);
+    }
+
+    double serial = time_best([&] {
+        LightmapAtlas atlas = LightmapAtlas::FromBSP(&parser, materials.Texinfo());
+    });
+    double parallel = time_best([&] {
+        LightmapAtlas atlas = LightmapAtlas::FromBSP(&parser, materials.Texinfo(), &pool);
+    });
+
+    LightmapAtlas atlas = LightmapAtlas::FromBSP(&parser, materials.Texinfo(), &pool);
+    printf("  atlas: %zu lit faces, %zu pages, %.1f%% occupied\n", atlas.LitFaces(),
+           atlas.Pages().size(),
+           100.0 * atlas.Occupancy());
+    printf("  build: serial %.3f ms, parallel %.3f ms, speedup %.2fx\n",
+           serial, parallel, serial / parallel);
+
+    return 0;
+}
+
+/**
+ * Displacement tessellation, serial vs one job per chunk of surfaces.
+ */
+int bench_displacements(const std::string& path, unsigned int threads) {
+    BSPParser parser(path, BSPParser::MODE_MMAP, false);
+    Displacements displacements = Displacements::FromBSP(&parser);
+    ThreadPool pool(threads);
+
+    printf("displacements: %s, %zu surfaces, %zu vertices, %zu indices, %u threads\n",
+           path.c_str(), displacements.Count(), displacements.VertexCount(),
+           displacements.IndexCount(), pool.Size());
+    if (displacements.Count() == 0) {
+        return 0;
+    }
+
+    std::vector<glm::vec3> positions(displacements.VertexCount());
+    std::vector<glm::vec3> normals(displacements.VertexCount());
+    std::vector<uint16_t> indices(displacements.IndexCount());
+
+    double serial = time_best([&] {
+        displacements.Tessellate(positions.data(), normals.data(), indices.data());
+    });
+    double parallel = time_best([&] {
+        displacements.Tessellate(positions.data(), normals.data(), indices.data(), &pool);
+    });
+
+    printf("  serial %.3f ms (%.1f M vertices/s), parallel %.3f ms, speedup %.2fx\n",
+           serial, displacements.VertexCount() / (serial / 1000.0) / 1e6, parallel,
+           serial / parallel);
+
+    return 0;
+}
+
+/**
+ * Vertex normals, looked up out of the lumps vs recomputed serially and in
+ * parallel.
+ */
+int bench_normals(const std::string& path, unsigned int threads) {
+    BSPParser parser(path, BSPParser::MODE_MMAP, false);
+    ThreadPool pool(threads);
+
+    /* Recomputing trusts its input, so make sure it's sane first */
+    GeometryReport report = GeometryReport::Validate(&parser);
+    if (!report.Certified()) {
+        throw GeometryValidationException(report);
+    }
+
+    bool has_lumps = !parser.VertNormals().empty() && !parser.VertNormalIndices().empty();
+    printf("normals: %s, %zu faces, %zu normals in the lump, %u threads\n", path.c_str(),
+           parser.Faces().size(), parser.VertNormals().size(), pool.Size());
+
+    if (has_lumps) {
+        double lookup = time_best([&] {
+            VertexNormals normals(parser.VertNormals(), parser.VertNormalIndices(), parser.Faces());
+        });
+        printf("  lookup: %.3f ms\n", lookup);
+    }
+
+    double serial = time_best([&] {
+        VertexNormals::Recompute(parser.Vertices(), parser.Edges(), parser.Surfedges(),
+                                 parser.Faces());
+    });
+    double parallel = time_best([&] {
+        VertexNormals::Recompute(parser.Vertices(), parser.Edges(), parser.Surfedges(),
+                                 parser.Faces(), &pool);
+    });
+    printf("  recompute: serial %.3f ms, parallel %.3f ms, speedup %.2fx\n",
+           serial, parallel, serial / parallel);
+
+    return 0;
+}
+
+/**
+ * Whole map geometry builds on 1 to N threads, checking every build comes
+ * out the same as the single threaded one.
+ */
+int bench_geometry(const std::string& path, unsigned int threads) {
+    BSPParser parser(path, BSPParser::MODE_MMAP, false);
+    unsigned int max_threads = ThreadPool(threads).Size();
+
+    MapGeometry reference = MapGeometry::FromBSP(&parser);
+    printf("geometry: %s, %zu faces, %zu vertices, %zu indices, 1 to %u threads\n",
+           path.c_str(), reference.face_ranges.size(), reference.vertices.size(),
+           reference.indices.size() + reference.wide_indices.size(), max_threads);
+
+    double single = 0.0;
+    for (unsigned int count=1; count <= max_threads; count++) {
+        ThreadPool pool(count);
+        MapGeometry geometry;
+        double ms = time_best([&] {
+            geometry = MapGeometry::FromBSP(&parser, &pool);
+        });
+        if (count == 1) {
+            single = ms;
+        }
+
+        bool same = geometry.vertices == reference.vertices &&
+                    geometry.normals == reference.normals &&
+                    geometry.lightmap_uvs == reference.lightmap_uvs &&
+                    geometry.indices == reference.indices &&
+                    geometry.wide_indices == reference.wide_indices;
+        printf("  %2u threads: %.3f ms, speedup %.2fx%s\n", count, ms, single / ms,
+               same ? "" : ", output differs from 1 thread!");
+        if (!same) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Post transform cache use of the map's indices as built vs optimized, and
+ * what the optimization costs at load time.
+ */
+int bench_optimize(const std::string& path, unsigned int threads) {
+    BSPParser parser(path, BSPParser::MODE_MMAP, false);
+    ThreadPool pool(threads);
+    MapGeometry plain;
+    MapGeometry optimized;
+
+    double plain_ms = time_best([&] {
+        plain = MapGeometry::FromBSP(&parser, &pool, false);
+    });
+    double optimized_ms = time_best([&] {
+        optimized = MapGeometry::FromBSP(&parser, &pool, true);
+    });
+
+    VertexCacheStats before = plain.AnalyzeVertexCache();
+    VertexCacheStats after = optimized.AnalyzeVertexCache();
+    printf("optimize: %s, %zu triangles, %zu vertices, %u entry FIFO cache\n", path.c_str(),
+           before.triangles, before.vertices, MESH_CACHE_SIZE);
+    printf("  as built:  ACMR %.3f, ATVR %.3f\n", before.acmr, before.atvr);
+    printf("  optimized: ACMR %.3f, ATVR %.3f\n", after.acmr, after.atvr);
+    printf("  build: %.3f ms plain, %.3f ms optimized (+%.3f ms)\n", plain_ms, optimized_ms,
+           optimized_ms - plain_ms);
+
+    return 0;
+}
+
+void usage(const char* name) {
+    printf("Usage: %s <benchmark> <map.bsp> [threads]\n", name);
+    printf("Benchmarks:\n");
+    printf("  decode    serial vs parallel lump decoding\n");
+    printf("  lzma      compressed lump decompression throughput\n");
+    printf("  vertices  vertex lump conversion and bounds, per SIMD path\n");
+    printf("  entities  entity lump parsing and indexing\n");
+    printf("  tree      BSP tree point in leaf lookups\n");
+    printf("  vis       PVS decompression, caching and set operations\n");
+    printf("  lightmaps lightmap decoding per SIMD path and atlas building\n");
+    printf("  displacements  displacement tessellation, serial vs parallel\n");
+    printf("  normals   vertex normal lookup vs serial and parallel recompute\n");
+    printf("  geometry  whole map geometry build on 1 to N threads\n");
+    printf("  optimize  vertex cache ACMR/ATVR of the built vs optimized indices\n");
+}
+
+/**
+ * Entry point.
+ */
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::string bench = argv[1];
+    std::string path = argv[2];
+    unsigned int threads = (argc >= 4) ? atoi(argv[3]) : 0;
+
+    try {
+        if (bench == "decode") {
+            return bench_decode(path, threads);
+        }
+        if (bench == "lzma") {
+            return bench_lzma(path, threads);
+        }
+        if (bench == "vertices") {
+            return bench_vertices(path);
+        }
+        if (bench == "entities") {
+            return bench_entities(path);
+        }
+        if (bench == "tree") {
+            return bench_tree(path);
+        }
+        if (bench == "vis") {
+            return bench_vis(path);
+        }
+        if (bench == "lightmaps") {
+            return bench_lightmaps(path, threads);
+        }
+        if (bench == "displacements") {
+            return bench_displacements(path, threads);
+        }
+        if (bench == "normals") {
+            return bench_normals(path, threads);
+        }
+        if (bench == "geometry") {
+            return bench_geometry(path, threads);
+        }
+        if (bench == "optimize") {
+            return bench_optimize(path, threads);
+        }
+    } catch (std::exception& e) {
+        printf("Benchmark failed: %s\n", e.what());
+        return 1;
+    }
+
+    usage(argv[0]);
+    return 1;
+}
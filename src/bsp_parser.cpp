@@ -22,255 +22,477 @@
  */
 
 #include <stdio.h>
-#include <fstream>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
 #include "bsp_parser.h"
+#include "bsp_stream_parser.h"
+#include "lzma_lump.h"
 
 
-BSPParser::BSPParser(std::string path) {
-  std::ifstream file(path, std::ios::in | std::ios::ate | std::ios::binary);
-  uint8_t* data;
-  size_t data_len;
+BSPParser::BSPParser(std::string path, Mode mode, bool verbose) {
+  this->mode = mode;
+  this->verbose = verbose;
+  fd = -1;
 
-  /* Get file size */
-  file.seekg(0, file.end);
-  data_len = file.tellg();
-  file.seekg(0, file.beg);
-
-  /* Read file into a buffer */
-  data = new uint8_t[data_len];
-  file.read((char*)data, data_len);
-  file.close();
+  for (int i=0; i < BSP_TOTAL_LUMPS; i++) {
+    lump_streamed[i] = false;
+  }
 
-  processHeader(data, data_len);
+  if (mode == MODE_MMAP) {
+    /* Map the file, pages get pulled in as the lumps are touched */
+    try {
+      mapping.reset(new MappedFile(path));
+    } catch (MappedFileException& e) {
+      throw BSPParserException(e.what());
+    }
+    file_size = mapping->Size();
+  } else {
+    struct stat st;
+
+    /* Hang on to the file so lumps can be read out of it later */
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw BSPParserException("Failed to open " + path);
+    }
+    if (fstat(fd, &st) < 0) {
+      close(fd);
+      throw BSPParserException("Failed to stat " + path);
+    }
+    file_size = st.st_size;
+  }
 
-  delete data;  // TODO: delete data if an exception occurs and forward it
+  try {
+    processHeader();
+  } catch (...) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    throw;
+  }
 }
 
-void BSPParser::processHeader(uint8_t* data, size_t data_len) {
-  bsp_header_t* header;
+BSPParser::BSPParser(int stream_fd, const std::vector<uint32_t>& lump_types, bool verbose,
+                     size_t memory_limit) {
+  BSPStreamParser stream(stream_fd);
 
-  printf("Processing bsp header\n");
+  this->mode = MODE_STREAM;
+  this->verbose = verbose;
+  fd = -1;
 
-  if (sizeof(*header) > data_len) {
-    throw BSPParserException("Not enough data in buffer to hold header, file is probably invallid?");
+  for (int i=0; i < BSP_TOTAL_LUMPS; i++) {
+    lump_streamed[i] = false;
   }
 
-  /* Set header struct to point to its location in the file */
-  header = (bsp_header_t*)(data);
-  printf(" Header info: \n\t VERSION:  %i\n\t REVISION: %i\n",
-         header->version, header->map_revision);
-
-  /* Get file identifier and check it against the expected value */
-  if (header->file_identifier != BSP_FILE_IDENTIFIER) {
-    throw BSPParserException("Bad BSP file identifier.");
+  for (uint32_t lump_type : lump_types) {
+    stream.Request(lump_type);
   }
 
-  /* Check file version */
-  if (header->version < 17 || header->version > 29) {
-    // NOTE: Info on versions: https://developer.valvesoftware.com/wiki/Source_BSP_File_Format#Versions
-    throw BSPParserException("Unrecognized BSP file version.");
-  }
+  /* Every requested lump stays in memory, so check they fit before reading
+     any of them.  Compressed lumps hold their decompressed size in the fourCC
+     and keep their compressed bytes around while they're decompressed */
+  header = stream.ReadHeader();
+  bool counted[BSP_TOTAL_LUMPS] = {};
+  size_t needed = 0;
+  size_t largest_compressed = 0;
+  for (uint32_t lump_type : lump_types) {
+    const bsp_lump_t& lump = header.lumps[lump_type];
+    if (counted[lump_type]) {
+      continue;
+    }
+    counted[lump_type] = true;
 
-  for (int i=0; i < BSP_TOTAL_LUMPS; i++) {
-    processLump(data, data_len, i, &header->lumps[i]);
+    if (lump.identifier != 0) {
+      needed += lump.identifier;
+      largest_compressed = std::max<size_t>(largest_compressed, lump.size);
+    } else {
+      needed += lump.size;
+    }
+  }
+  needed += largest_compressed;
+  if (needed > memory_limit) {
+    throw BSPParserException("Requested lumps need " + std::to_string(needed)
+                             + " bytes, over the stream memory limit of "
+                             + std::to_string(memory_limit));
   }
+
+  /* Keep each lump's buffer and decode it as soon as it's off the stream.  The
+     decoded views point into these buffers, so all of them stay alive */
+  log("Processing bsp stream\n");
+  stream.Run([this, &stream](uint32_t lump_type, const bsp_lump_t& /*lump*/, std::vector<uint8_t>& data) {
+    file_size = stream.BytesRead();
+
+    lump_buffers[lump_type] = std::move(data);
+    lump_streamed[lump_type] = true;
+    decodeLump(lump_type);
+  });
+
+  header = stream.Header();
+  file_size = stream.BytesRead();
+  log(" Header info: \n\t VERSION:  %i\n\t REVISION: %i\n",
+      header.version, header.map_revision);
 }
 
-void BSPParser::processLump(uint8_t* data, size_t data_len, uint32_t lump_type, bsp_lump_t* lump) {
-  /* Make sure the location the lump indicates data is in is inside the file */
-  if (lump->file_offset >= data_len) {
-    throw BSPParserException("Not enough data in buffer to hold header, file is probably invallid?");
+BSPParser::~BSPParser() {
+  if (fd >= 0) {
+    close(fd);
   }
+}
+
+uint32_t BSPParser::Version() const {
+  return header.version;
+}
+
+uint32_t BSPParser::Revision() const {
+  return header.map_revision;
+}
+
+size_t BSPParser::FileSize() const {
+  return file_size;
+}
 
-  switch(lump_type) {
-  case LUMP_VERTEXES:
-    processVertexLump(data, data_len, lump);
-    break;
-  case LUMP_EDGES:
-    processEdgeLump(data, data_len, lump);
-    break;
-  case LUMP_SURFEDGES:
-    processSurfedgeLump(data, data_len, lump);
-    break;
-  case LUMP_FACES:
-    processFaceLump(data, data_len, lump);
-    break;
-  case LUMP_ENTITIES:
-  case LUMP_PLANES:
-  case LUMP_TEXDATA:
-  case LUMP_VISIBILITY:
-  case LUMP_NODES:
-  case LUMP_TEXINFO:
-  case LUMP_LIGHTING:
-  case LUMP_OCCLUSION:
-  case LUMP_LEAFS:
-  case LUMP_FACEIDS:
-  case LUMP_MODELS:
-  case LUMP_WORLDLIGHTS:
-  case LUMP_LEAFFACES:
-  case LUMP_LEAFBRUSHES:
-  case LUMP_BRUSHES:
-  case LUMP_BRUSHSIDES:
-  case LUMP_AREAS:
-  case LUMP_AREAPORTALS:
-    //case LUMP_PORTALS:
-    //case LUMP_UNUSED0:
-  case LUMP_PROPCOLLISION:
-    //case LUMP_CLUSTERS:
-    //case LUMP_UNUSED1:
-  case LUMP_PROPHULLS:
-    //case LUMP_PORTALVERTS:
-    //case LUMP_UNUSED2:
-  case LUMP_PROPHULLVERTS:
-    //case LUMP_CLUSTERPORTALS:
-    //case LUMP_UNUSED3:
-  case LUMP_PROPTRIS:
-  case LUMP_DISPINFO:
-  case LUMP_ORIGINALFACES:
-  case LUMP_PHYSDISP:
-  case LUMP_PHYSCOLLIDE:
-  case LUMP_VERTNORMALS:
-  case LUMP_VERTNORMALINDICES:
-  case LUMP_DISP_LIGHTMAP_ALPHAS:
-  case LUMP_DISP_VERTS:
-  case LUMP_DISP_LIGHTMAP_SAMPLE_POSITIONS:
-  case LUMP_GAME_LUMP:
-  case LUMP_LEAFWATERDATA:
-  case LUMP_PRIMITIVES:
-  case LUMP_PRIMVERTS:
-  case LUMP_PRIMINDICES:
-  case LUMP_PAKFILE:
-  case LUMP_CLIPPORTALVERTS:
-  case LUMP_CUBEMAPS:
-  case LUMP_TEXDATA_STRING_DATA:
-  case LUMP_TEXDATA_STRING_TABLE:
-  case LUMP_OVERLAYS:
-  case LUMP_LEAFMINDISTTOWATER:
-  case LUMP_FACE_MACRO_TEXTURE_INFO:
-  case LUMP_DISP_TRIS:
-  case LUMP_PHYSCOLLIDESURFACE:
-    //case LUMP_PROP_BLOB:
-  case LUMP_WATEROVERLAYS:
-  case LUMP_LIGHTMAPPAGES:
-  case LUMP_LEAF_AMBIENT_INDEX_HDR:
-  case LUMP_LIGHTMAPPAGEINFOS:
-  case LUMP_LEAF_AMBIENT_INDEX:
-  case LUMP_LIGHTING_HDR:
-  case LUMP_WORLDLIGHTS_HDR:
-  case LUMP_LEAF_AMBIENT_LIGHTING_HDR:
-  case LUMP_LEAF_AMBIENT_LIGHTING:
-  case LUMP_XZIPPAKFILE:
-  case LUMP_FACES_HDR:
-  case LUMP_MAP_FLAGS:
-  case LUMP_OVERLAY_FADES:
-  case LUMP_DISP_MULTIBLEND:
-    break;
-  default:
+const bsp_lump_t& BSPParser::LumpInfo(uint32_t lump_type) const {
+  if (lump_type >= BSP_TOTAL_LUMPS) {
     throw BSPParserException("Encountered unknown lump type.");
   }
+  return header.lumps[lump_type];
 }
 
-void BSPParser::processVertexLump(uint8_t* data, size_t data_len, bsp_lump_t* lump) {
-  bsp_vertex_t* verts;
-  size_t number_verts;
+LumpView<uint8_t> BSPParser::LumpData(uint32_t lump_type) {
+  return readLump(lump_type);
+}
 
-  printf("Processing vertex lump...\n");
+void BSPParser::DecodeLumps(const std::vector<uint32_t>& lump_types, ThreadPool* pool) {
+  for (uint32_t lump_type : lump_types) {
+    LumpInfo(lump_type);  // Reject bad lump types before anything is queued
 
-  /* Make sure lump values look ok */
-  if (data_len < lump->file_offset + lump->size) {
-    throw BSPParserException("Vertex lump doesn't seem to fit in the data buffer?");
+    if (pool == nullptr) {
+      decodeLump(lump_type);
+    } else {
+      pool->Submit([this, lump_type] { decodeLump(lump_type); });
+    }
   }
 
-  /* Sanity check more values */
-  if ((lump->size % sizeof(*verts)) != 0) {
-    throw BSPParserException("Vertex lumps are uneven");
+  if (pool != nullptr) {
+    pool->Wait();
   }
+}
+
+const LumpView<bsp_vertex_t>& BSPParser::Vertices() {
+  decodeLump(LUMP_VERTEXES);
+  return vertices;
+}
+
+const LumpView<bsp_edge_t>& BSPParser::Edges() {
+  decodeLump(LUMP_EDGES);
+  return map_edges;
+}
+
+const LumpView<bsp_surfedge_t>& BSPParser::Surfedges() {
+  decodeLump(LUMP_SURFEDGES);
+  return map_surfedges;
+}
+
+const LumpView<bsp_face_t>& BSPParser::Faces() {
+  decodeLump(LUMP_FACES);
+  return map_faces;
+}
+
+const LumpView<bsp_model_t>& BSPParser::Models() {
+  decodeLump(LUMP_MODELS);
+  return map_models;
+}
+
+const LumpView<bsp_vertnormal_t>& BSPParser::VertNormals() {
+  decodeLump(LUMP_VERTNORMALS);
+  return map_vert_normals;
+}
 
-  /* */
-  verts = (bsp_vertex_t*)(data + lump->file_offset);
-  number_verts = lump->size / sizeof(*verts);
+const LumpView<bsp_vertnormal_index_t>& BSPParser::VertNormalIndices() {
+  decodeLump(LUMP_VERTNORMALINDICES);
+  return map_vert_normal_indices;
+}
 
-  /* */
-  for (int i=0; i < number_verts; i++) {
-    //printf("\t VERTEX: %f %f %f\n", verts[i].x, verts[i].y, verts[i].z);
-    vertices.push_back({ verts[i].x, verts[i].y, verts[i].z });
+const LumpView<bsp_plane_t>& BSPParser::Planes() {
+  decodeLump(LUMP_PLANES);
+  return map_planes;
+}
+
+const LumpView<bsp_node_t>& BSPParser::Nodes() {
+  decodeLump(LUMP_NODES);
+  return map_nodes;
+}
+
+const LumpView<bsp_leaf_t>& BSPParser::Leafs() {
+  decodeLump(LUMP_LEAFS);
+  return map_leafs;
+}
+
+const LumpView<bsp_texinfo_t>& BSPParser::TexInfo() {
+  decodeLump(LUMP_TEXINFO);
+  return map_texinfo;
+}
+
+const LumpView<bsp_texdata_t>& BSPParser::TexData() {
+  decodeLump(LUMP_TEXDATA);
+  return map_texdata;
+}
+
+const LumpView<bsp_string_table_t>& BSPParser::TexDataStringTable() {
+  decodeLump(LUMP_TEXDATA_STRING_TABLE);
+  return map_string_table;
+}
+
+const LumpView<uint8_t>& BSPParser::TexDataStringData() {
+  decodeLump(LUMP_TEXDATA_STRING_DATA);
+  return map_string_data;
+}
+
+const LumpView<uint8_t>& BSPParser::Lighting() {
+  decodeLump(LUMP_LIGHTING);
+  return map_lighting;
+}
+
+const LumpView<bsp_dispinfo_t>& BSPParser::DispInfo() {
+  decodeLump(LUMP_DISPINFO);
+  return map_dispinfo;
+}
+
+const LumpView<bsp_disp_vert_t>& BSPParser::DispVerts() {
+  decodeLump(LUMP_DISP_VERTS);
+  return map_disp_verts;
+}
+
+const LumpView<bsp_disp_tri_t>& BSPParser::DispTris() {
+  decodeLump(LUMP_DISP_TRIS);
+  return map_disp_tris;
+}
+
+void BSPParser::log(const char* fmt, ...) {
+  va_list args;
+
+  if (!verbose) {
+    return;
   }
+
+  va_start(args, fmt);
+  vprintf(fmt, args);
+  va_end(args);
+}
+
+const PakFile& BSPParser::Pakfile() {
+  decodeLump(LUMP_PAKFILE);
+  return *pakfile;
+}
+
+const EntityLump& BSPParser::Entities() {
+  decodeLump(LUMP_ENTITIES);
+  return *entities;
 }
 
-void BSPParser::processEdgeLump(uint8_t* data, size_t data_len, bsp_lump_t* lump) {
-  bsp_edge_t* edges;
-  size_t number_edges;
+const VisibilityLump& BSPParser::Visibility() {
+  decodeLump(LUMP_VISIBILITY);
+  return *visibility;
+}
 
-  printf("Processing edge lump...\n");
+const GameLump& BSPParser::GameLumps() {
+  decodeLump(LUMP_GAME_LUMP);
+  return *game_lumps;
+}
 
-  /* Make sure edge values look ok */
-  if (data_len < lump->file_offset + lump->size) {
-      throw BSPParserException("Edge lump doesn't seem to fit in the data buffer?");
+void BSPParser::CheckHeader(const bsp_header_t& header) {
+  /* Get file identifier and check it against the expected value */
+  if (header.file_identifier != BSP_FILE_IDENTIFIER) {
+    throw BSPParserException("Bad BSP file identifier.");
   }
 
-  /* Sanity check more values */
-  if ((lump->size % sizeof(*edges)) != 0) {
-      throw BSPParserException("Edge lumps are uneven");
+  /* Check file version */
+  if (header.version < 17 || header.version > 29) {
+    // NOTE: Info on versions: https://developer.valvesoftware.com/wiki/Source_BSP_File_Format#Versions
+    throw BSPParserException("Unrecognized BSP file version.");
   }
+}
 
-  /* */
-  edges = (bsp_edge_t*)(data + lump->file_offset);
-  number_edges = lump->size / sizeof(*edges);
+void BSPParser::processHeader() {
+  log("Processing bsp header\n");
 
+  if (sizeof(header) > file_size) {
+    throw BSPParserException("Not enough data in buffer to hold header, file is probably invallid?");
+  }
 
-  for (int i=0; i < number_edges; i++) {
-      map_edges.push_back(edges[i]);
+  /* Copy the header out of the file, it's the only part we read up front */
+  if (mode == MODE_MMAP) {
+    memcpy(&header, mapping->Data(), sizeof(header));
+  } else if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+    throw BSPParserException("Failed to read bsp header.");
   }
+  log(" Header info: \n\t VERSION:  %i\n\t REVISION: %i\n",
+      header.version, header.map_revision);
+
+  CheckHeader(header);
 }
 
-void BSPParser::processSurfedgeLump(uint8_t* data, size_t data_len, bsp_lump_t* lump) {
-    bsp_surfedge_t* surfedges;
-    size_t number_surfedges;
+/**
+ * Gets at a lump's raw bytes, as they're stored in the file.
+ */
+const uint8_t* BSPParser::fetchLump(uint32_t lump_type, const bsp_lump_t* lump) {
+  /* Streamed lumps were all read in the constructor, we can't go back for more */
+  if (mode == MODE_STREAM) {
+    if (!lump_streamed[lump_type]) {
+      throw BSPParserException("Lump wasn't requested when the stream was read.");
+    }
+    return lump_buffers[lump_type].data();
+  }
 
-    printf("Processing surfedge lump...\n");
+  /* Make sure the location the lump indicates data is in is inside the file */
+  if (file_size < (uint64_t)lump->file_offset + lump->size) {
+    throw BSPParserException("Lump doesn't seem to fit in the file?");
+  }
 
-    /* Make sure edge values look ok */
-    if (data_len < lump->file_offset + lump->size) {
-        throw BSPParserException("Surfedge lump doesn't seem to fit in the data buffer?");
-    }
+  if (mode == MODE_MMAP) {
+    mapping->Prefetch(lump->file_offset, lump->size);
+    return mapping->Data() + lump->file_offset;
+  }
+
+  std::vector<uint8_t>& buffer = lump_buffers[lump_type];
+  buffer.resize(lump->size);
 
-    /* Sanity check more values */
-    if ((lump->size % sizeof(*surfedges)) != 0) {
-        throw BSPParserException("Surfedge lumps are uneven");
+  size_t done = 0;
+  while (done < lump->size) {
+    ssize_t amt = pread(fd, buffer.data() + done, lump->size - done,
+                        lump->file_offset + done);
+    if (amt <= 0) {
+      throw BSPParserException("Failed to read lump data.");
     }
+    done += amt;
+  }
+
+  return buffer.data();
+}
+
+/**
+ * Gets at a lump's contents, reading and decompressing it the first time
+ * it's asked for.
+ */
+const LumpView<uint8_t>& BSPParser::readLump(uint32_t lump_type) {
+  const bsp_lump_t* lump = &LumpInfo(lump_type);
 
-    /* */
-    surfedges = (bsp_surfedge_t*)(data + lump->file_offset);
-    number_surfedges = lump->size / sizeof(*surfedges);
+  std::call_once(lump_read[lump_type], [this, lump, lump_type] {
+    const uint8_t* raw = fetchLump(lump_type, lump);
 
+    if (!IsLZMALump(raw, lump->size)) {
+      lump_data[lump_type] = LumpView<uint8_t>(raw, lump->size);
+      return;
+    }
 
-    for (int i=0; i < number_surfedges; i++) {
-        map_surfedges.push_back(surfedges[i]);
+    /* The lump's fourCC holds the uncompressed size for compressed lumps */
+    size_t actual_size = LZMALumpSize(raw, lump->size);
+    if (lump->identifier != 0 && lump->identifier != actual_size) {
+      throw BSPParserException("Compressed lump size doesn't match the lump directory.");
     }
+
+    log("Decompressing lump %u (%u -> %zu bytes)...\n",
+        lump_type, lump->size, actual_size);
+    std::vector<uint8_t> decompressed = DecompressLZMALump(raw, lump->size);
+    lump_buffers[lump_type] = std::move(decompressed);
+    lump_data[lump_type] = LumpView<uint8_t>(lump_buffers[lump_type].data(),
+                                             lump_buffers[lump_type].size());
+  });
+
+  return lump_data[lump_type];
+}
+
+void BSPParser::decodeLump(uint32_t lump_type) {
+  LumpInfo(lump_type);  // Reject bad lump types before they index anything
+
+  /* If a decoder throws the lump is left undecoded and the next caller retries */
+  std::call_once(lump_decoded[lump_type], [this, lump_type] {
+    processLump(lump_type);
+  });
 }
 
-void BSPParser::processFaceLump(uint8_t* data, size_t data_len, bsp_lump_t* lump) {
-    bsp_face_t* faces;
-    size_t number_faces;
+void BSPParser::processLump(uint32_t lump_type) {
+  const LumpDecoder& decoder = lump_decoders[lump_type];
 
-    printf("Processing face lump...\n");
+  /* Nothing reads these lumps yet */
+  if (decoder.decode == nullptr) {
+    return;
+  }
 
-    /* Make sure edge values look ok */
-    if (data_len < lump->file_offset + lump->size) {
-        throw BSPParserException("Face lump doesn't seem to fit in the data buffer?");
+  log("Processing %s lump...\n", decoder.name);
+  (this->*decoder.decode)(lump_type, readLump(lump_type));
+}
+
+template <typename T, LumpView<T> BSPParser::*view>
+void BSPParser::decodeArray(uint32_t lump_type, const LumpView<uint8_t>& data) {
+  const LumpDecoder& decoder = lump_decoders[lump_type];
+
+  /* A newer version could lay its elements out differently than T does */
+  uint32_t version = LumpInfo(lump_type).version;
+  if (version > decoder.version) {
+    throw BSPParserException(std::string("The ") + decoder.name + " lump is version "
+                             + std::to_string(version) + ", newest supported is "
+                             + std::to_string(decoder.version));
+  }
+  if ((data.size() % sizeof(T)) != 0) {
+    throw BSPParserException(std::string("The ") + decoder.name + " lump is uneven");
+  }
+
+  /* Point the view at the elements in the file */
+  this->*view = LumpView<T>(data.Bytes(), data.size() / sizeof(T));
+}
+
+void BSPParser::processLeafLump(uint32_t lump_type, const LumpView<uint8_t>& data) {
+    uint32_t version = LumpInfo(lump_type).version;
+    log(" Leafs are version %u\n", version);
+
+    if (version >= 1) {
+        if ((data.size() % sizeof(bsp_leaf_t)) != 0) {
+            throw BSPParserException("The leaf lump is uneven");
+        }
+        map_leafs = LumpView<bsp_leaf_t>(data.Bytes(), data.size() / sizeof(bsp_leaf_t));
+        return;
     }
 
-    /* Sanity check more values */
-    if ((lump->size % sizeof(*faces)) != 0) {
-        throw BSPParserException("Face lumps are uneven");
+    /* Version 0 leafs carry ambient lighting we don't use, drop it so the
+       rest of the code only ever sees version 1 leafs */
+    if ((data.size() % BSP_LEAF_V0_SIZE) != 0) {
+        throw BSPParserException("The leaf lump is uneven");
     }
+    size_t number_leafs = data.size() / BSP_LEAF_V0_SIZE;
+    leaf_buffer.resize(number_leafs);
+    for (size_t i=0; i < number_leafs; i++) {
+        const uint8_t* leaf = data.Bytes() + i * BSP_LEAF_V0_SIZE;
+        memcpy(&leaf_buffer[i], leaf, offsetof(bsp_leaf_t, padding));
+        leaf_buffer[i].padding = 0;
+    }
+    map_leafs = LumpView<bsp_leaf_t>((const uint8_t*)leaf_buffer.data(), number_leafs);
+}
 
-    /* */
-    faces = (bsp_face_t*)(data + lump->file_offset);
-    number_faces = lump->size / sizeof(*faces);
+void BSPParser::processVisibilityLump(uint32_t /*lump_type*/, const LumpView<uint8_t>& data) {
+    /* Only the offsets are read now, sets are decompressed as they're used */
+    visibility.reset(new VisibilityLump(data));
+    log(" Map has %zu clusters\n", visibility->ClusterCount());
+}
 
+void BSPParser::processGameLump(uint32_t lump_type, const LumpView<uint8_t>& data) {
+    /* Just the directory, each game lump is picked apart by whatever uses it */
+    game_lumps.reset(new GameLump(data, LumpInfo(lump_type).file_offset));
+    log(" Map has %zu game lumps\n", game_lumps->Count());
+}
 
-    for (int i=0; i < number_faces; i++) {
-        map_faces.push_back(faces[i]);
-    }
+void BSPParser::processPakfileLump(uint32_t /*lump_type*/, const LumpView<uint8_t>& data) {
+    /* Index the zip's central directory, files are pulled out on demand */
+    pakfile.reset(new PakFile(data));
+    log(" Pakfile holds %zu files\n", pakfile->Count());
+}
+
+void BSPParser::processEntityLump(uint32_t /*lump_type*/, const LumpView<uint8_t>& data) {
+    /* Keys and values are views into the lump text, nothing gets copied */
+    entities.reset(new EntityLump(data));
+    log(" Map has %zu entities\n", entities->Count());
 }
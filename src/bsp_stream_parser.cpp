@@ -0,0 +1,127 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Reads lumps out of a BSP file that can only be read front to back.
+ *
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <algorithm>
+#include "bsp_stream_parser.h"
+#include "bsp_parser.h"
+
+#define STREAM_SKIP_CHUNK 65536
+
+
+BSPStreamParser::BSPStreamParser(int fd) {
+    this->fd = fd;
+    header_read = false;
+    bytes_read = 0;
+}
+
+void BSPStreamParser::Request(uint32_t lump_type) {
+    if (lump_type >= BSP_TOTAL_LUMPS) {
+        throw BSPParserException("Encountered unknown lump type.");
+    }
+
+    if (std::find(requested.begin(), requested.end(), lump_type) == requested.end()) {
+        requested.push_back(lump_type);
+    }
+}
+
+/**
+ * Reads and checks the header, which is at the front of the file.  Run()
+ * does this itself if it hasn't been done yet.
+ */
+const bsp_header_t& BSPStreamParser::ReadHeader() {
+    if (!header_read) {
+        readFully((uint8_t*)&header, sizeof(header));
+        BSPParser::CheckHeader(header);
+        header_read = true;
+    }
+    return header;
+}
+
+void BSPStreamParser::Run(LumpCallback callback) {
+    std::vector<uint8_t> data;
+
+    ReadHeader();
+
+    /* We can only move forward, so visit lumps in the order they're stored */
+    std::vector<uint32_t> order = requested;
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return header.lumps[a].file_offset < header.lumps[b].file_offset;
+    });
+
+    for (uint32_t lump_type : order) {
+        const bsp_lump_t& lump = header.lumps[lump_type];
+
+        if (lump.size == 0) {
+            data.clear();
+            callback(lump_type, lump, data);
+            continue;
+        }
+
+        /* Lumps normally don't share bytes, bail if these do since we can't go back */
+        if (lump.file_offset < bytes_read) {
+            throw BSPParserException("Lumps overlap, can't read them from a stream.");
+        }
+
+        skip(lump.file_offset - bytes_read);
+        data.resize(lump.size);
+        readFully(data.data(), lump.size);
+        callback(lump_type, lump, data);
+    }
+}
+
+const bsp_header_t& BSPStreamParser::Header() const {
+    return header;
+}
+
+size_t BSPStreamParser::BytesRead() const {
+    return bytes_read;
+}
+
+void BSPStreamParser::readFully(uint8_t* out, size_t amt) {
+    size_t done = 0;
+
+    while (done < amt) {
+        ssize_t got = read(fd, out + done, amt - done);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            throw BSPParserException("Stream ended before all the lump data was read.");
+        }
+        done += got;
+    }
+
+    bytes_read += amt;
+}
+
+void BSPStreamParser::skip(size_t amt) {
+    uint8_t scratch[STREAM_SKIP_CHUNK];
+
+    while (amt > 0) {
+        size_t chunk = std::min(amt, sizeof(scratch));
+        readFully(scratch, chunk);
+        amt -= chunk;
+    }
+}
@@ -0,0 +1,183 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief The map's BSP tree, laid out for fast traversal.
+ *
+ */
+
+#include "bsp_tree.h"
+#include "bsp_parser.h"
+
+#define FIND_LEAFS_LANES 8
+
+
+BSPTree::BSPTree(const LumpView<bsp_plane_t>& planes, const LumpView<bsp_node_t>& nodes,
+                 const LumpView<bsp_leaf_t>& leafs) {
+    this->nodes.resize(nodes.size());
+    this->node_info.resize(nodes.size());
+    this->leafs.resize(leafs.size());
+
+    for (size_t i=0; i < nodes.size(); i++) {
+        bsp_node_t node = nodes[i];
+
+        if (node.plane_index < 0 || (size_t)node.plane_index >= planes.size()) {
+            throw BSPTreeException("Node " + std::to_string(i) + " uses a plane that doesn't exist.");
+        }
+        for (int side=0; side < 2; side++) {
+            int32_t child = node.children[side];
+            if (child >= 0 && ((size_t)child <= i || (size_t)child >= nodes.size())) {
+                throw BSPTreeException("Node " + std::to_string(i) + " has a bad child node.");
+            }
+            if (child < 0 && (size_t)(-1 - (int64_t)child) >= leafs.size()) {
+                throw BSPTreeException("Node " + std::to_string(i) + " has a bad child leaf.");
+            }
+        }
+
+        bsp_plane_t plane = planes[node.plane_index];
+        BSPTreeNode& flat = this->nodes[i];
+        flat.normal[0] = plane.normal[0];
+        flat.normal[1] = plane.normal[1];
+        flat.normal[2] = plane.normal[2];
+        flat.dist = plane.dist;
+        flat.children[0] = node.children[0];
+        flat.children[1] = node.children[1];
+
+        BSPTreeNodeInfo& info = this->node_info[i];
+        for (int axis=0; axis < 3; axis++) {
+            info.mins[axis] = node.mins[axis];
+            info.maxs[axis] = node.maxs[axis];
+        }
+        info.first_face = node.first_face;
+        info.num_faces = node.num_faces;
+    }
+
+    for (size_t i=0; i < leafs.size(); i++) {
+        bsp_leaf_t leaf = leafs[i];
+        BSPTreeLeaf& flat = this->leafs[i];
+
+        flat.contents = leaf.contents;
+        flat.cluster = leaf.cluster;
+        flat.area = leaf.area_flags & 0x1FF;
+        for (int axis=0; axis < 3; axis++) {
+            flat.mins[axis] = leaf.mins[axis];
+            flat.maxs[axis] = leaf.maxs[axis];
+        }
+        flat.first_leaf_face = leaf.first_leaf_face;
+        flat.num_leaf_faces = leaf.num_leaf_faces;
+        flat.first_leaf_brush = leaf.first_leaf_brush;
+        flat.num_leaf_brushes = leaf.num_leaf_brushes;
+    }
+}
+
+BSPTree BSPTree::FromBSP(BSPParser* parser) {
+    return BSPTree(parser->Planes(), parser->Nodes(), parser->Leafs());
+}
+
+int32_t BSPTree::FindLeaf(const glm::vec3& point, int32_t head_node) const {
+    if (nodes.empty()) {
+        return leafs.empty() ? -1 : 0;
+    }
+    if (head_node < 0 || (size_t)head_node >= nodes.size()) {
+        throw BSPTreeException("Head node " + std::to_string(head_node) + " doesn't exist.");
+    }
+
+    /* Children were checked when the tree was built, so just walk */
+    int32_t index = head_node;
+    const BSPTreeNode* tree = nodes.data();
+    while (index >= 0) {
+        const BSPTreeNode& node = tree[index];
+        float dist = node.normal[0] * point.x + node.normal[1] * point.y +
+                     node.normal[2] * point.z - node.dist;
+        index = node.children[dist < 0.0f];
+    }
+
+    return -1 - index;
+}
+
+/**
+ * Walks FIND_LEAFS_LANES points down the tree together.  Each step's node
+ * loads are independent of each other, so the CPU can have several cache
+ * misses in flight instead of stalling on one point at a time.
+ */
+void BSPTree::FindLeafs(const glm::vec3* points, size_t count, int32_t* leafs,
+                        int32_t head_node) const {
+    if (nodes.empty()) {
+        for (size_t i=0; i < count; i++) {
+            leafs[i] = this->leafs.empty() ? -1 : 0;
+        }
+        return;
+    }
+    if (head_node < 0 || (size_t)head_node >= nodes.size()) {
+        throw BSPTreeException("Head node " + std::to_string(head_node) + " doesn't exist.");
+    }
+
+    const BSPTreeNode* tree = nodes.data();
+    size_t start = 0;
+    for (; start + FIND_LEAFS_LANES <= count; start += FIND_LEAFS_LANES) {
+        int32_t index[FIND_LEAFS_LANES];
+        int active = FIND_LEAFS_LANES;
+
+        for (int lane=0; lane < FIND_LEAFS_LANES; lane++) {
+            index[lane] = head_node;
+        }
+
+        while (active > 0) {
+            active = 0;
+            for (int lane=0; lane < FIND_LEAFS_LANES; lane++) {
+                if (index[lane] < 0) {
+                    continue;
+                }
+                const BSPTreeNode& node = tree[index[lane]];
+                const glm::vec3& point = points[start + lane];
+                float dist = node.normal[0] * point.x + node.normal[1] * point.y +
+                             node.normal[2] * point.z - node.dist;
+                index[lane] = node.children[dist < 0.0f];
+                active += index[lane] >= 0;
+            }
+        }
+
+        for (int lane=0; lane < FIND_LEAFS_LANES; lane++) {
+            leafs[start + lane] = -1 - index[lane];
+        }
+    }
+
+    for (; start < count; start++) {
+        leafs[start] = FindLeaf(points[start], head_node);
+    }
+}
+
+size_t BSPTree::NodeCount() const {
+    return nodes.size();
+}
+
+size_t BSPTree::LeafCount() const {
+    return leafs.size();
+}
+
+const std::vector<BSPTreeNode>& BSPTree::Nodes() const {
+    return nodes;
+}
+
+const std::vector<BSPTreeNodeInfo>& BSPTree::NodeInfo() const {
+    return node_info;
+}
+
+const std::vector<BSPTreeLeaf>& BSPTree::Leafs() const {
+    return leafs;
+}
@@ -0,0 +1,242 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Tessellates displacement surfaces into render ready grids.
+ *
+ * A displacement replaces a quad face with a grid of (2^power + 1)^2
+ * vertices.  The grid is spread bilinearly over the quad's corners, starting
+ * at whichever corner the dispinfo's start position is on, and each vertex is
+ * then pushed out along its own offset vector from the displacement vertex
+ * lump.
+ */
+
+#include <math.h>
+#include "displacement.h"
+#include "thread_pool.h"
+#include "bsp_parser.h"
+
+
+static DisplacementException surface_error(size_t face, const char* problem) {
+    return DisplacementException("Face " + std::to_string(face) + "'s displacement " + problem);
+}
+
+static glm::vec3 to_vec3(const float (&v)[3]) {
+    return glm::vec3(v[0], v[1], v[2]);
+}
+
+
+Displacements::Displacements(const LumpView<bsp_dispinfo_t>& dispinfo,
+                             const LumpView<bsp_disp_vert_t>& disp_verts,
+                             const LumpView<bsp_disp_tri_t>& disp_tris,
+                             const LumpView<bsp_face_t>& faces,
+                             const LumpView<bsp_surfedge_t>& surfedges,
+                             const LumpView<bsp_edge_t>& edges,
+                             const LumpView<bsp_vertex_t>& vertices) {
+    this->disp_verts = disp_verts;
+    face_surfaces.assign(faces.size(), DISPLACEMENT_NONE);
+    vertex_count = 0;
+    index_count = 0;
+
+    for (size_t i=0; i < faces.size(); i++) {
+        bsp_face_t face = faces[i];
+        if (face.disp_info == DISP_NO_INFO) {
+            continue;
+        }
+
+        if (face.disp_info >= dispinfo.size()) {
+            throw surface_error(i, "isn't in the dispinfo lump.");
+        }
+        bsp_dispinfo_t info = dispinfo[face.disp_info];
+        if (info.power < 1 || info.power > DISP_MAX_POWER) {
+            throw surface_error(i, "has an unsupported power.");
+        }
+        if (face.num_edges != 4) {
+            throw surface_error(i, "isn't on a quad.");
+        }
+
+        uint32_t side = (1u << info.power) + 1;
+        uint64_t grid_verts = (uint64_t)side * side;
+        uint64_t grid_tris = 2 * (uint64_t)(side - 1) * (side - 1);
+        if (info.disp_vert_start < 0 || info.disp_vert_start + grid_verts > disp_verts.size()) {
+            throw surface_error(i, "runs off the end of the displacement vertex lump.");
+        }
+        if (info.disp_tri_start < 0 || info.disp_tri_start + grid_tris > disp_tris.size()) {
+            throw surface_error(i, "runs off the end of the displacement triangle lump.");
+        }
+
+        DisplacementSurface surface;
+        surface.face = i;
+        surface.dispinfo = face.disp_info;
+        surface.power = info.power;
+
+        /* The base quad's corners, in winding order */
+        glm::vec3 corners[4];
+        for (int k=0; k < 4; k++) {
+            if ((uint64_t)face.first_edge + k >= surfedges.size()) {
+                throw surface_error(i, "has a surfedge outside the surfedge lump.");
+            }
+            int64_t surfedge = surfedges[face.first_edge + k];
+            if ((uint64_t)std::abs(surfedge) >= edges.size()) {
+                throw surface_error(i, "has an edge outside the edge lump.");
+            }
+            bsp_edge_t edge = edges[std::abs(surfedge)];
+            uint16_t vertex = surfedge >= 0 ? edge.v[0] : edge.v[1];
+            if (vertex >= vertices.size()) {
+                throw surface_error(i, "has a vertex outside the vertex lump.");
+            }
+            bsp_vertex_t v = vertices[vertex];
+            corners[k] = glm::vec3(v.x, v.y, v.z);
+        }
+
+        /* Start the grid at the corner nearest the start position */
+        glm::vec3 start = to_vec3(info.start_position);
+        int first = 0;
+        float nearest = INFINITY;
+        for (int k=0; k < 4; k++) {
+            glm::vec3 delta = corners[k] - start;
+            float distance = delta.x * delta.x + delta.y * delta.y + delta.z * delta.z;
+            if (distance < nearest) {
+                nearest = distance;
+                first = k;
+            }
+        }
+        for (int k=0; k < 4; k++) {
+            surface.corners[k] = corners[(first + k) % 4];
+        }
+
+        surface.first_vertex = vertex_count;
+        surface.vertex_count = grid_verts;
+        surface.first_index = index_count;
+        surface.index_count = (side - 1) * (side - 1) * 6;
+        vertex_count += surface.vertex_count;
+        index_count += surface.index_count;
+
+        face_surfaces[i] = surfaces.size();
+        surfaces.push_back(surface);
+        vert_starts.push_back(info.disp_vert_start);
+    }
+}
+
+Displacements Displacements::FromBSP(BSPParser* parser) {
+    return Displacements(parser->DispInfo(), parser->DispVerts(), parser->DispTris(),
+                         parser->Faces(), parser->Surfedges(), parser->Edges(),
+                         parser->Vertices());
+}
+
+size_t Displacements::Count() const {
+    return surfaces.size();
+}
+
+const std::vector<DisplacementSurface>& Displacements::Surfaces() const {
+    return surfaces;
+}
+
+uint32_t Displacements::FaceSurface(size_t face) const {
+    return face < face_surfaces.size() ? face_surfaces[face] : DISPLACEMENT_NONE;
+}
+
+size_t Displacements::VertexCount() const {
+    return vertex_count;
+}
+
+size_t Displacements::IndexCount() const {
+    return index_count;
+}
+
+void Displacements::Tessellate(glm::vec3* positions, glm::vec3* normals, uint16_t* indices,
+                               ThreadPool* pool) const {
+    /* Surfaces never share output, so chunks of them can run in any order */
+    ThreadPool::ParallelFor(pool, surfaces.size(), [&](size_t first, size_t last) {
+        for (size_t i=first; i < last; i++) {
+            tessellate(i, positions, normals, indices);
+        }
+    });
+}
+
+/**
+ * Builds one surface's grid, row by row from the first corner towards the
+ * second, then its normals and triangles.
+ */
+void Displacements::tessellate(size_t surface_index, glm::vec3* positions, glm::vec3* normals,
+                               uint16_t* indices) const {
+    const DisplacementSurface& surface = surfaces[surface_index];
+    const glm::vec3* corners = surface.corners;
+    uint32_t side = (1u << surface.power) + 1;
+    float step = 1.0f / (side - 1);
+    size_t vert = vert_starts[surface_index];
+
+    glm::vec3* out_positions = positions + surface.first_vertex;
+    for (uint32_t row=0; row < side; row++) {
+        glm::vec3 left = corners[0] + (corners[1] - corners[0]) * (row * step);
+        glm::vec3 right = corners[3] + (corners[2] - corners[3]) * (row * step);
+
+        for (uint32_t col=0; col < side; col++, vert++) {
+            bsp_disp_vert_t disp_vert = disp_verts[vert];
+            glm::vec3 base = left + (right - left) * (col * step);
+            *out_positions++ = base + to_vec3(disp_vert.vec) * disp_vert.dist;
+        }
+    }
+
+    /* Normals come from the differences across each vertex's neighbours,
+       flipped if the grid runs against the base face's winding.  Faces wind
+       clockwise seen from the front, so the front is against Newell's normal */
+    const glm::vec3* grid = positions + surface.first_vertex;
+    glm::vec3* out_normals = normals + surface.first_vertex;
+    glm::vec3 front = -glm::cross(corners[2] - corners[0], corners[3] - corners[1]);
+    float facing = glm::dot(glm::cross(corners[1] - corners[0], corners[3] - corners[0]), front) < 0.0f ? -1.0f : 1.0f;
+    for (uint32_t row=0; row < side; row++) {
+        uint32_t up = row > 0 ? row - 1 : row;
+        uint32_t down = row + 1 < side ? row + 1 : row;
+        for (uint32_t col=0; col < side; col++) {
+            uint32_t left = col > 0 ? col - 1 : col;
+            uint32_t right = col + 1 < side ? col + 1 : col;
+            glm::vec3 along_rows = grid[down * side + col] - grid[up * side + col];
+            glm::vec3 along_cols = grid[row * side + right] - grid[row * side + left];
+            glm::vec3 normal = glm::cross(along_rows, along_cols) * facing;
+            float length = glm::length(normal);
+            *out_normals++ = length > 1e-12f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+        }
+    }
+
+    /* Two triangles per cell, wound the same way as the base face.  The
+       diagonal flips from cell to cell like the engine does, so the grid
+       doesn't get a directional bias on curved surfaces */
+    uint16_t* out = indices + surface.first_index;
+    for (uint32_t row=0; row + 1 < side; row++) {
+        for (uint32_t col=0; col + 1 < side; col++) {
+            uint16_t corner = row * side + col;
+            if ((row * side + col) % 2 == 0) {
+                out[0] = corner;
+                out[1] = corner + side;
+                out[2] = corner + side + 1;
+                out[3] = corner;
+                out[4] = corner + side + 1;
+                out[5] = corner + 1;
+            } else {
+                out[0] = corner;
+                out[1] = corner + side;
+                out[2] = corner + 1;
+                out[3] = corner + 1;
+                out[4] = corner + side;
+                out[5] = corner + side + 1;
+            }
+            out += 6;
+        }
+    }
+}
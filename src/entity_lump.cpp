@@ -0,0 +1,474 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Parser for the KeyValues text in a map's entity lump.
+ *
+ * The lump is a list of blocks like:
+ *
+ *   {
+ *   "classname" "light"
+ *   "origin" "0 0 64"
+ *   }
+ *
+ * usually followed by a NUL.  Values can't contain quotes, so quotes always
+ * come in open/close pairs, and everything outside the strings should be
+ * whitespace and braces.  Each 64 byte block is turned into bitmasks with
+ * SSE2 compares, and a prefix XOR of the quote bits marks which bytes are
+ * inside strings.  The parser then only visits the quotes and whatever
+ * isn't whitespace outside them, a couple dozen stops per entity, and never
+ * looks at the bytes in between.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include "entity_lump.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ENTITY_LUMP_X86
+#include <emmintrin.h>
+#endif
+
+#define NO_TOKEN ((size_t)-1)
+#define TOKEN_SCAN_BLOCKS 64  // 64 byte blocks a TokenScanner scans per call
+
+
+/**
+ * Finds, in order, the positions of the quotes in a block of text and of
+ * anything outside the quotes that isn't whitespace.  Positions are written
+ * out a run of blocks at a time rather than handed out one by one, so the
+ * parser's loop over them doesn't branch on where blocks end.
+ */
+class TokenScanner {
+public:
+    TokenScanner(const char* text, size_t text_len) {
+        this->text = text;
+        this->text_len = text_len;
+        this->block = 0;
+        this->in_string = 0;
+    }
+
+    bool AtEnd() const {
+        return block >= text_len;
+    }
+
+    /* Writes the positions in the next TOKEN_SCAN_BLOCKS blocks to
+       positions, which must have room for TOKEN_SCAN_BLOCKS * 64, and
+       returns how many there were */
+    size_t Next(uint32_t* positions) {
+        size_t count = 0;
+
+        for (int i=0; i < TOKEN_SCAN_BLOCKS && block < text_len; i++, block += 64) {
+            count += flatten(blockMask(block), block, positions + count);
+        }
+        return count;
+    }
+
+private:
+    const char* text;
+    size_t text_len;
+    size_t block;
+    uint64_t in_string;  // All ones if the last block ended inside a string
+
+    uint64_t blockMask(size_t offset) {
+        const char* p = text + offset;
+        size_t len = std::min<size_t>(text_len - offset, 64);
+        char tail[64];
+        uint64_t quotes = 0;
+        uint64_t spaces = 0;
+
+        /* Pad the last block out so the loads stay inside the lump */
+        if (len < 64) {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, p, len);
+            p = tail;
+        }
+
+#ifdef ENTITY_LUMP_X86
+        for (int i=0; i < 4; i++) {
+            __m128i chunk = _mm_loadu_si128((const __m128i*)(p + i * 16));
+            __m128i space = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')),
+                             _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t'))),
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')),
+                             _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r'))));
+            quotes |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(chunk, _mm_set1_epi8('"'))) << (i * 16);
+            spaces |= (uint64_t)(uint16_t)_mm_movemask_epi8(space) << (i * 16);
+        }
+#else
+        for (int i=0; i < 64; i++) {
+            quotes |= (uint64_t)(p[i] == '"') << i;
+            spaces |= (uint64_t)(p[i] == ' ' || p[i] == '\t' || p[i] == '\n' || p[i] == '\r') << i;
+        }
+#endif
+
+        /* Prefix XOR sets every bit from an opening quote up to (not
+           including) its closing quote */
+        uint64_t inside = quotes;
+        inside ^= inside << 1;
+        inside ^= inside << 2;
+        inside ^= inside << 4;
+        inside ^= inside << 8;
+        inside ^= inside << 16;
+        inside ^= inside << 32;
+        inside ^= in_string;
+        in_string = (uint64_t)((int64_t)inside >> 63);
+
+        uint64_t result = quotes | ~(spaces | inside);
+        if (len < 64) {
+            result &= (1ULL << len) - 1;
+        }
+        return result;
+    }
+
+    /* Writes the positions of the bits set in mask.  The first 8 and 16 are
+       written whether or not there are that many, which costs less than a
+       branch per bit; whatever is past the count gets written over by the
+       next block. */
+    static size_t flatten(uint64_t mask, uint32_t base, uint32_t* out) {
+        size_t count = __builtin_popcountll(mask);
+
+        /* The top bit keeps ctz defined once mask runs out */
+        for (int i=0; i < 8; i++) {
+            out[i] = base + __builtin_ctzll(mask | (1ULL << 63));
+            mask &= mask - 1;
+        }
+        if (count > 8) {
+            for (int i=8; i < 16; i++) {
+                out[i] = base + __builtin_ctzll(mask | (1ULL << 63));
+                mask &= mask - 1;
+            }
+            for (size_t i=16; i < count; i++) {
+                out[i] = base + __builtin_ctzll(mask);
+                mask &= mask - 1;
+            }
+        }
+        return count;
+    }
+};
+
+
+/* ASCII only, like the engine's stricmp */
+static inline uint8_t fold_case(char c) {
+    return ((unsigned)(c - 'A') < 26) ? c | 0x20 : c;
+}
+
+/* fold_case on 8 bytes at once: flag the bytes from 'A' to 'Z' in their top
+   bits, then shift the flags down onto 0x20 */
+static inline uint64_t fold_case_word(uint64_t word) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    uint64_t low = word & (0x7F * ones);
+    uint64_t from_a = low + (0x80 - 'A') * ones;
+    uint64_t past_z = low + (0x80 - 'Z' - 1) * ones;
+
+    return word | ((from_a & ~past_z & ~word & (0x80 * ones)) >> 2);
+}
+
+static int compare_names(std::string_view a, std::string_view b) {
+    size_t len = std::min(a.size(), b.size());
+
+    for (size_t i=0; i < len; i++) {
+        int diff = fold_case(a[i]) - fold_case(b[i]);
+        if (diff != 0) {
+            return diff;
+        }
+    }
+    return (a.size() > b.size()) - (a.size() < b.size());
+}
+
+static bool key_equals(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && compare_names(a, b) == 0;
+}
+
+/* key_equals against a lowercase name made only of letters, which is what
+   the parser looks for.  OR-ing in 0x20 only makes a lowercase letter out of
+   a letter, so that's the whole case fold and it can be done 8 at a time. */
+static bool key_is(std::string_view key, std::string_view name) {
+    size_t i = 0;
+
+    if (key.size() != name.size()) {
+        return false;
+    }
+    for (; i + 8 <= key.size(); i += 8) {
+        uint64_t a, b;
+        memcpy(&a, key.data() + i, 8);
+        memcpy(&b, name.data() + i, 8);
+        if ((a | 0x2020202020202020ULL) != b) {
+            return false;
+        }
+    }
+    for (; i < key.size(); i++) {
+        if ((key[i] | 0x20) != name[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+[[noreturn]] __attribute__((noinline))
+static void parse_error(const char* what, size_t at) {
+    throw EntityLumpException(std::string(what) + " at byte " + std::to_string(at) +
+                              " of the entity lump.");
+}
+
+/* Hash of the case folded name, mixed in a word at a time since one byte at
+   a time is a multiply per byte */
+static uint64_t hash_name(std::string_view name) {
+    const uint64_t mul = 0x9E3779B97F4A7C15ULL;
+    uint64_t hash = (name.size() + 1) * mul;
+    size_t i = 0;
+
+    for (; i + 8 <= name.size(); i += 8) {
+        uint64_t word;
+        memcpy(&word, name.data() + i, 8);
+        hash = (hash ^ fold_case_word(word)) * mul;
+        hash ^= hash >> 32;
+    }
+    if (i < name.size()) {
+        uint64_t word = 0;
+        for (size_t j=0; i + j < name.size(); j++) {
+            word |= (uint64_t)(uint8_t)name[i + j] << (j * 8);
+        }
+        hash = (hash ^ fold_case_word(word)) * mul;
+        hash ^= hash >> 32;
+    }
+    return hash * mul;
+}
+
+/* Index order is by hash, then by name in case two names share a hash */
+static bool index_less(const EntityIndexEntry& a, const EntityIndexEntry& b) {
+    if (a.hash != b.hash) {
+        return a.hash < b.hash;
+    }
+    return compare_names(a.name, b.name) < 0;
+}
+
+/**
+ * Sorts an index into index_less order, keeping entities in lump order
+ * within a name.  Entries go in in lump order, so a stable sort on the hash
+ * alone does that.  Hashes are spread evenly, so one pass drops entries into
+ * about one bucket each by their top bits and an insertion sort finishes off
+ * each bucket, where entries sharing a name are already in order.  One pass
+ * over the result then checks for two different names sharing a hash, and
+ * only then are names compared.
+ */
+static void sort_index(std::vector<EntityIndexEntry>* index) {
+    int bits = 8;
+    while (bits < 20 && ((size_t)1 << bits) < index->size()) {
+        bits++;
+    }
+    std::vector<uint32_t> offsets(((size_t)1 << bits) + 1);
+    std::vector<EntityIndexEntry> sorted(index->size());
+
+    for (const EntityIndexEntry& entry : *index) {
+        offsets[(entry.hash >> (64 - bits)) + 1]++;
+    }
+    for (size_t i=1; i < offsets.size(); i++) {
+        offsets[i] += offsets[i - 1];
+    }
+    for (const EntityIndexEntry& entry : *index) {
+        sorted[offsets[entry.hash >> (64 - bits)]++] = entry;
+    }
+
+    for (size_t i=1; i < sorted.size(); i++) {
+        if (sorted[i - 1].hash <= sorted[i].hash) {
+            continue;
+        }
+        EntityIndexEntry entry = sorted[i];
+        size_t j = i;
+        for (; j > 0 && sorted[j - 1].hash > entry.hash; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = entry;
+    }
+    index->swap(sorted);
+
+    for (size_t i=1; i < index->size(); i++) {
+        const EntityIndexEntry& a = (*index)[i - 1];
+        const EntityIndexEntry& b = (*index)[i];
+        if (a.hash == b.hash && !key_equals(a.name, b.name)) {
+            std::stable_sort(index->begin(), index->end(), index_less);
+            return;
+        }
+    }
+}
+
+
+EntityLump::EntityLump(const LumpView<uint8_t>& data) {
+    const char* text = (const char*)data.Bytes();
+    size_t text_len = data.size();
+    TokenScanner tokens(text, text_len);
+    uint32_t positions[TOKEN_SCAN_BLOCKS * 64];
+    size_t open = NO_TOKEN;  // Start of the string we're in, if any
+    bool in_entity = false;
+    bool want_value = false;
+    bool done = false;
+    size_t end = text_len;
+    EntityKeyValue pair;
+    Entity entity = {};
+
+    /* Pairs take 16-30 bytes and entities 100-200, so these guesses keep
+       the arrays from growing more than once or twice */
+    pairs.reserve(text_len / 16);
+    entities.reserve(text_len / 128);
+    classname_index.reserve(text_len / 128);
+    targetname_index.reserve(text_len / 256);
+
+    /* Takes the string between two quotes, a key or the value to go with
+       it */
+    auto string = [&](size_t open, size_t close) {
+        std::string_view token(text + open + 1, close - open - 1);
+
+        if (!want_value) {
+            pair.key = token;
+            want_value = true;
+            return;
+        }
+
+        pair.value = token;
+        want_value = false;
+        pairs.push_back(pair);
+
+        if (entity.classname.empty() && key_is(pair.key, "classname")) {
+            entity.classname = pair.value;
+        } else if (entity.targetname.empty() && key_is(pair.key, "targetname")) {
+            entity.targetname = pair.value;
+        }
+    };
+
+    while (!done && !tokens.AtEnd()) {
+        size_t count = tokens.Next(positions);
+        size_t i = 0;
+
+        /* Finish a string left open at the end of the last run */
+        if (open != NO_TOKEN && count > 0) {
+            string(open, positions[0]);
+            open = NO_TOKEN;
+            i = 1;
+        }
+
+        for (; i < count && !done; i++) {
+            size_t at = positions[i];
+
+            switch (text[at]) {
+            case '"':
+                if (!in_entity) {
+                    parse_error("String outside of an entity", at);
+                }
+
+                /* Nothing inside a string is a token, so the next one is its
+                   end */
+                if (i + 1 == count) {
+                    open = at;
+                    break;
+                }
+                i++;
+                string(at, positions[i]);
+                break;
+            case '{':
+                if (in_entity) {
+                    parse_error("Unexpected '{'", at);
+                }
+                in_entity = true;
+                entity = { (uint32_t)pairs.size(), 0, {}, {} };
+                break;
+            case '}':
+                if (!in_entity || want_value) {
+                    parse_error("Unexpected '}'", at);
+                }
+                in_entity = false;
+                entity.pair_count = pairs.size() - entity.first_pair;
+                if (!entity.classname.empty()) {
+                    classname_index.push_back({ hash_name(entity.classname), entity.classname,
+                                                (uint32_t)entities.size() });
+                }
+                if (!entity.targetname.empty()) {
+                    targetname_index.push_back({ hash_name(entity.targetname), entity.targetname,
+                                                 (uint32_t)entities.size() });
+                }
+                entities.push_back(entity);
+                break;
+            case '\0':
+                done = true;  // Terminator, anything after it is junk
+                end = at;
+                break;
+            default:
+                parse_error("Unexpected character", at);
+            }
+        }
+    }
+    if (open != NO_TOKEN) {
+        parse_error("Unterminated string", open);
+    }
+
+    if (in_entity) {
+        parse_error("Unterminated entity", end);
+    }
+
+    sort_index(&classname_index);
+    sort_index(&targetname_index);
+}
+
+size_t EntityLump::Count() const {
+    return entities.size();
+}
+
+const Entity& EntityLump::operator[](size_t entity) const {
+    return entities[entity];
+}
+
+const std::vector<Entity>& EntityLump::Entities() const {
+    return entities;
+}
+
+const std::vector<EntityKeyValue>& EntityLump::Pairs() const {
+    return pairs;
+}
+
+/**
+ * Value of a key on an entity, or an empty view if it doesn't have it.  If a
+ * key shows up more than once the first one wins.
+ */
+std::string_view EntityLump::Get(size_t entity, std::string_view key) const {
+    const Entity& ent = entities.at(entity);
+
+    for (uint32_t i=ent.first_pair; i < ent.first_pair + ent.pair_count; i++) {
+        if (key_equals(pairs[i].key, key)) {
+            return pairs[i].value;
+        }
+    }
+
+    return {};
+}
+
+EntityMatches EntityLump::FindByClassname(std::string_view classname) const {
+    return find(classname_index, classname);
+}
+
+EntityMatches EntityLump::FindByTargetname(std::string_view targetname) const {
+    return find(targetname_index, targetname);
+}
+
+EntityMatches EntityLump::find(const std::vector<EntityIndexEntry>& index, std::string_view name) {
+    auto range = std::equal_range(index.begin(), index.end(),
+                                  EntityIndexEntry{ hash_name(name), name, 0 }, index_less);
+
+    return { index.data() + (range.first - index.begin()),
+             index.data() + (range.second - index.begin()) };
+}
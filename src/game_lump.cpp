@@ -0,0 +1,97 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Directory of the game specific lumps inside LUMP_GAME_LUMP.
+ */
+
+#include <string.h>
+#include "game_lump.h"
+#include "lzma_lump.h"
+#include "bsp_parser.h"
+
+
+GameLump::GameLump(const LumpView<uint8_t>& data, uint64_t file_offset) {
+    int32_t count;
+
+    /* Maps without any game lumps can leave it empty */
+    if (data.empty()) {
+        return;
+    }
+
+    if (data.size() < sizeof(count)) {
+        throw GameLumpException("Game lump is too small to hold a count.");
+    }
+    memcpy(&count, data.Bytes(), sizeof(count));
+    if (count < 0 || (uint64_t)count * sizeof(bsp_gamelump_t) > data.size() - sizeof(count)) {
+        throw GameLumpException("Game lump directory doesn't fit in the lump.");
+    }
+
+    LumpView<bsp_gamelump_t> directory(data.Bytes() + sizeof(count), count);
+    entries.reserve(count);
+    for (bsp_gamelump_t lump : directory) {
+        GameLumpEntry entry;
+        entry.id = lump.id;
+        entry.flags = lump.flags;
+        entry.version = lump.version;
+
+        /* Some compilers end the directory with an empty entry */
+        if (lump.id == 0 && lump.file_length == 0) {
+            continue;
+        }
+
+        uint64_t offset = (uint64_t)(uint32_t)lump.file_offset;
+        uint64_t length = (uint64_t)(uint32_t)lump.file_length;
+        if (offset < file_offset || offset - file_offset > data.size() ||
+            length > data.size() - (offset - file_offset)) {
+            throw GameLumpException("Game lump " + std::to_string(entries.size()) +
+                                    " is outside LUMP_GAME_LUMP.");
+        }
+        const uint8_t* bytes = data.Bytes() + (offset - file_offset);
+
+        if ((lump.flags & GAMELUMP_COMPRESSED) && IsLZMALump(bytes, length)) {
+            try {
+                buffers.push_back(DecompressLZMALump(bytes, length));
+            } catch (BSPParserException& e) {
+                throw GameLumpException(e.what());
+            }
+            entry.data = LumpView<uint8_t>(buffers.back().data(), buffers.back().size());
+        } else {
+            entry.data = LumpView<uint8_t>(bytes, length);
+        }
+
+        entries.push_back(entry);
+    }
+}
+
+size_t GameLump::Count() const {
+    return entries.size();
+}
+
+const GameLumpEntry& GameLump::operator[](size_t i) const {
+    return entries[i];
+}
+
+const GameLumpEntry* GameLump::Find(uint32_t id) const {
+    for (const GameLumpEntry& entry : entries) {
+        if (entry.id == id) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
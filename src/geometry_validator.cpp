@@ -0,0 +1,277 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Structural validation of the lumps map geometry is built from.
+ *
+ * The checks are reductions: the largest edge vertex index, the largest
+ * surfedge magnitude and the largest face end are all that matter to tell
+ * whether a lump is clean.  They run 8-16 elements at a time with AVX2 when
+ * the CPU has it (faces are pulled out of their 56 byte structs with
+ * gathers), and as plain loops the compiler can vectorize otherwise.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "geometry_validator.h"
+#include "bsp_parser.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GEOMETRY_VALIDATOR_X86
+#include <immintrin.h>
+#endif
+
+
+/* Biggest values found by the reductions */
+struct GeometryMaxima {
+    uint32_t edge_vertex;  // Largest vertex index in the edge lump
+    uint32_t surfedge;  // Largest surfedge magnitude
+    uint32_t face_first;  // Largest first_edge
+    uint32_t face_end;  // Largest first_edge + num_edges
+};
+
+static uint32_t surfedge_magnitude(bsp_surfedge_t surfedge) {
+    /* Done unsigned so INT32_MIN doesn't overflow */
+    return surfedge < 0 ? 0u - (uint32_t)surfedge : (uint32_t)surfedge;
+}
+
+static void reduce_scalar(const uint16_t* edge_vertices, size_t edge_vertices_len,
+                          const int32_t* surfedges, size_t surfedges_len,
+                          const uint8_t* faces, size_t faces_len, GeometryMaxima* maxima) {
+    for (size_t i=0; i < edge_vertices_len; i++) {
+        uint16_t vertex;
+        memcpy(&vertex, edge_vertices + i, sizeof(vertex));
+        maxima->edge_vertex = vertex > maxima->edge_vertex ? vertex : maxima->edge_vertex;
+    }
+
+    for (size_t i=0; i < surfedges_len; i++) {
+        int32_t surfedge;
+        memcpy(&surfedge, surfedges + i, sizeof(surfedge));
+        uint32_t magnitude = surfedge_magnitude(surfedge);
+        maxima->surfedge = magnitude > maxima->surfedge ? magnitude : maxima->surfedge;
+    }
+
+    for (size_t i=0; i < faces_len; i++) {
+        bsp_face_t face;
+        memcpy(&face, faces + i * sizeof(bsp_face_t), sizeof(face));
+        uint32_t end = face.first_edge + face.num_edges;
+        maxima->face_first = face.first_edge > maxima->face_first ? face.first_edge : maxima->face_first;
+        maxima->face_end = end > maxima->face_end ? end : maxima->face_end;
+    }
+}
+
+#ifdef GEOMETRY_VALIDATOR_X86
+
+__attribute__((target("avx2")))
+static uint32_t hmax_epu32(__m256i v) {
+    uint32_t lanes[8];
+    uint32_t best = 0;
+
+    _mm256_storeu_si256((__m256i*)lanes, v);
+    for (int i=0; i < 8; i++) {
+        best = lanes[i] > best ? lanes[i] : best;
+    }
+    return best;
+}
+
+__attribute__((target("avx2")))
+static void reduce_avx2(const uint16_t* edge_vertices, size_t edge_vertices_len,
+                        const int32_t* surfedges, size_t surfedges_len,
+                        const uint8_t* faces, size_t faces_len, GeometryMaxima* maxima) {
+    size_t i;
+
+    /* Edge vertex indices, 16 at a time */
+    __m256i max16 = _mm256_setzero_si256();
+    for (i=0; i + 16 <= edge_vertices_len; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(edge_vertices + i));
+        max16 = _mm256_max_epu16(max16, v);
+    }
+    uint16_t lanes16[16];
+    _mm256_storeu_si256((__m256i*)lanes16, max16);
+    for (int lane=0; lane < 16; lane++) {
+        maxima->edge_vertex = lanes16[lane] > maxima->edge_vertex ? lanes16[lane] : maxima->edge_vertex;
+    }
+    reduce_scalar(edge_vertices + i, edge_vertices_len - i, nullptr, 0, nullptr, 0, maxima);
+
+    /* Surfedge magnitudes, 8 at a time.  abs(INT32_MIN) stays 0x80000000,
+       which is the right magnitude once it's treated as unsigned */
+    __m256i max32 = _mm256_setzero_si256();
+    for (i=0; i + 8 <= surfedges_len; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(surfedges + i));
+        max32 = _mm256_max_epu32(max32, _mm256_abs_epi32(v));
+    }
+    uint32_t surfedge_max = hmax_epu32(max32);
+    maxima->surfedge = surfedge_max > maxima->surfedge ? surfedge_max : maxima->surfedge;
+    reduce_scalar(nullptr, 0, surfedges + i, surfedges_len - i, nullptr, 0, maxima);
+
+    /* Faces, 8 at a time, gathering first_edge and num_edges out of each
+       struct.  num_edges shares its dword with tex_info so it gets masked */
+    const __m256i stride = _mm256_setr_epi32(0, 56, 112, 168, 224, 280, 336, 392);
+    const __m256i low16 = _mm256_set1_epi32(0xFFFF);
+    __m256i max_first = _mm256_setzero_si256();
+    __m256i max_end = _mm256_setzero_si256();
+    for (i=0; i + 8 <= faces_len; i += 8) {
+        const uint8_t* base = faces + i * sizeof(bsp_face_t);
+        __m256i first = _mm256_i32gather_epi32((const int*)(base + offsetof(bsp_face_t, first_edge)), stride, 1);
+        __m256i count = _mm256_i32gather_epi32((const int*)(base + offsetof(bsp_face_t, num_edges)), stride, 1);
+        __m256i end = _mm256_add_epi32(first, _mm256_and_si256(count, low16));
+        max_first = _mm256_max_epu32(max_first, first);
+        max_end = _mm256_max_epu32(max_end, end);
+    }
+    uint32_t first_max = hmax_epu32(max_first);
+    uint32_t end_max = hmax_epu32(max_end);
+    maxima->face_first = first_max > maxima->face_first ? first_max : maxima->face_first;
+    maxima->face_end = end_max > maxima->face_end ? end_max : maxima->face_end;
+    reduce_scalar(nullptr, 0, nullptr, 0, faces + i * sizeof(bsp_face_t), faces_len - i, maxima);
+}
+
+#endif // GEOMETRY_VALIDATOR_X86
+
+GeometryReport GeometryReport::Validate(const LumpView<bsp_vertex_t>& vertices,
+                                        const LumpView<bsp_edge_t>& edges,
+                                        const LumpView<bsp_surfedge_t>& surfedges,
+                                        const LumpView<bsp_face_t>& faces) {
+    static_assert(sizeof(bsp_face_t) == 56, "face gathers assume 56 byte faces");
+    GeometryReport report;
+    GeometryMaxima maxima = {};
+
+    const uint16_t* edge_vertices = (const uint16_t*)edges.Bytes();
+    const int32_t* surfedge_values = (const int32_t*)surfedges.Bytes();
+
+#ifdef GEOMETRY_VALIDATOR_X86
+    if (__builtin_cpu_supports("avx2")) {
+        reduce_avx2(edge_vertices, edges.size() * 2, surfedge_values, surfedges.size(),
+                    faces.Bytes(), faces.size(), &maxima);
+    } else
+#endif
+    {
+        reduce_scalar(edge_vertices, edges.size() * 2, surfedge_values, surfedges.size(),
+                      faces.Bytes(), faces.size(), &maxima);
+    }
+
+    /* Only lumps whose maxima are out of range need walking to find out
+       exactly which elements are bad */
+    if (!edges.empty() && maxima.edge_vertex >= vertices.size()) {
+        for (size_t i=0; i < edges.size(); i++) {
+            bsp_edge_t edge = edges[i];
+            for (int v=0; v < 2; v++) {
+                if (edge.v[v] >= vertices.size()) {
+                    report.violations.push_back({ LUMP_EDGES, (uint32_t)i, edge.v[v], vertices.size() });
+                }
+            }
+        }
+    }
+
+    if (!surfedges.empty() && maxima.surfedge >= edges.size()) {
+        for (size_t i=0; i < surfedges.size(); i++) {
+            uint32_t magnitude = surfedge_magnitude(surfedges[i]);
+            if (magnitude >= edges.size()) {
+                report.violations.push_back({ LUMP_SURFEDGES, (uint32_t)i, magnitude, edges.size() });
+            }
+        }
+    }
+
+    /* A first_edge past the end catches faces whose end wrapped around */
+    if (!faces.empty() && (maxima.face_end > surfedges.size() || maxima.face_first > surfedges.size())) {
+        for (size_t i=0; i < faces.size(); i++) {
+            bsp_face_t face = faces[i];
+            uint64_t end = (uint64_t)face.first_edge + face.num_edges;
+            if (end > surfedges.size()) {
+                report.violations.push_back({ LUMP_FACES, (uint32_t)i, end, surfedges.size() });
+            }
+        }
+    }
+
+    return report;
+}
+
+GeometryReport GeometryReport::Validate(BSPParser* parser) {
+    GeometryReport report = Validate(parser->Vertices(), parser->Edges(), parser->Surfedges(), parser->Faces());
+
+    /* There's only a handful of models, so they're just walked.  Negative
+       fields come out huge and fail the same check */
+    const LumpView<bsp_model_t>& models = parser->Models();
+    size_t face_count = parser->Faces().size();
+    for (size_t i=0; i < models.size(); i++) {
+        bsp_model_t model = models[i];
+        uint64_t end = (uint64_t)(uint32_t)model.first_face + (uint32_t)model.num_faces;
+        if (end > face_count) {
+            report.violations.push_back({ LUMP_MODELS, (uint32_t)i, end, face_count });
+        }
+    }
+
+    return report;
+}
+
+bool GeometryReport::Certified() const {
+    return violations.empty();
+}
+
+const std::vector<GeometryViolation>& GeometryReport::Violations() const {
+    return violations;
+}
+
+std::string GeometryReport::Summary(size_t max_listed) const {
+    if (violations.empty()) {
+        return "Map geometry is valid.";
+    }
+
+    std::string summary = "Map geometry has " + std::to_string(violations.size()) + " bad indices:";
+    for (size_t i=0; i < violations.size() && i < max_listed; i++) {
+        summary += "\n  " + Describe(violations[i]);
+    }
+    if (violations.size() > max_listed) {
+        summary += "\n  ...";
+    }
+
+    return summary;
+}
+
+std::string GeometryReport::Describe(const GeometryViolation& violation) {
+    char desc[128];
+
+    switch (violation.lump_type) {
+    case LUMP_EDGES:
+        snprintf(desc, sizeof(desc), "edge %u uses vertex %llu, map has %llu vertices",
+                 violation.index, (unsigned long long)violation.value,
+                 (unsigned long long)violation.limit);
+        break;
+    case LUMP_SURFEDGES:
+        snprintf(desc, sizeof(desc), "surfedge %u uses edge %llu, map has %llu edges",
+                 violation.index, (unsigned long long)violation.value,
+                 (unsigned long long)violation.limit);
+        break;
+    case LUMP_FACES:
+        snprintf(desc, sizeof(desc), "face %u ends at surfedge %llu, map has %llu surfedges",
+                 violation.index, (unsigned long long)violation.value,
+                 (unsigned long long)violation.limit);
+        break;
+    case LUMP_MODELS:
+        snprintf(desc, sizeof(desc), "model %u ends at face %llu, map has %llu faces",
+                 violation.index, (unsigned long long)violation.value,
+                 (unsigned long long)violation.limit);
+        break;
+    default:
+        snprintf(desc, sizeof(desc), "lump %u element %u is out of range",
+                 violation.lump_type, violation.index);
+        break;
+    }
+
+    return desc;
+}
@@ -0,0 +1,267 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Headless batch map inspector
+ *
+ * Parses every map it's pointed at across a thread pool without opening a
+ * window, and prints one line of JSON per map with its stats.  A throughput
+ * summary goes to stderr once everything is done so stdout stays valid JSON
+ * lines.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include "bsp_parser.h"
+#include "geometry_validator.h"
+#include "material_table.h"
+#include "static_props.h"
+#include "thread_pool.h"
+
+namespace fs = std::filesystem;
+
+
+struct InspectTotals {
+    std::mutex lock;
+    size_t maps;
+    size_t failed;
+    uint64_t bytes;
+};
+
+/**
+ * Escapes a string so it can be dropped into a JSON string literal.
+ */
+std::string json_escape(const std::string& in) {
+    std::string out;
+    char hex[8];
+
+    for (unsigned char c : in) {
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (c < 0x20) {
+                snprintf(hex, sizeof(hex), "\\u%04x", c);
+                out += hex;
+            } else {
+                out += c;
+            }
+        }
+    }
+
+    return out;
+}
+
+/**
+ * Parses a single map and builds its line of JSON.
+ */
+std::string inspect_map(const std::string& path, BSPParser::Mode mode, uint64_t* file_size) {
+    auto start = std::chrono::steady_clock::now();
+    BSPParser parser(path, mode, false);
+
+    /* Pull in the geometry lumps, which also makes sure they're sane */
+    size_t vertex_count = parser.Vertices().size();
+    size_t edge_count = parser.Edges().size();
+    size_t surfedge_count = parser.Surfedges().size();
+    size_t face_count = parser.Faces().size();
+    size_t displacement_count = parser.DispInfo().size();
+    size_t model_count = parser.Models().size();
+    GeometryReport report = GeometryReport::Validate(&parser);
+    size_t entity_count = parser.Entities().Count();
+    size_t material_count = MaterialTable::FromBSP(&parser).Count();
+    StaticProps props = StaticProps::FromBSP(&parser);
+
+    auto end = std::chrono::steady_clock::now();
+    double parse_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    *file_size = parser.FileSize();
+
+    std::string json = "{\"path\":\"" + json_escape(path) + "\"";
+    json += ",\"size\":" + std::to_string(parser.FileSize());
+    json += ",\"version\":" + std::to_string(parser.Version());
+    json += ",\"revision\":" + std::to_string(parser.Revision());
+    json += ",\"vertices\":" + std::to_string(vertex_count);
+    json += ",\"edges\":" + std::to_string(edge_count);
+    json += ",\"surfedges\":" + std::to_string(surfedge_count);
+    json += ",\"faces\":" + std::to_string(face_count);
+    json += ",\"displacements\":" + std::to_string(displacement_count);
+    json += ",\"models\":" + std::to_string(model_count);
+    json += ",\"entities\":" + std::to_string(entity_count);
+    json += ",\"materials\":" + std::to_string(material_count);
+    json += ",\"static_props\":" + std::to_string(props.Count());
+    json += ",\"prop_models\":" + std::to_string(props.Groups().size());
+    json += ",\"lump_sizes\":[";
+    for (uint32_t i=0; i < BSP_TOTAL_LUMPS; i++) {
+        json += (i ? "," : "") + std::to_string(parser.LumpInfo(i).size);
+    }
+    json += "]";
+    json += ",\"violations\":" + std::to_string(report.Violations().size());
+
+    char ms[32];
+    snprintf(ms, sizeof(ms), "%.3f", parse_ms);
+    json += ",\"parse_ms\":" + std::string(ms) + "}";
+
+    return json;
+}
+
+/**
+ * Expands the paths given on the command line into a list of maps.
+ * Directories are searched recursively for .bsp files.
+ */
+std::vector<std::string> collect_maps(const std::vector<std::string>& paths) {
+    std::vector<std::string> maps;
+
+    for (const std::string& path : paths) {
+        if (!fs::is_directory(path)) {
+            maps.push_back(path);
+            continue;
+        }
+
+        for (const fs::directory_entry& entry : fs::recursive_directory_iterator(path)) {
+            std::string ext = entry.path().extension().string();
+            std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+            if (entry.is_regular_file() && ext == ".bsp") {
+                maps.push_back(entry.path().string());
+            }
+        }
+    }
+
+    /* Largest maps first, so the long tail doesn't end up on one worker */
+    std::vector<std::pair<uintmax_t, std::string>> sized;
+    for (const std::string& map : maps) {
+        std::error_code ec;
+        sized.push_back({ fs::file_size(map, ec), map });
+    }
+    std::sort(sized.begin(), sized.end(), [](const auto& a, const auto& b) {
+        return a.first > b.first;
+    });
+    for (size_t i=0; i < sized.size(); i++) {
+        maps[i] = sized[i].second;
+    }
+
+    return maps;
+}
+
+void usage(const char* name) {
+    printf("Usage: %s [-j threads] [--read] <map.bsp | directory>...\n", name);
+    printf("  -j threads  number of worker threads (default: one per core)\n");
+    printf("  --read      read lumps with pread instead of mmapping maps\n");
+}
+
+/**
+ * Entry point.
+ */
+int main(int argc, char* argv[]) {
+    std::vector<std::string> paths;
+    unsigned int threads = 0;
+    BSPParser::Mode mode = BSPParser::MODE_MMAP;
+    std::mutex output_lock;
+    InspectTotals totals;
+
+    totals.maps = 0;
+    totals.failed = 0;
+    totals.bytes = 0;
+
+    /* Parse arguments */
+    for (int i=1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (arg == "--read") {
+            mode = BSPParser::MODE_READ;
+        } else if (arg == "-h" || arg == "--help") {
+            usage(argv[0]);
+            return 0;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> maps;
+    try {
+        maps = collect_maps(paths);
+    } catch (fs::filesystem_error& e) {
+        fprintf(stderr, "Failed to list maps: %s\n", e.what());
+        return 1;
+    }
+
+    ThreadPool pool(threads);
+    auto start = std::chrono::steady_clock::now();
+
+    for (const std::string& map : maps) {
+        pool.Submit([&, map] {
+            std::string json;
+            uint64_t file_size = 0;
+            bool failed = false;
+
+            try {
+                json = inspect_map(map, mode, &file_size);
+            } catch (std::exception& e) {
+                json = "{\"path\":\"" + json_escape(map) + "\",\"error\":\""
+                       + json_escape(e.what()) + "\"}";
+                failed = true;
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(output_lock);
+                fputs(json.c_str(), stdout);
+                fputc('\n', stdout);
+            }
+            {
+                std::lock_guard<std::mutex> guard(totals.lock);
+                totals.maps++;
+                totals.bytes += file_size;
+                if (failed) {
+                    totals.failed++;
+                }
+            }
+        });
+    }
+    pool.Wait();
+
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double mb = totals.bytes / (1024.0 * 1024.0);
+
+    fprintf(stderr, "Inspected %zu maps (%zu failed), %.1f MB in %.3f s on %u threads\n",
+            totals.maps, totals.failed, mb, seconds, pool.Size());
+    fprintf(stderr, "Throughput: %.1f maps/s, %.1f MB/s\n",
+            totals.maps / seconds, mb / seconds);
+
+    return totals.failed ? 2 : 0;
+}
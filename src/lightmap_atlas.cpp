@@ -0,0 +1,413 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Decodes face lightmaps out of the lighting lump and packs them into
+ *        atlas pages.
+ *
+ * A sample is c * 2^exponent / 255 in linear light for each channel c.  The
+ * texels we hand out are sqrt() of that, a gamma 2 curve that's close enough
+ * to the engine's 2.2 and, unlike pow(), has a SIMD instruction.  The SIMD
+ * kernels build 2^exponent by writing exponent + 127 straight into a float's
+ * exponent bits, exponents too small for that give black, which is what the
+ * engine's lookup table gives too.
+ *
+ * Faces with a lightmap have (lightmap_size[0] + 1) x (lightmap_size[1] + 1)
+ * samples at light_offset, row by row.  Only the first style is used, and
+ * bumpmapped faces keep their unbumped lightmap, which is stored first.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <utility>
+#include <algorithm>
+#include "lightmap_atlas.h"
+#include "material_table.h"
+#include "thread_pool.h"
+#include "bsp_parser.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LIGHTMAP_DECODE_X86
+#include <immintrin.h>
+#endif
+
+#define LIGHTMAP_NO_OFFSET 0xFFFFFFFF  // light_offset of a face without a lightmap
+#define LIGHTMAP_NO_STYLE 255  // Unused entry in a face's styles
+
+
+static void decode_scalar(const uint8_t* samples, uint32_t* texels, size_t start, size_t end) {
+    for (size_t i=start; i < end; i++) {
+        const uint8_t* sample = samples + i * 4;
+        int exponent = (int8_t)sample[3];
+        uint32_t bits = exponent > -127 ? (uint32_t)(exponent + 127) << 23 : 0;
+        float scale;
+        uint32_t texel = 0xFF000000;
+
+        /* Same 2^exponent construction as the SIMD kernels, so they match */
+        memcpy(&scale, &bits, sizeof(scale));
+        scale *= 1.0f / 255.0f;
+
+        for (int channel=0; channel < 3; channel++) {
+            float value = fminf(sqrtf(sample[channel] * scale), 1.0f);
+            texel |= (uint32_t)lrintf(value * 255.0f) << (channel * 8);
+        }
+        texels[i] = texel;
+    }
+}
+
+#ifdef LIGHTMAP_DECODE_X86
+
+/**
+ * Decodes 4 samples per iteration, returns how many were done.
+ */
+static size_t decode_sse(const uint8_t* samples, uint32_t* texels, size_t count) {
+    const __m128i byte_mask = _mm_set1_epi32(0xFF);
+    const __m128i min_exponent = _mm_set1_epi32(-127);
+    const __m128i bias = _mm_set1_epi32(127);
+    const __m128i alpha = _mm_set1_epi32(0xFF000000);
+    const __m128 inv_255 = _mm_set1_ps(1.0f / 255.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 full = _mm_set1_ps(255.0f);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(samples + i * 4));
+
+        /* 2^exponent / 255, or 0 if the exponent is too small for a float */
+        __m128i exponent = _mm_srai_epi32(in, 24);
+        __m128i bits = _mm_slli_epi32(_mm_add_epi32(exponent, bias), 23);
+        bits = _mm_and_si128(bits, _mm_cmpgt_epi32(exponent, min_exponent));
+        __m128 scale = _mm_mul_ps(_mm_castsi128_ps(bits), inv_255);
+
+        __m128i out = alpha;
+        for (int channel=0; channel < 3; channel++) {
+            __m128i c = _mm_and_si128(_mm_srli_epi32(in, channel * 8), byte_mask);
+            __m128 value = _mm_sqrt_ps(_mm_mul_ps(_mm_cvtepi32_ps(c), scale));
+            value = _mm_mul_ps(_mm_min_ps(value, one), full);
+            out = _mm_or_si128(out, _mm_slli_epi32(_mm_cvtps_epi32(value), channel * 8));
+        }
+        _mm_storeu_si128((__m128i*)(texels + i), out);
+    }
+
+    return i;
+}
+
+/**
+ * Same as decode_sse, 8 samples at a time.
+ */
+__attribute__((target("avx2")))
+static size_t decode_avx2(const uint8_t* samples, uint32_t* texels, size_t count) {
+    const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+    const __m256i min_exponent = _mm256_set1_epi32(-127);
+    const __m256i bias = _mm256_set1_epi32(127);
+    const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+    const __m256 inv_255 = _mm256_set1_ps(1.0f / 255.0f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 full = _mm256_set1_ps(255.0f);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256i in = _mm256_loadu_si256((const __m256i*)(samples + i * 4));
+
+        __m256i exponent = _mm256_srai_epi32(in, 24);
+        __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(exponent, bias), 23);
+        bits = _mm256_and_si256(bits, _mm256_cmpgt_epi32(exponent, min_exponent));
+        __m256 scale = _mm256_mul_ps(_mm256_castsi256_ps(bits), inv_255);
+
+        __m256i out = alpha;
+        for (int channel=0; channel < 3; channel++) {
+            __m256i c = _mm256_and_si256(_mm256_srli_epi32(in, channel * 8), byte_mask);
+            __m256 value = _mm256_sqrt_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(c), scale));
+            value = _mm256_mul_ps(_mm256_min_ps(value, one), full);
+            out = _mm256_or_si256(out, _mm256_slli_epi32(_mm256_cvtps_epi32(value), channel * 8));
+        }
+        _mm256_storeu_si256((__m256i*)(texels + i), out);
+    }
+
+    return i;
+}
+
+#endif // LIGHTMAP_DECODE_X86
+
+bool LightmapDecodePathSupported(LightmapDecodePath path) {
+    switch (path) {
+    case DECODE_BEST:
+    case DECODE_SCALAR:
+        return true;
+#ifdef LIGHTMAP_DECODE_X86
+    case DECODE_SSE:
+        return true;
+    case DECODE_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+/**
+ * Runs the requested SIMD kernel over as much as it can, then finishes off
+ * the leftovers with the scalar code.
+ */
+void DecodeLightmapSamples(const uint8_t* samples, uint32_t* texels, size_t count,
+                           LightmapDecodePath path) {
+    static const LightmapDecodePath best =
+        LightmapDecodePathSupported(DECODE_AVX2) ? DECODE_AVX2 :
+        LightmapDecodePathSupported(DECODE_SSE) ? DECODE_SSE : DECODE_SCALAR;
+    size_t done = 0;
+
+    if (path == DECODE_BEST) {
+        path = best;
+    }
+    if (!LightmapDecodePathSupported(path)) {
+        path = DECODE_SCALAR;
+    }
+
+#ifdef LIGHTMAP_DECODE_X86
+    if (path == DECODE_AVX2) {
+        done = decode_avx2(samples, texels, count);
+    } else if (path == DECODE_SSE) {
+        done = decode_sse(samples, texels, count);
+    }
+
+    /* Lightmaps are small, so the leftovers are a good share of the work.
+       Run them through the kernel too, padded out to a full block. */
+    if (path != DECODE_SCALAR && done < count) {
+        uint8_t block_samples[8 * 4] = {};
+        uint32_t block_texels[8];
+        size_t left = count - done;
+
+        memcpy(block_samples, samples + done * 4, left * 4);
+        if (path == DECODE_AVX2) {
+            decode_avx2(block_samples, block_texels, 8);
+        } else {
+            decode_sse(block_samples, block_texels, 8);
+        }
+        memcpy(texels + done, block_texels, left * sizeof(uint32_t));
+        done = count;
+    }
+#endif
+    decode_scalar(samples, texels, done, count);
+}
+
+
+LightmapAtlas::LightmapAtlas(const LumpView<uint8_t>& lighting,
+                             const LumpView<bsp_face_t>& map_faces,
+                             const TexinfoArrays& texinfo, ThreadPool* pool,
+                             uint32_t page_size) {
+    std::vector<uint32_t> order;
+
+    if (page_size <= 2 * LIGHTMAP_PADDING || page_size > 0xFFFF) {
+        throw LightmapAtlasException("Lightmap page size is out of range.");
+    }
+
+    FaceLightmap unlit = {};
+    unlit.page = LIGHTMAP_NO_PAGE;
+    faces.assign(map_faces.size(), unlit);
+    lit_faces = 0;
+    used_texels = 0;
+
+    /* Maps compiled with only HDR lighting have an empty lighting lump, those
+       just render unlit */
+    if (lighting.empty()) {
+        return;
+    }
+
+    /* Pick out the faces that have a lightmap and make sure it's all there */
+    for (size_t i=0; i < map_faces.size(); i++) {
+        bsp_face_t face = map_faces[i];
+        if (face.light_offset == LIGHTMAP_NO_OFFSET || face.styles[0] == LIGHTMAP_NO_STYLE ||
+            face.tex_info >= texinfo.lightmap_s.size()) {
+            continue;
+        }
+
+        uint64_t width = (uint64_t)face.lightmap_size[0] + 1;
+        uint64_t height = (uint64_t)face.lightmap_size[1] + 1;
+        if (width + 2 * LIGHTMAP_PADDING > page_size || height + 2 * LIGHTMAP_PADDING > page_size) {
+            throw LightmapAtlasException("Face " + std::to_string(i) +
+                                         "'s lightmap is too big for an atlas page.");
+        }
+        if (face.light_offset + width * height * 4 > lighting.size()) {
+            throw LightmapAtlasException("Face " + std::to_string(i) +
+                                         "'s lightmap runs off the end of the lighting lump.");
+        }
+
+        order.push_back(i);
+    }
+    lit_faces = order.size();
+
+    /* Tallest first, so each shelf is as tall as its first lightmap.  The
+       sizes fit in 16 bits (they're under the page size), so the sort key is
+       inverted height, inverted width, then face index in one integer. */
+    std::vector<uint64_t> keys(order.size());
+    for (size_t i=0; i < order.size(); i++) {
+        bsp_face_t face = map_faces[order[i]];
+        keys[i] = ((uint64_t)(0xFFFF - face.lightmap_size[1]) << 48) |
+                  ((uint64_t)(0xFFFF - face.lightmap_size[0]) << 32) | order[i];
+    }
+    std::sort(keys.begin(), keys.end());
+    for (size_t i=0; i < order.size(); i++) {
+        order[i] = (uint32_t)keys[i];
+    }
+
+    pack(map_faces, order, page_size);
+
+    /* Turn each face's lightmap vectors into atlas coordinates.  Luxel n's
+       centre is at n + 0.5 once the face's mins are taken off. */
+    for (uint32_t i : order) {
+        bsp_face_t face = map_faces[i];
+        FaceLightmap& out = faces[i];
+        const LightmapPage& page = pages[out.page];
+        glm::vec4 s = texinfo.lightmap_s[face.tex_info];
+        glm::vec4 t = texinfo.lightmap_t[face.tex_info];
+
+        out.uv_s = s / (float)page.width;
+        out.uv_s.w = (s.w - (int32_t)face.lightmap_mins[0] + out.x + 0.5f) / page.width;
+        out.uv_t = t / (float)page.height;
+        out.uv_t.w = (t.w - (int32_t)face.lightmap_mins[1] + out.y + 0.5f) / page.height;
+    }
+
+    /* Every face writes its own rect, so faces can be decoded in any order */
+    texels.assign(pages.empty() ? 0 : pages.back().first_texel +
+                  (uint64_t)pages.back().width * pages.back().height, 0);
+    ThreadPool::ParallelFor(pool, order.size(), [&](size_t first, size_t last) {
+        decode(lighting, map_faces, order, first, last);
+    });
+}
+
+LightmapAtlas LightmapAtlas::FromBSP(BSPParser* parser, const TexinfoArrays& texinfo,
+                                     ThreadPool* pool) {
+    return LightmapAtlas(parser->Lighting(), parser->Faces(), texinfo, pool);
+}
+
+const std::vector<FaceLightmap>& LightmapAtlas::Faces() const {
+    return faces;
+}
+
+const std::vector<LightmapPage>& LightmapAtlas::Pages() const {
+    return pages;
+}
+
+const std::vector<uint32_t>& LightmapAtlas::Texels() const {
+    return texels;
+}
+
+std::vector<uint32_t> LightmapAtlas::ReleaseTexels() {
+    return std::move(texels);
+}
+
+size_t LightmapAtlas::LitFaces() const {
+    return lit_faces;
+}
+
+double LightmapAtlas::Occupancy() const {
+    uint64_t total = 0;
+    for (const LightmapPage& page : pages) {
+        total += (uint64_t)page.width * page.height;
+    }
+    return total == 0 ? 0.0 : (double)used_texels / total;
+}
+
+/**
+ * Places the faces in order onto shelves, left to right, starting a new shelf
+ * when one fills up and a new page when a shelf won't fit under the last one.
+ * Each page is trimmed to the height its shelves use.
+ */
+void LightmapAtlas::pack(const LumpView<bsp_face_t>& map_faces,
+                         const std::vector<uint32_t>& order, uint32_t page_size) {
+    uint32_t shelf_x = 0;
+    uint32_t shelf_y = 0;
+    uint32_t shelf_height = 0;
+
+    for (uint32_t i : order) {
+        bsp_face_t face = map_faces[i];
+        uint32_t width = face.lightmap_size[0] + 1 + 2 * LIGHTMAP_PADDING;
+        uint32_t height = face.lightmap_size[1] + 1 + 2 * LIGHTMAP_PADDING;
+
+        if (pages.empty() || shelf_x + width > page_size) {
+            shelf_y += shelf_height;
+            shelf_x = 0;
+            shelf_height = height;
+
+            if (pages.empty() || shelf_y + shelf_height > page_size) {
+                pages.push_back(LightmapPage{page_size, 0, 0});
+                shelf_y = 0;
+            }
+        }
+
+        FaceLightmap& out = faces[i];
+        out.page = pages.size() - 1;
+        out.x = shelf_x + LIGHTMAP_PADDING;
+        out.y = shelf_y + LIGHTMAP_PADDING;
+        out.width = width - 2 * LIGHTMAP_PADDING;
+        out.height = height - 2 * LIGHTMAP_PADDING;
+
+        shelf_x += width;
+        pages.back().height = shelf_y + shelf_height;
+        used_texels += (uint64_t)width * height;
+    }
+
+    /* Pages go back to back in the texel buffer */
+    uint64_t first_texel = 0;
+    for (LightmapPage& page : pages) {
+        page.first_texel = first_texel;
+        first_texel += (uint64_t)page.width * page.height;
+    }
+}
+
+/**
+ * Decodes faces order[first, last) into their rects, then copies each rect's
+ * edges out into its padding.
+ */
+void LightmapAtlas::decode(const LumpView<uint8_t>& lighting,
+                           const LumpView<bsp_face_t>& map_faces,
+                           const std::vector<uint32_t>& order, size_t first, size_t last) {
+    std::vector<uint32_t> scratch;
+
+    for (size_t n=first; n < last; n++) {
+        bsp_face_t face = map_faces[order[n]];
+        const FaceLightmap& lightmap = faces[order[n]];
+        const LightmapPage& page = pages[lightmap.page];
+        uint32_t* page_texels = texels.data() + page.first_texel;
+        size_t width = lightmap.width;
+        size_t height = lightmap.height;
+
+        /* Decode the whole face in one go, rows are too short to keep the
+           SIMD kernels busy on their own */
+        scratch.resize(width * height);
+        DecodeLightmapSamples(lighting.Bytes() + face.light_offset, scratch.data(),
+                              scratch.size());
+
+        for (size_t row=0; row < height; row++) {
+            uint32_t* out = page_texels + (lightmap.y + row) * page.width + lightmap.x;
+            memcpy(out, scratch.data() + row * width, width * sizeof(uint32_t));
+            for (int pad=1; pad <= LIGHTMAP_PADDING; pad++) {
+                out[-pad] = out[0];
+                out[width - 1 + pad] = out[width - 1];
+            }
+        }
+
+        uint32_t* top = page_texels + lightmap.y * page.width + lightmap.x - LIGHTMAP_PADDING;
+        uint32_t* bottom = top + (height - 1) * page.width;
+        size_t padded_width = (width + 2 * LIGHTMAP_PADDING) * sizeof(uint32_t);
+        for (int pad=1; pad <= LIGHTMAP_PADDING; pad++) {
+            memcpy(top - pad * page.width, top, padded_width);
+            memcpy(bottom + pad * page.width, bottom, padded_width);
+        }
+    }
+}
@@ -0,0 +1,118 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Decompression of LZMA compressed lumps.
+ */
+
+#include <string.h>
+#include <lzma.h>
+#include "bsp_file.h"
+#include "bsp_parser.h"
+#include "lzma_lump.h"
+
+
+/**
+ * Checks whether a lump's data starts with an LZMA header.
+ */
+bool IsLZMALump(const uint8_t* data, size_t data_len) {
+    uint32_t identifier;
+
+    if (data_len < sizeof(lzma_header_t)) {
+        return false;
+    }
+
+    memcpy(&identifier, data, sizeof(identifier));
+    return identifier == LZMA_IDENTIFIER;
+}
+
+/**
+ * Size of a compressed lump's data once it's decompressed.
+ */
+size_t LZMALumpSize(const uint8_t* data, size_t data_len) {
+    lzma_header_t header;
+
+    if (!IsLZMALump(data, data_len)) {
+        throw BSPParserException("Lump isn't LZMA compressed.");
+    }
+
+    memcpy(&header, data, sizeof(header));
+    return header.actual_size;
+}
+
+/**
+ * Decompresses a compressed lump.
+ *
+ * Valve's header holds the same coder properties as the header of a .lzma
+ * (LZMA_Alone) file, just arranged differently.  We rebuild the .lzma header
+ * with the known uncompressed size and feed it to liblzma ahead of the
+ * compressed data, which saves us from copying the compressed data anywhere.
+ */
+std::vector<uint8_t> DecompressLZMALump(const uint8_t* data, size_t data_len) {
+    lzma_header_t header;
+    uint8_t alone_header[13];
+    lzma_stream stream = LZMA_STREAM_INIT;
+    lzma_ret ret;
+
+    if (!IsLZMALump(data, data_len)) {
+        throw BSPParserException("Lump isn't LZMA compressed.");
+    }
+    memcpy(&header, data, sizeof(header));
+
+    if (data_len - sizeof(header) < header.lzma_size) {
+        throw BSPParserException("Compressed lump is larger than the lump holding it.");
+    }
+
+    /* .lzma header is the 5 property bytes then the 64 bit uncompressed size */
+    uint64_t actual_size = header.actual_size;
+    memcpy(alone_header, header.properties, sizeof(header.properties));
+    memcpy(alone_header + sizeof(header.properties), &actual_size, sizeof(actual_size));
+
+    std::vector<uint8_t> out(header.actual_size);
+    if (out.empty()) {
+        return out;
+    }
+
+    if (lzma_alone_decoder(&stream, UINT64_MAX) != LZMA_OK) {
+        throw BSPParserException("Failed to set up the LZMA decoder.");
+    }
+
+    stream.next_out = out.data();
+    stream.avail_out = out.size();
+
+    /* Feed the header we built */
+    stream.next_in = alone_header;
+    stream.avail_in = sizeof(alone_header);
+    ret = lzma_code(&stream, LZMA_RUN);
+
+    /* Then the compressed data straight out of the lump */
+    if (ret == LZMA_OK) {
+        stream.next_in = data + sizeof(header);
+        stream.avail_in = header.lzma_size;
+        ret = lzma_code(&stream, LZMA_FINISH);
+    }
+
+    size_t decoded = stream.total_out;
+    lzma_end(&stream);
+
+    if (ret != LZMA_STREAM_END || decoded != header.actual_size) {
+        throw BSPParserException("Failed to decompress LZMA lump.");
+    }
+
+    return out;
+}
@@ -25,12 +25,18 @@
 
 #include <stdio.h>
 #include <math.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
 #include <vector>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <GLFW/glfw3.h>
 #include "bsp_parser.h"
+#include "map_geometry.h"
+#include "render_cache.h"
+#include "thread_pool.h"
 #include "camera.h"
 #include "shader.h"
 #include "mesh.h"
@@ -40,6 +46,8 @@
 #define WINDOW_WIDTH 1600
 #define WINDOW_HEIGHT 900
 #define CAMERA_FOV 45.0f
+#define CAMERA_NEAR 0.1f
+#define MAP_SCALE 0.005f
 
 Camera camera(glm::vec3(0.0f, 0.0f, 5.0f));
 float delta_time = 0.0f;
@@ -47,6 +55,7 @@ float last_frame = 0.0f;
 float last_x = 0.0f;
 float last_y = 0.0f;
 int draw_mode = 0;
+MapRenderMode map_render_mode = RENDER_BATCHED;
 
 
 /**
@@ -78,6 +87,9 @@ void key_callback(GLFWwindow* window, int key, int scode, int action, int mod) {
 		break;
 	    }
 	}
+        if (key == GLFW_KEY_B) {
+            map_render_mode = MapRenderMode((map_render_mode + 1) % (RENDER_MESHLETS + 1));
+        }
 
         bool sprint = bool(mod | GLFW_MOD_SHIFT);
     }
@@ -121,6 +133,109 @@ void mouse_callback(GLFWwindow* window, double pos_x, double pos_y) {
     camera.ProcessMouseMovement(x_offset, y_offset);
 }
 
+/**
+ * Transform from map units into the world, Source maps are z up and huge.
+ */
+glm::mat4 map_model_matrix() {
+    glm::mat4 model = glm::mat4();
+    model = glm::scale(model, glm::vec3(MAP_SCALE));
+    model = glm::rotate(model, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+    model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    return model;
+}
+
+/**
+ * Drops the camera in the middle of a map and works out a far plane that
+ * takes in the whole thing.
+ */
+float frame_map(const Map* map) {
+    const VertexBounds& bounds = map->Bounds();
+
+    if (bounds.non_finite > 0) {
+        printf("Warning: map has %zu vertices with NaN/Inf coordinates\n", bounds.non_finite);
+    }
+    if (bounds.mins.x > bounds.maxs.x) {
+        return 1000.0f;  // No usable vertices
+    }
+
+    glm::vec3 center = (bounds.mins + bounds.maxs) * 0.5f;
+    float diagonal = glm::length(bounds.maxs - bounds.mins) * MAP_SCALE;
+    camera.pos = glm::vec3(map_model_matrix() * glm::vec4(center, 1.0f));
+
+    return fmaxf(diagonal, CAMERA_NEAR * 10.0f);
+}
+
+/**
+ * Loads a map, out of the render cache if it's been loaded before.
+ */
+Map* load_map(const std::string& path) {
+    std::vector<uint32_t> map_lumps = { LUMP_VERTEXES, LUMP_EDGES, LUMP_SURFEDGES, LUMP_FACES,
+                                        LUMP_TEXINFO, LUMP_TEXDATA, LUMP_TEXDATA_STRING_TABLE,
+                                        LUMP_TEXDATA_STRING_DATA, LUMP_LIGHTING, LUMP_DISPINFO,
+                                        LUMP_DISP_VERTS, LUMP_DISP_TRIS, LUMP_MODELS,
+                                        LUMP_VERTNORMALS, LUMP_VERTNORMALINDICES };
+    std::unique_ptr<BSPParser> parser;
+    std::unique_ptr<Map> map(new Map());
+
+    /* A path of "-" streams the map in from stdin, which we can't cache */
+    if (path == "-") {
+        printf("Parsing BSP file from stdin\n");
+        parser.reset(new BSPParser(STDIN_FILENO, map_lumps));
+        map->FromBSP(parser.get());
+        return map.release();
+    }
+
+    /* Try the cache first, a hit skips parsing and building entirely.  The
+       cache is optional, so failing to even key it just means no caching */
+    RenderCacheKey key = {};
+    std::string cache_path;
+    bool cacheable = false;
+    try {
+        key = RenderCache::KeyForFile(path);
+        cache_path = RenderCache::PathForKey(key);
+        cacheable = true;
+
+        RenderCache cache(cache_path);
+        if (cache.Matches(key)) {
+            printf("Loading map from render cache at \'%s\'\n", cache_path.c_str());
+            map->FromCache(cache);
+            return map.release();
+        }
+    } catch (RenderCacheException& e) {
+        printf("No usable render cache: %s\n", e.what());
+    }
+
+    printf("Parsing BSP file at \'%s\'\n", path.c_str());
+    parser.reset(new BSPParser(path));
+
+    /* Decode the lumps the map is built from across all cores */
+    ThreadPool pool;
+    double decode_start = glfwGetTime();
+    parser->DecodeLumps(map_lumps, &pool);
+    printf("Decoded lumps in %.3f ms on %u threads\n",
+           (glfwGetTime() - decode_start) * 1000.0, pool.Size());
+
+    double build_start = glfwGetTime();
+    MapGeometry geometry = MapGeometry::FromBSP(parser.get(), &pool);
+    printf("Built map geometry (%zu vertices, %zu 16 bit and %zu 32 bit indices) and %zu lightmap pages in %.3f ms\n",
+           geometry.vertices.size(), geometry.indices.size(), geometry.wide_indices.size(),
+           geometry.lightmap_pages.size(), (glfwGetTime() - build_start) * 1000.0);
+    VertexCacheStats cache_stats = geometry.AnalyzeVertexCache();
+    printf("Vertex cache: ACMR %.3f, ATVR %.3f\n", cache_stats.acmr, cache_stats.atvr);
+    map->FromGeometry(geometry);
+
+    /* Save the built geometry for next time */
+    if (cacheable) {
+        try {
+            RenderCache::Write(cache_path, key, geometry);
+        } catch (RenderCacheException& e) {
+            printf("Failed to write render cache: %s\n", e.what());
+        }
+    }
+
+    return map.release();
+}
+
 /**
  * Entry point.
  */
@@ -260,17 +375,24 @@ int main(int argc, char* argv[]) {
     });
     glm::vec3 light_pos = glm::vec3(1.2f, 0.7f, 2.0f);
 
-    /* Parse BSP file if one is provided */
+    /* Load map if one is provided */
     Map* map = nullptr;
+    float far_plane = 1000.0f;
     if (argc >= 2) {
-        printf("Parsing BSP file at \'%s\'\n", argv[1]);
-        BSPParser parser(argv[1]);
-        map = new Map();
-        map->FromBSP(&parser);
+        try {
+            map = load_map(argv[1]);
+            far_plane = frame_map(map);
+        } catch (std::exception& e) {
+            printf("Not rendering map: %s\n", e.what());
+        }
     }
 
     /* Start render loop! */
     printf("Rendering started.\n");
+    double stats_start = glfwGetTime();
+    size_t stats_frames = 0;
+    size_t stats_draw_calls = 0;
+    size_t stats_meshlets = 0;
     while (!glfwWindowShouldClose(window)) {
         /* Calculate delta_time so that we can smooth movement */
         float current_frame = glfwGetTime();
@@ -336,13 +458,31 @@ int main(int argc, char* argv[]) {
         if (map != nullptr) {
           glm::mat4 projection = glm::perspective(glm::radians(CAMERA_FOV),
                                                   float(WINDOW_WIDTH)/WINDOW_HEIGHT,
-                                                  0.1f, 1000.0f);
+                                                  CAMERA_NEAR, far_plane);
           glm::mat4 view = camera.GetViewMatrix();
-          glm::mat4 model = glm::mat4();
-          model = glm::scale(model, glm::vec3(0.005f));
-          model = glm::rotate(model, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-          model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-          map->render(model, view, projection);
+          map->SetRenderMode(map_render_mode);
+          map->render(map_model_matrix(), view, projection);
+          stats_draw_calls += map->DrawCalls();
+          stats_meshlets += map->VisibleMeshlets();
+        }
+
+        /* Report frame time and draw calls every second, B cycles through
+           batched, per face and culled meshlet drawing to compare them */
+        stats_frames++;
+        if (glfwGetTime() - stats_start >= 1.0) {
+            double elapsed = glfwGetTime() - stats_start;
+            static const char* mode_names[] = { "Batched", "Per face", "Meshlets" };
+            printf("%s: %.2f ms/frame, %zu draw calls/frame", mode_names[map_render_mode],
+                   elapsed * 1000.0 / stats_frames, stats_draw_calls / stats_frames);
+            if (map_render_mode == RENDER_MESHLETS && map != nullptr) {
+                printf(", %zu of %zu meshlets visible", stats_meshlets / stats_frames,
+                       map->MeshletCount());
+            }
+            printf("\n");
+            stats_start = glfwGetTime();
+            stats_frames = 0;
+            stats_draw_calls = 0;
+            stats_meshlets = 0;
         }
 
         /* Check and call events and swap the buffers */
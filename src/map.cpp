@@ -22,92 +22,366 @@
  */
 
 #include <stdio.h>
+#include <algorithm>
 #include "map.h"
+#include "map_geometry.h"
+#include "render_cache.h"
 #include "bsp_parser.h"
 
-MapFace::MapFace(Shader* shader, std::vector<uint16_t>& indices) {
+MapFace::MapFace(Shader* shader, const MapDrawRange& range, GLenum index_type, size_t index_offset,
+                 Texture* lightmap_page) {
     this->shader = shader;
-    face_color = glm::vec3(float(rand()) / RAND_MAX,
-                           float(rand()) / RAND_MAX,
-                           float(rand()) / RAND_MAX);
-
-    /* Create the vertex object array that'll store the mesh render info */
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-
-    /* Create a buffer object to store vertex data in */
-    glGenBuffers(1, &element_bo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_bo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (size_t)(indices.size() * sizeof(uint16_t)),
-                 indices.data(), GL_STATIC_DRAW);
-    index_amt = indices.size();
-
-    /* Set the attrib pointer to point to our point info */
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GL_FLOAT), (void*)0);
-
-    /* Unbind the data buffer and the vertex array */
-    glBindVertexArray(0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    this->index_type = index_type;
+    this->index_offset = index_offset;
+    index_amt = range.index_count;
+    base_vertex = range.base_vertex;
+    this->lightmap_page = lightmap_page;
 }
 
 void MapFace::render() {
-    shader->SetVec3("face_color", face_color);
-    glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLE_STRIP, index_amt, GL_UNSIGNED_SHORT, 0);
+    if (lightmap_page != nullptr) {
+        lightmap_page->Use(GL_TEXTURE0);
+        shader->SetInt("lightmapped", 1);
+    } else {
+        shader->SetInt("lightmapped", 0);
+    }
+    glDrawElementsBaseVertex(GL_TRIANGLES, index_amt, index_type, (void*)index_offset, base_vertex);
 }
 
 Map::Map() {
   shader = nullptr;
+  vao = -1;
   vertex_bo = -1;
+  normal_bo = -1;
+  lightmap_uv_bo = -1;
+  element_bo = -1;
+  bounds = VertexBounds();
+  render_mode = RENDER_BATCHED;
+  draw_calls = 0;
+  visible_meshlets = 0;
 }
 
 void Map::render(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection) {
   shader->Use();
   shader->SetMat4("projection", projection);
   shader->SetMat4("view", view);
-  shader->SetMat4("model", model);
+  shader->SetInt("lightmap", 0);
+  shader->SetVec3("face_color", glm::vec3(0.7f, 0.7f, 0.7f));
+
+  /* Every face draws out of the same buffers, a model at a time */
+  glm::mat4 view_projection = projection * view;
+  glm::vec3 camera_pos = glm::vec3(glm::inverse(view)[3]);
+  draw_calls = 0;
+  visible_meshlets = 0;
+  glBindVertexArray(vao);
+  for (size_t i=0; i < models.size(); i++) {
+      if (models[i].index_count == 0) {
+          continue;
+      }
+
+      shader->SetMat4("model", model * model_transforms[i]);
+      if (render_mode == RENDER_PER_FACE) {
+          for (size_t face=models[i].first_face; face < models[i].first_face + models[i].face_count; face++) {
+              faces[face].render();
+              draw_calls++;
+          }
+          continue;
+      }
+      if (render_mode == RENDER_MESHLETS) {
+          renderMeshlets(i, model * model_transforms[i], view_projection, camera_pos);
+          continue;
+      }
 
-  for (MapFace face : faces) {
-      face.render();
+      /* Faces carry their lightmap coordinates in their vertices, so all
+         that changes between batches is the page */
+      for (size_t b=model_batches[i]; b < model_batches[i + 1]; b++) {
+          const MapBatch& batch = batches[b];
+          if (batch.lightmap_page != nullptr) {
+              batch.lightmap_page->Use(GL_TEXTURE0);
+              shader->SetInt("lightmapped", 1);
+          } else {
+              shader->SetInt("lightmapped", 0);
+          }
+          glMultiDrawElementsBaseVertex(GL_TRIANGLES, batch.counts.data(), batch.index_type,
+                                        batch.offsets.data(), batch.counts.size(),
+                                        batch.base_vertices.data());
+          draw_calls++;
+      }
+  }
+  glBindVertexArray(0);
+}
+
+/**
+ * Draws a model's meshlets that are inside the view frustum and aren't
+ * entirely backfacing, batched by lightmap page.  Culling happens in model
+ * space, the frustum planes come straight out of the model's combined
+ * matrix and the camera gets moved into the model.  That assumes model
+ * transforms only scale uniformly.
+ */
+void Map::renderMeshlets(size_t model, const glm::mat4& transform, const glm::mat4& view_projection,
+                         const glm::vec3& camera_pos) {
+  glm::mat4 mvp = view_projection * transform;
+  glm::vec4 w_row(mvp[0][3], mvp[1][3], mvp[2][3], mvp[3][3]);
+  glm::vec4 planes[6];
+  for (int k=0; k < 3; k++) {
+      glm::vec4 row(mvp[0][k], mvp[1][k], mvp[2][k], mvp[3][k]);
+      planes[k * 2] = w_row + row;
+      planes[k * 2 + 1] = w_row - row;
+  }
+  glm::vec3 camera = glm::vec3(glm::inverse(transform) * glm::vec4(camera_pos, 1.0f));
+
+  const MapModel& map_model = models[model];
+  GLenum index_type = (map_model.index_size == sizeof(uint32_t)) ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+  for (MapBatch& batch : culled_batches) {
+      batch.counts.clear();
+      batch.offsets.clear();
+      batch.base_vertices.clear();
+  }
+
+  for (size_t i=map_model.first_meshlet; i < map_model.first_meshlet + map_model.meshlet_count; i++) {
+      const MapMeshlet& meshlet = meshlets[i];
+      bool outside = false;
+      for (const glm::vec4& plane : planes) {
+          glm::vec3 normal = glm::vec3(plane);
+          if (glm::dot(normal, meshlet.bounds.centre) + plane.w < -meshlet.bounds.radius * glm::length(normal)) {
+              outside = true;
+              break;
+          }
+      }
+      if (outside || MeshletBackfacing(meshlet.bounds, camera)) {
+          continue;
+      }
+
+      /* Meshlets next to each other in the buffer merge into one draw */
+      size_t slot = (meshlet.lightmap_page >= 0 && (size_t)meshlet.lightmap_page < lightmap_pages.size())
+                    ? meshlet.lightmap_page + 1 : 0;
+      MapBatch& batch = culled_batches[slot];
+      visible_meshlets++;
+      if (!batch.counts.empty() && batch.base_vertices.back() == (GLint)meshlet.base_vertex &&
+          (size_t)batch.offsets.back() + batch.counts.back() * map_model.index_size == meshlet_offsets[i]) {
+          batch.counts.back() += meshlet.index_count;
+          continue;
+      }
+      batch.counts.push_back(meshlet.index_count);
+      batch.offsets.push_back((const void*)meshlet_offsets[i]);
+      batch.base_vertices.push_back(meshlet.base_vertex);
+  }
+
+  for (const MapBatch& batch : culled_batches) {
+      if (batch.counts.empty()) {
+          continue;
+      }
+      if (batch.lightmap_page != nullptr) {
+          batch.lightmap_page->Use(GL_TEXTURE0);
+          shader->SetInt("lightmapped", 1);
+      } else {
+          shader->SetInt("lightmapped", 0);
+      }
+      glMultiDrawElementsBaseVertex(GL_TRIANGLES, batch.counts.data(), index_type,
+                                    batch.offsets.data(), batch.counts.size(),
+                                    batch.base_vertices.data());
+      draw_calls++;
   }
 }
 
 void Map::FromBSP(BSPParser* parser) {
+  FromGeometry(MapGeometry::FromBSP(parser));
+}
+
+void Map::FromGeometry(const MapGeometry& geometry) {
+  bounds = geometry.bounds;
+  upload(geometry.vertices.data(), geometry.normals.data(), geometry.lightmap_uvs.data(),
+         geometry.vertices.size(),
+         geometry.indices.data(), geometry.indices.size() * sizeof(uint16_t),
+         geometry.wide_indices.data(), geometry.wide_indices.size() * sizeof(uint32_t),
+         geometry.face_ranges, geometry.models, geometry.meshlets, geometry.face_lightmaps,
+         geometry.lightmap_pages, geometry.lightmap_texels.data());
+}
+
+void Map::FromCache(const RenderCache& cache) {
+  bounds = cache.Bounds();
+
+  /* The buffers go to OpenGL straight out of the mapped cache file */
+  upload(cache.Vertices().Bytes(), cache.Normals().Bytes(), cache.LightmapUVs().Bytes(),
+         cache.Vertices().size(),
+         cache.Indices().Bytes(), cache.Indices().SizeBytes(),
+         cache.WideIndices().Bytes(), cache.WideIndices().SizeBytes(),
+         cache.FaceRanges().Copy(), cache.Models().Copy(), cache.Meshlets().Copy(),
+         cache.FaceLightmaps().Copy(),
+         cache.LightmapPages().Copy(), cache.LightmapTexels().Data());
+}
+
+const VertexBounds& Map::Bounds() const {
+  return bounds;
+}
+
+size_t Map::ModelCount() const {
+  return models.size();
+}
+
+const MapModel& Map::Model(size_t model) const {
+  return models.at(model);
+}
+
+void Map::SetModelTransform(size_t model, const glm::mat4& transform) {
+  model_transforms.at(model) = transform;
+}
+
+void Map::SetRenderMode(MapRenderMode mode) {
+  render_mode = mode;
+}
+
+MapRenderMode Map::RenderMode() const {
+  return render_mode;
+}
+
+size_t Map::DrawCalls() const {
+  return draw_calls;
+}
+
+size_t Map::VisibleMeshlets() const {
+  return visible_meshlets;
+}
+
+size_t Map::MeshletCount() const {
+  return meshlets.size();
+}
+
+void Map::upload(const void* vertices, const void* normals, const void* lightmap_uvs,
+                 size_t vertices_len,
+                 const void* indices, size_t indices_len,
+                 const void* wide_indices, size_t wide_indices_len,
+                 const std::vector<MapDrawRange>& face_ranges,
+                 const std::vector<MapModel>& models,
+                 const std::vector<MapMeshlet>& meshlets,
+                 const std::vector<FaceLightmap>& face_lightmaps,
+                 const std::vector<LightmapPage>& pages, const uint32_t* texels) {
   shader = new Shader("./assets/shaders/level.glsl");
 
+  /* Create the vertex object array that'll store the map render info */
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
+
   /* Create a buffer object to store vertex data in */
   glGenBuffers(1, &vertex_bo);
   glBindBuffer(GL_ARRAY_BUFFER, vertex_bo);
-  glBufferData(GL_ARRAY_BUFFER, parser->vertices.size() * sizeof(glm::vec3),
-               parser->vertices.data(), GL_STATIC_DRAW);
-
-  /* Create faces */
-  for (bsp_face_t face : parser->map_faces) {
-      /* Extract each point in the edge */
-      std::vector<uint16_t> points;
-      for (int edge_index=face.first_edge; edge_index < face.first_edge + face.num_edges; edge_index++) {
-          uint16_t edge1;
-          uint16_t edge2;
-
-          bsp_surfedge_t surfedge = parser->map_surfedges[edge_index];
-          bsp_edge_t edge = parser->map_edges[abs(surfedge)];
-          if (surfedge < 0) {
-              edge1 = edge.v[0];
-              edge2 = edge.v[1];
-          } else {
-              edge1 = edge.v[1];
-              edge2 = edge.v[0];
+  glBufferData(GL_ARRAY_BUFFER, vertices_len * sizeof(glm::vec3), vertices, GL_STATIC_DRAW);
+
+  /* Create a buffer object to store every face's indices in, the 32 bit
+     ones go after the 16 bit ones */
+  size_t wide_offset = (indices_len + 3) & ~(size_t)3;
+  glGenBuffers(1, &element_bo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_bo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, wide_offset + wide_indices_len, nullptr, GL_STATIC_DRAW);
+  glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indices_len, indices);
+  glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, wide_offset, wide_indices_len, wide_indices);
+
+  /* Set the attrib pointer to point to our point info */
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GL_FLOAT), (void*)0);
+
+  /* Normals go in their own buffer, one for each vertex */
+  glGenBuffers(1, &normal_bo);
+  glBindBuffer(GL_ARRAY_BUFFER, normal_bo);
+  glBufferData(GL_ARRAY_BUFFER, vertices_len * sizeof(glm::vec3), normals, GL_STATIC_DRAW);
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GL_FLOAT), (void*)0);
+
+  /* And so do the lightmap coordinates */
+  glGenBuffers(1, &lightmap_uv_bo);
+  glBindBuffer(GL_ARRAY_BUFFER, lightmap_uv_bo);
+  glBufferData(GL_ARRAY_BUFFER, vertices_len * sizeof(glm::vec2), lightmap_uvs, GL_STATIC_DRAW);
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GL_FLOAT), (void*)0);
+
+  /* Upload the lightmap atlas, the faces point into it so it can't grow after this */
+  lightmap_pages.reserve(pages.size());
+  for (const LightmapPage& page : pages) {
+      lightmap_pages.push_back(Texture(texels + page.first_texel, page.width, page.height));
+  }
+
+  /* Create faces, each reads indices of whatever size its model uses.
+     Faces outside every model don't have any */
+  std::vector<GLenum> index_types(face_ranges.size(), GL_UNSIGNED_SHORT);
+  std::vector<size_t> index_offsets(face_ranges.size(), 0);
+  for (const MapModel& model : models) {
+      for (size_t i=model.first_face; i < model.first_face + model.face_count; i++) {
+          bool wide = (model.index_size == sizeof(uint32_t));
+          index_types[i] = wide ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+          index_offsets[i] = (wide ? wide_offset : 0) + (size_t)face_ranges[i].first_index * model.index_size;
+      }
+  }
+  for (size_t i=0; i < face_ranges.size(); i++) {
+      Texture* page = nullptr;
+      if (i < face_lightmaps.size() && face_lightmaps[i].page >= 0 &&
+          (size_t)face_lightmaps[i].page < lightmap_pages.size()) {
+          page = &lightmap_pages[face_lightmaps[i].page];
+      }
+      faces.push_back(MapFace(shader, face_ranges[i], index_types[i], index_offsets[i], page));
+  }
+
+  /* Every model starts out where it was compiled */
+  this->models = models;
+  model_transforms.assign(models.size(), glm::mat4(1.0f));
+
+  /* Batch each model's faces by lightmap page, slot 0 holds the unlit
+     ones.  Faces go in in index buffer order, which is the order the
+     geometry was optimized to draw in, and neighbours in the buffer merge
+     into one draw */
+  model_batches.assign(1, 0);
+  for (const MapModel& model : models) {
+      std::vector<size_t> model_faces;
+      for (size_t i=model.first_face; i < model.first_face + model.face_count; i++) {
+          if (face_ranges[i].index_count != 0) {
+              model_faces.push_back(i);
+          }
+      }
+      std::stable_sort(model_faces.begin(), model_faces.end(), [&](size_t a, size_t b) {
+          return face_ranges[a].first_index < face_ranges[b].first_index;
+      });
+
+      std::vector<int> page_batch(lightmap_pages.size() + 1, -1);
+      for (size_t i : model_faces) {
+          const MapDrawRange& range = face_ranges[i];
+          int32_t page = (i < face_lightmaps.size()) ? face_lightmaps[i].page : LIGHTMAP_NO_PAGE;
+          size_t slot = (page >= 0 && (size_t)page < lightmap_pages.size()) ? page + 1 : 0;
+          if (page_batch[slot] < 0) {
+              page_batch[slot] = batches.size();
+              batches.push_back(MapBatch());
+              batches.back().lightmap_page = (slot == 0) ? nullptr : &lightmap_pages[slot - 1];
+              batches.back().index_type = index_types[i];
           }
 
-          /* Add the point indices to the array */
-          points.push_back(edge1);
-          points.push_back(edge2);
+          MapBatch& batch = batches[page_batch[slot]];
+          if (!batch.counts.empty() && batch.base_vertices.back() == (GLint)range.base_vertex &&
+              (size_t)batch.offsets.back() + batch.counts.back() * model.index_size == index_offsets[i]) {
+              batch.counts.back() += range.index_count;
+              continue;
+          }
+          batch.counts.push_back(range.index_count);
+          batch.offsets.push_back((const void*)index_offsets[i]);
+          batch.base_vertices.push_back(range.base_vertex);
       }
+      model_batches.push_back(batches.size());
+  }
 
-      faces.push_back(MapFace(shader, points));
+  /* Meshlets get drawn out of the same buffer, with one batch per page
+     refilled by whatever survives culling */
+  this->meshlets = meshlets;
+  meshlet_offsets.assign(meshlets.size(), 0);
+  for (const MapModel& model : models) {
+      size_t base = (model.index_size == sizeof(uint32_t)) ? wide_offset : 0;
+      for (size_t i=model.first_meshlet; i < model.first_meshlet + model.meshlet_count; i++) {
+          meshlet_offsets[i] = base + (size_t)meshlets[i].first_index * model.index_size;
+      }
+  }
+  culled_batches.assign(lightmap_pages.size() + 1, MapBatch());
+  for (size_t slot=0; slot < culled_batches.size(); slot++) {
+      culled_batches[slot].lightmap_page = (slot == 0) ? nullptr : &lightmap_pages[slot - 1];
   }
 
-  /* Unbind the vertex buffer */
+  /* Unbind the vertex array and then the buffers */
+  glBindVertexArray(0);
   glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
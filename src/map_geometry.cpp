@@ -0,0 +1,500 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief GPU ready map geometry, built on the CPU.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+#include "map_geometry.h"
+#include "bsp_parser.h"
+#include "geometry_validator.h"
+#include "material_table.h"
+#include "displacement.h"
+#include "vertex_normals.h"
+#include "vertex_weld.h"
+#include "mesh_optimizer.h"
+#include "thread_pool.h"
+
+
+/**
+ * Grows bounds to take in more vertices, skipping and counting non-finite ones.
+ */
+static void extend_bounds(VertexBounds* bounds, const glm::vec3* vertices, size_t count) {
+  for (size_t i=0; i < count; i++) {
+      glm::vec3 v = vertices[i];
+      if (!std::isfinite(v.x) || !std::isfinite(v.y) || !std::isfinite(v.z)) {
+          bounds->non_finite++;
+          continue;
+      }
+      bounds->mins = glm::vec3(std::min(bounds->mins.x, v.x), std::min(bounds->mins.y, v.y),
+                               std::min(bounds->mins.z, v.z));
+      bounds->maxs = glm::vec3(std::max(bounds->maxs.x, v.x), std::max(bounds->maxs.y, v.y),
+                               std::max(bounds->maxs.z, v.z));
+  }
+}
+
+
+/**
+ * Reorders one model's welded triangles and vertices for the GPU.  Faces
+ * sharing a lightmap page draw together, so each page's faces are laid out
+ * in one run and optimized as one draw: Forsyth order for the vertex
+ * cache, then runs of faces sorted against overdraw.  A face's triangles
+ * stay together so faces can still be drawn one at a time.  Last of all
+ * the vertices are renumbered in the order they're first used.
+ */
+static void optimize_model(std::vector<uint32_t>* indices, std::vector<WeldVertex>* vertices,
+                           std::vector<uint32_t> faces, std::vector<MapDrawRange>* face_ranges,
+                           const std::vector<FaceLightmap>& face_lightmaps) {
+  std::stable_sort(faces.begin(), faces.end(), [&](uint32_t a, uint32_t b) {
+      return face_lightmaps[a].page < face_lightmaps[b].page;
+  });
+
+  /* Each page's vertices get numbered from 0 so the passes only size
+     their tables for the page */
+  std::vector<uint32_t> local_ids(vertices->size(), UINT32_MAX);
+  std::vector<uint32_t> out;
+  out.reserve(indices->size());
+  for (size_t first=0, last=0; first < faces.size(); first = last) {
+      int32_t page = face_lightmaps[faces[first]].page;
+      while (last < faces.size() && face_lightmaps[faces[last]].page == page) {
+          last++;
+      }
+
+      std::vector<uint32_t> batch;
+      std::vector<uint32_t> owners;  // Which face each triangle is from
+      std::vector<uint32_t> local_vertices;
+      std::vector<glm::vec3> positions;
+      for (size_t f=first; f < last; f++) {
+          const MapDrawRange& range = (*face_ranges)[faces[f]];
+          for (uint32_t k=0; k < range.index_count; k++) {
+              uint32_t v = (*indices)[range.first_index + k];
+              if (local_ids[v] == UINT32_MAX) {
+                  local_ids[v] = local_vertices.size();
+                  local_vertices.push_back(v);
+                  positions.push_back((*vertices)[v].position);
+              }
+              batch.push_back(local_ids[v]);
+          }
+          owners.insert(owners.end(), range.index_count / 3, f - first);
+      }
+      for (uint32_t v : local_vertices) {
+          local_ids[v] = UINT32_MAX;
+      }
+
+      /* Each face goes where Forsyth put its first triangle, with its
+         triangles in the order Forsyth put them */
+      std::vector<uint32_t> triangles = VertexCacheOrder(batch.data(), batch.size(), positions.size());
+      std::vector<uint32_t> rank(last - first, UINT32_MAX);
+      uint32_t ranked = 0;
+      for (uint32_t t : triangles) {
+          if (rank[owners[t]] == UINT32_MAX) {
+              rank[owners[t]] = ranked++;
+          }
+      }
+      std::stable_sort(triangles.begin(), triangles.end(), [&](uint32_t a, uint32_t b) {
+          return rank[owners[a]] < rank[owners[b]];
+      });
+
+      std::vector<uint32_t> ordered;
+      std::vector<MeshCluster> clusters;
+      std::vector<uint32_t> cluster_faces;
+      ordered.reserve(batch.size());
+      for (uint32_t t : triangles) {
+          uint32_t face = faces[first + owners[t]];
+          if (cluster_faces.empty() || cluster_faces.back() != face) {
+              clusters.push_back({ (uint32_t)ordered.size(), 0 });
+              cluster_faces.push_back(face);
+          }
+          ordered.insert(ordered.end(), batch.begin() + t * 3, batch.begin() + t * 3 + 3);
+          clusters.back().index_count += 3;
+      }
+
+      for (uint32_t cluster : OverdrawOrder(ordered.data(), clusters, positions.data(), positions.size())) {
+          (*face_ranges)[cluster_faces[cluster]].first_index = out.size();
+          for (uint32_t k=0; k < clusters[cluster].index_count; k++) {
+              out.push_back(local_vertices[ordered[clusters[cluster].first_index + k]]);
+          }
+      }
+  }
+
+  /* Renumber the vertices in the order the GPU will fetch them */
+  std::vector<uint32_t> remap(vertices->size());
+  VertexFetchRemap(remap.data(), out.data(), out.size(), vertices->size());
+  std::vector<WeldVertex> fetch_ordered(vertices->size());
+  for (size_t v=0; v < vertices->size(); v++) {
+      fetch_ordered[remap[v]] = (*vertices)[v];
+  }
+  for (uint32_t& index : out) {
+      index = remap[index];
+  }
+
+  vertices->swap(fetch_ordered);
+  indices->swap(out);
+}
+
+/**
+ * Welds each model's vertices, putting them one model after another with
+ * its faces' indices made relative to the model's first vertex.  Models
+ * that end up with at most 65536 vertices keep 16 bit indices, anything
+ * bigger is moved to the wide indices.  Faces outside every model are
+ * never drawn and get dropped.
+ */
+static void weld_models(MapGeometry* geometry, bool optimize) {
+  std::vector<MapDrawRange> source_ranges;
+  std::vector<uint16_t> source_indices;
+  std::vector<glm::vec3> source_vertices;
+  std::vector<glm::vec3> source_normals;
+  std::vector<glm::vec2> source_lightmap_uvs;
+  source_ranges.swap(geometry->face_ranges);
+  source_indices.swap(geometry->indices);
+  source_vertices.swap(geometry->vertices);
+  source_normals.swap(geometry->normals);
+  source_lightmap_uvs.swap(geometry->lightmap_uvs);
+
+  MapDrawRange empty = {};
+  geometry->face_ranges.assign(source_ranges.size(), empty);
+  for (MapModel& model : geometry->models) {
+      /* Go through the faces in index order, which puts displacements
+         after the rest like they were before welding */
+      std::vector<uint32_t> faces;
+      for (uint32_t i=model.first_face; i < model.first_face + model.face_count; i++) {
+          if (source_ranges[i].index_count != 0) {
+              faces.push_back(i);
+          }
+      }
+      std::stable_sort(faces.begin(), faces.end(), [&](uint32_t a, uint32_t b) {
+          return source_ranges[a].first_index < source_ranges[b].first_index;
+      });
+
+      VertexWelder welder(model.index_count);
+      std::vector<uint32_t> indices;
+      indices.reserve(model.index_count);
+      for (uint32_t i : faces) {
+          const MapDrawRange& source = source_ranges[i];
+          geometry->face_ranges[i].first_index = indices.size();
+          geometry->face_ranges[i].index_count = source.index_count;
+          for (uint32_t k=0; k < source.index_count; k++) {
+              uint32_t v = source.base_vertex + source_indices[source.first_index + k];
+              WeldVertex vertex = { source_vertices[v], source_normals[v],
+                                    source_lightmap_uvs[v] };
+              indices.push_back(welder.Weld(vertex));
+          }
+      }
+
+      std::vector<WeldVertex> vertices = welder.Vertices();
+      if (optimize) {
+          optimize_model(&indices, &vertices, faces, &geometry->face_ranges, geometry->face_lightmaps);
+      }
+
+      model.first_vertex = geometry->vertices.size();
+      model.vertex_count = vertices.size();
+      for (const WeldVertex& vertex : vertices) {
+          geometry->vertices.push_back(vertex.position);
+          geometry->normals.push_back(vertex.normal);
+          geometry->lightmap_uvs.push_back(vertex.lightmap_uv);
+      }
+
+      model.index_count = indices.size();
+      if (model.vertex_count <= 65536) {
+          model.index_size = sizeof(uint16_t);
+          model.first_index = geometry->indices.size();
+          geometry->indices.insert(geometry->indices.end(), indices.begin(), indices.end());
+      } else {
+          model.index_size = sizeof(uint32_t);
+          model.first_index = geometry->wide_indices.size();
+          geometry->wide_indices.insert(geometry->wide_indices.end(), indices.begin(), indices.end());
+      }
+
+      for (uint32_t i=model.first_face; i < model.first_face + model.face_count; i++) {
+          MapDrawRange& range = geometry->face_ranges[i];
+          range.first_index = (source_ranges[i].index_count != 0) ? range.first_index + model.first_index
+                                                                   : model.first_index;
+          range.base_vertex = model.first_vertex;
+      }
+  }
+}
+
+
+/**
+ * Cuts each model's triangles into meshlets.  The model's faces are walked
+ * in index buffer order and each run of them on one lightmap page gets cut
+ * on its own, so a meshlet can be drawn with its page bound.
+ */
+static void build_meshlets(MapGeometry* geometry) {
+  for (MapModel& model : geometry->models) {
+      std::vector<uint32_t> indices(model.index_count);
+      for (uint32_t i=0; i < model.index_count; i++) {
+          indices[i] = (model.index_size == sizeof(uint16_t)) ? geometry->indices[model.first_index + i]
+                                                             : geometry->wide_indices[model.first_index + i];
+      }
+      const glm::vec3* positions = geometry->vertices.data() + model.first_vertex;
+
+      std::vector<uint32_t> faces;
+      for (uint32_t i=model.first_face; i < model.first_face + model.face_count; i++) {
+          if (geometry->face_ranges[i].index_count != 0) {
+              faces.push_back(i);
+          }
+      }
+      std::stable_sort(faces.begin(), faces.end(), [&](uint32_t a, uint32_t b) {
+          return geometry->face_ranges[a].first_index < geometry->face_ranges[b].first_index;
+      });
+
+      model.first_meshlet = geometry->meshlets.size();
+      for (size_t first=0, last=0; first < faces.size(); first = last) {
+          int32_t page = geometry->face_lightmaps[faces[first]].page;
+          uint32_t run_first = geometry->face_ranges[faces[first]].first_index - model.first_index;
+          uint32_t run_end = run_first;
+          while (last < faces.size() && geometry->face_lightmaps[faces[last]].page == page &&
+                 geometry->face_ranges[faces[last]].first_index - model.first_index == run_end) {
+              run_end += geometry->face_ranges[faces[last]].index_count;
+              last++;
+          }
+
+          const uint32_t* run = indices.data() + run_first;
+          for (const MeshCluster& cluster : BuildMeshlets(run, run_end - run_first)) {
+              MapMeshlet meshlet;
+              meshlet.first_index = model.first_index + run_first + cluster.first_index;
+              meshlet.index_count = cluster.index_count;
+              meshlet.base_vertex = model.first_vertex;
+              meshlet.lightmap_page = page;
+              meshlet.bounds = ComputeMeshletBounds(run + cluster.first_index, cluster.index_count,
+                                                    positions);
+              geometry->meshlets.push_back(meshlet);
+          }
+      }
+      model.meshlet_count = geometry->meshlets.size() - model.first_meshlet;
+  }
+}
+
+
+MapGeometry MapGeometry::FromBSP(BSPParser* parser, ThreadPool* pool, bool optimize) {
+  const LumpView<bsp_vertex_t>& map_vertices = parser->Vertices();
+  const LumpView<bsp_edge_t>& map_edges = parser->Edges();
+  const LumpView<bsp_surfedge_t>& map_surfedges = parser->Surfedges();
+  const LumpView<bsp_face_t>& map_faces = parser->Faces();
+  MapGeometry geometry;
+
+  /* Check every index up front, nothing below does any bounds checking */
+  GeometryReport report = GeometryReport::Validate(parser);
+  if (!report.Certified()) {
+      throw GeometryValidationException(report);
+  }
+
+  /* Lay out the displacements, which checks their lumps too */
+  Displacements displacements = Displacements::FromBSP(parser);
+
+  /* Convert the vertex lump, working out the map's bounds on the way.  Each
+     face gets its own copy of its corners below, since a corner's normal
+     depends on which face it's on */
+  std::vector<glm::vec3> lump_vertices(map_vertices.size());
+  geometry.bounds = ConvertVertices(map_vertices, lump_vertices.data());
+
+  /* Normals come out of the lumps, or get recomputed across the pool */
+  VertexNormals normals = VertexNormals::FromBSP(parser, pool);
+
+  /* Brush entities can't have displacements, so they all belong to one
+     model (the world) and get tessellated right after its last face.  That
+     keeps every model's indices contiguous */
+  const LumpView<bsp_model_t>& map_models = parser->Models();
+  size_t displacement_model = SIZE_MAX;
+  for (const DisplacementSurface& surface : displacements.Surfaces()) {
+      size_t model = 0;
+      while (model < map_models.size() &&
+             (surface.face < (uint32_t)map_models[model].first_face ||
+              surface.face >= (uint32_t)map_models[model].first_face + (uint32_t)map_models[model].num_faces)) {
+          model++;
+      }
+      if (displacement_model != SIZE_MAX && model != displacement_model) {
+          throw DisplacementException("Displacements belong to more than one brush model");
+      }
+      displacement_model = model;
+  }
+  size_t displacement_after = map_faces.size() - 1;  // No model lump, they just go last
+  if (displacement_model < map_models.size()) {
+      bsp_model_t model = map_models[displacement_model];
+      displacement_after = model.first_face + model.num_faces - 1;
+  }
+
+  /* Count each face's corners and fan indices and lay the faces out one
+     after another.  Displacements are left out, their indices get a gap
+     once their model's faces are in */
+  size_t vertex_count = 0;
+  size_t index_count = 0;
+  size_t base_index = 0;
+  geometry.face_ranges.resize(map_faces.size());
+  for (size_t i=0; i < map_faces.size(); i++) {
+      bsp_face_t face = map_faces[i];
+      MapDrawRange& range = geometry.face_ranges[i];
+      range.first_index = index_count;
+      range.index_count = 0;
+      range.base_vertex = vertex_count;
+      if (face.disp_info == DISP_NO_INFO) {
+          range.index_count = (face.num_edges >= 3) ? (face.num_edges - 2) * 3 : 0;
+          vertex_count += face.num_edges;
+          index_count += range.index_count;
+      }
+
+      if (i == displacement_after) {
+          base_index = index_count;
+          index_count += displacements.IndexCount();
+      }
+  }
+
+  /* Every face writes its own slice of the buffers, so they can be built
+     across the pool and come out the same whatever the thread count */
+  size_t base_vertex = vertex_count;
+  geometry.vertices.resize(base_vertex + displacements.VertexCount());
+  geometry.normals.resize(geometry.vertices.size());
+  geometry.indices.resize(index_count);
+  ThreadPool::ParallelFor(pool, map_faces.size(), [&](size_t first, size_t last) {
+      for (size_t i=first; i < last; i++) {
+          bsp_face_t face = map_faces[i];
+          if (face.disp_info != DISP_NO_INFO) {
+              continue;
+          }
+
+          /* Copy out each corner, which sits on the start of its edge */
+          const MapDrawRange& range = geometry.face_ranges[i];
+          const glm::vec3* corner_normals = normals.Normals().data() + normals.FaceCorner(i);
+          glm::vec3* out_vertices = geometry.vertices.data() + range.base_vertex;
+          glm::vec3* out_normals = geometry.normals.data() + range.base_vertex;
+          for (uint32_t k=0; k < face.num_edges; k++) {
+              bsp_surfedge_t surfedge = map_surfedges[face.first_edge + k];
+              bsp_edge_t edge = map_edges[abs(surfedge)];
+              out_vertices[k] = lump_vertices[surfedge >= 0 ? edge.v[0] : edge.v[1]];
+              out_normals[k] = corner_normals[k];
+          }
+
+          /* Faces are convex, so a fan from the first corner covers them.
+             Indices are relative to that corner */
+          uint16_t* out = geometry.indices.data() + range.first_index;
+          for (uint32_t k=1; k + 1 < face.num_edges; k++) {
+              *out++ = 0;
+              *out++ = k;
+              *out++ = k + 1;
+          }
+      }
+  });
+
+  /* Tessellate the displacements onto the end of the vertices and into the
+     gap left in the indices, each surface is its own job on the pool */
+  displacements.Tessellate(geometry.vertices.data() + base_vertex,
+                           geometry.normals.data() + base_vertex,
+                           geometry.indices.data() + base_index, pool);
+  extend_bounds(&geometry.bounds, geometry.vertices.data() + base_vertex,
+                displacements.VertexCount());
+
+  for (const DisplacementSurface& surface : displacements.Surfaces()) {
+      MapDrawRange& range = geometry.face_ranges[surface.face];
+      range.first_index = base_index + surface.first_index;
+      range.index_count = surface.index_count;
+      range.base_vertex = base_vertex + surface.first_vertex;
+  }
+
+  /* Each model spans its faces' indices.  Maps without a model lump get a
+     single model holding everything */
+  if (map_models.empty()) {
+      MapModel world;
+      world.first_face = 0;
+      world.face_count = map_faces.size();
+      world.mins = geometry.bounds.mins;
+      world.maxs = geometry.bounds.maxs;
+      world.origin = glm::vec3(0.0f);
+      geometry.models.push_back(world);
+  }
+  for (bsp_model_t map_model : map_models) {
+      MapModel model;
+      model.first_face = map_model.first_face;
+      model.face_count = map_model.num_faces;
+      model.mins = glm::vec3(map_model.mins[0], map_model.mins[1], map_model.mins[2]);
+      model.maxs = glm::vec3(map_model.maxs[0], map_model.maxs[1], map_model.maxs[2]);
+      model.origin = glm::vec3(map_model.origin[0], map_model.origin[1], map_model.origin[2]);
+      geometry.models.push_back(model);
+  }
+  for (MapModel& model : geometry.models) {
+      size_t first = geometry.indices.size();
+      size_t end = 0;
+      for (size_t i=model.first_face; i < model.first_face + model.face_count; i++) {
+          const MapDrawRange& range = geometry.face_ranges[i];
+          if (range.index_count != 0) {
+              first = std::min(first, (size_t)range.first_index);
+              end = std::max(end, (size_t)range.first_index + range.index_count);
+          }
+      }
+      model.first_index = end != 0 ? first : 0;
+      model.index_count = end != 0 ? end - first : 0;
+  }
+
+  /* Resolve each face's material down to an interned ID */
+  MaterialTable material_table = MaterialTable::FromBSP(parser);
+  geometry.face_materials = material_table.FaceMaterials(map_faces);
+  geometry.materials = material_table.Materials().names;
+
+  /* Pack the lightmaps, decoding them across the pool if there is one */
+  LightmapAtlas atlas = LightmapAtlas::FromBSP(parser, material_table.Texinfo(), pool);
+  geometry.face_lightmaps = atlas.Faces();
+  geometry.lightmap_pages = atlas.Pages();
+  geometry.lightmap_texels = atlas.ReleaseTexels();
+
+  /* Work out each vertex's spot on its face's page, so faces don't need
+     any per face state to draw */
+  geometry.lightmap_uvs.assign(geometry.vertices.size(), glm::vec2(0.0f));
+  ThreadPool::ParallelFor(pool, geometry.face_ranges.size(), [&](size_t first, size_t last) {
+      for (size_t i=first; i < last; i++) {
+          const FaceLightmap& lightmap = geometry.face_lightmaps[i];
+          const MapDrawRange& range = geometry.face_ranges[i];
+          if (lightmap.page == LIGHTMAP_NO_PAGE) {
+              continue;
+          }
+          for (uint32_t k=0; k < range.index_count; k++) {
+              uint32_t v = range.base_vertex + geometry.indices[range.first_index + k];
+              glm::vec3 p = geometry.vertices[v];
+              geometry.lightmap_uvs[v] = glm::vec2(
+                  lightmap.uv_s.x * p.x + lightmap.uv_s.y * p.y + lightmap.uv_s.z * p.z + lightmap.uv_s.w,
+                  lightmap.uv_t.x * p.x + lightmap.uv_t.y * p.y + lightmap.uv_t.z * p.z + lightmap.uv_t.w);
+          }
+      }
+  });
+
+  /* With every attribute in place, faces that agree on a corner can share
+     it, and then everything gets ordered for the GPU */
+  weld_models(&geometry, optimize);
+  build_meshlets(&geometry);
+
+  return geometry;
+}
+
+VertexCacheStats MapGeometry::AnalyzeVertexCache() const {
+  VertexCacheStats stats = {};
+
+  for (const MapModel& model : models) {
+      std::vector<uint32_t> model_indices(model.index_count);
+      for (uint32_t i=0; i < model.index_count; i++) {
+          model_indices[i] = (model.index_size == sizeof(uint16_t)) ? indices[model.first_index + i]
+                                                                   : wide_indices[model.first_index + i];
+      }
+      stats = CombineVertexCacheStats(stats, ::AnalyzeVertexCache(model_indices.data(), model_indices.size(),
+                                                                  model.vertex_count));
+  }
+  return stats;
+}
@@ -0,0 +1,89 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Read-only memory mapping of a file on disk.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mapped_file.h"
+
+
+MappedFile::MappedFile(const std::string& path) {
+    struct stat st;
+    int fd;
+
+    data = nullptr;
+    size = 0;
+
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw MappedFileException("Failed to open " + path);
+    }
+
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        throw MappedFileException("Failed to stat " + path);
+    }
+    size = st.st_size;
+
+    /* mmap refuses zero length mappings, an empty file just has no data */
+    if (size == 0) {
+        close(fd);
+        return;
+    }
+
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // The mapping holds its own reference to the file
+    if (mapping == MAP_FAILED) {
+        throw MappedFileException("Failed to map " + path);
+    }
+    data = (uint8_t*)mapping;
+}
+
+MappedFile::~MappedFile() {
+    if (data != nullptr) {
+        munmap(data, size);
+    }
+}
+
+const uint8_t* MappedFile::Data() const {
+    return data;
+}
+
+size_t MappedFile::Size() const {
+    return size;
+}
+
+/**
+ * Hint to the kernel that a range is about to be read so it can start pulling
+ * it in now, instead of faulting it in a page at a time later.
+ */
+void MappedFile::Prefetch(size_t offset, size_t length) const {
+    if (data == nullptr || length == 0 || offset >= size) {
+        return;
+    }
+
+    /* madvise wants a page aligned start address */
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t start = offset - (offset % page_size);
+    madvise(data + start, length + (offset - start), MADV_WILLNEED);
+}
@@ -0,0 +1,150 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Table of the materials a map's faces use.
+ *
+ * Faces point at a texinfo, which points at a texdata, which points at a
+ * string table entry, which is an offset to the material's name.  All of
+ * that gets resolved once here so nothing else has to chase it.
+ */
+
+#include <string.h>
+#include "material_table.h"
+#include "pak_file.h"
+#include "bsp_parser.h"
+
+
+/**
+ * Reads a texdata's name out of the string lumps.
+ */
+static std::string texdata_name(const bsp_texdata_t& texdata,
+                                const LumpView<bsp_string_table_t>& string_table,
+                                const LumpView<uint8_t>& string_data) {
+    if (texdata.name_string_table_id < 0 || (size_t)texdata.name_string_table_id >= string_table.size()) {
+        throw MaterialTableException("Texdata names a string that isn't in the string table.");
+    }
+
+    int32_t offset = string_table[texdata.name_string_table_id];
+    if (offset < 0 || (size_t)offset >= string_data.size()) {
+        throw MaterialTableException("Texdata string table points outside the string data.");
+    }
+
+    const char* name = (const char*)string_data.Bytes() + offset;
+    const char* end = (const char*)memchr(name, '\0', string_data.size() - offset);
+    if (end == nullptr) {
+        throw MaterialTableException("Material name runs off the end of the string data.");
+    }
+
+    return std::string(name, end);
+}
+
+static glm::vec4 texture_vec(const float (&vecs)[2][4], int axis) {
+    return glm::vec4(vecs[axis][0], vecs[axis][1], vecs[axis][2], vecs[axis][3]);
+}
+
+
+MaterialTable::MaterialTable(const LumpView<bsp_texinfo_t>& texinfo,
+                             const LumpView<bsp_texdata_t>& texdata,
+                             const LumpView<bsp_string_table_t>& string_table,
+                             const LumpView<uint8_t>& string_data) {
+    std::vector<uint32_t> texdata_material(texdata.size());
+
+    /* Intern every texdata's name, texdata that share a name share an ID */
+    for (size_t i=0; i < texdata.size(); i++) {
+        bsp_texdata_t data = texdata[i];
+        std::string name = PakFile::NormalizePath(texdata_name(data, string_table, string_data));
+
+        auto found = index.find(name);
+        if (found != index.end()) {
+            texdata_material[i] = found->second;
+            continue;
+        }
+
+        uint32_t id = materials.names.size();
+        index.emplace(name, id);
+        materials.names.push_back(std::move(name));
+        materials.width.push_back(data.width);
+        materials.height.push_back(data.height);
+        materials.reflectivity.push_back(glm::vec3(data.reflectivity[0], data.reflectivity[1],
+                                                   data.reflectivity[2]));
+        texdata_material[i] = id;
+    }
+
+    /* Split the texinfo out into one array per field */
+    this->texinfo.texture_s.resize(texinfo.size());
+    this->texinfo.texture_t.resize(texinfo.size());
+    this->texinfo.lightmap_s.resize(texinfo.size());
+    this->texinfo.lightmap_t.resize(texinfo.size());
+    this->texinfo.flags.resize(texinfo.size());
+    this->texinfo.material.resize(texinfo.size());
+    for (size_t i=0; i < texinfo.size(); i++) {
+        bsp_texinfo_t info = texinfo[i];
+
+        if (info.texdata >= 0 && (size_t)info.texdata >= texdata.size()) {
+            throw MaterialTableException("Texinfo " + std::to_string(i) + " uses texdata that doesn't exist.");
+        }
+
+        this->texinfo.texture_s[i] = texture_vec(info.texture_vecs, 0);
+        this->texinfo.texture_t[i] = texture_vec(info.texture_vecs, 1);
+        this->texinfo.lightmap_s[i] = texture_vec(info.lightmap_vecs, 0);
+        this->texinfo.lightmap_t[i] = texture_vec(info.lightmap_vecs, 1);
+        this->texinfo.flags[i] = info.flags;
+        this->texinfo.material[i] = info.texdata < 0 ? MATERIAL_NONE : texdata_material[info.texdata];
+    }
+}
+
+MaterialTable MaterialTable::FromBSP(BSPParser* parser) {
+    return MaterialTable(parser->TexInfo(), parser->TexData(), parser->TexDataStringTable(),
+                         parser->TexDataStringData());
+}
+
+size_t MaterialTable::Count() const {
+    return materials.names.size();
+}
+
+uint32_t MaterialTable::Find(const std::string& name) const {
+    auto found = index.find(PakFile::NormalizePath(name));
+    return found == index.end() ? MATERIAL_NONE : found->second;
+}
+
+uint32_t MaterialTable::TexinfoMaterial(size_t texinfo) const {
+    return texinfo < this->texinfo.material.size() ? this->texinfo.material[texinfo] : MATERIAL_NONE;
+}
+
+/**
+ * Material ID for every face.  Faces with no texinfo (tex_info is -1 in the
+ * file) get MATERIAL_NONE.
+ */
+std::vector<uint32_t> MaterialTable::FaceMaterials(const LumpView<bsp_face_t>& faces) const {
+    std::vector<uint32_t> face_materials(faces.size());
+
+    for (size_t i=0; i < faces.size(); i++) {
+        face_materials[i] = TexinfoMaterial(faces[i].tex_info);
+    }
+
+    return face_materials;
+}
+
+const TexinfoArrays& MaterialTable::Texinfo() const {
+    return texinfo;
+}
+
+const MaterialArrays& MaterialTable::Materials() const {
+    return materials;
+}
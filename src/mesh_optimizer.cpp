@@ -0,0 +1,433 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Reorders triangle lists and vertices for the GPU.
+ *
+ * The vertex cache pass follows Tom Forsyth's "Linear-Speed Vertex Cache
+ * Optimisation".  Only the triangles of vertices in the simulated cache get
+ * rescored after each pick, and when none of them are left the next
+ * triangle in input order is taken, so the whole pass is linear.
+ *
+ * Meshlets are cut greedily in index order, which after the passes above
+ * keeps each one spatially tight.  Their normal cones are centred on the
+ * average normal, and meshlets whose normals spread too far to ever be
+ * entirely backfacing get a cutoff that never culls.
+ */
+
+#include <math.h>
+#include <algorithm>
+#include "mesh_optimizer.h"
+
+#define FORSYTH_CACHE_SIZE 32  // LRU cache the scoring models, bigger than any real one
+#define FORSYTH_VALENCE_TABLE 64  // Valence scores worked out up front
+#define FORSYTH_NO_TRIANGLE UINT32_MAX
+#define MESHLET_MIN_CONE_DOT 0.1f  // Cones wider than this (cos of the half angle) can't cull
+
+
+/**
+ * Forsyth's vertex score.  Vertices used by the last triangle get a fixed
+ * score, so the same triangle's neighbours don't get an advantage, the rest
+ * of the cache falls off with age.  Vertices with few triangles left get
+ * boosted so they get finished off and stop hogging the cache.
+ */
+static float forsyth_score(int position, uint32_t live) {
+    if (live == 0) {
+        return 0.0f;
+    }
+
+    float score = 0.0f;
+    if (position >= 0) {
+        if (position < 3) {
+            score = 0.75f;
+        } else {
+            float scale = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+            score = powf(1.0f - (position - 3) * scale, 1.5f);
+        }
+    }
+    return score + 2.0f / sqrtf((float)live);
+}
+
+/**
+ * Concatenates clusters' indices in the given order.
+ */
+static std::vector<uint32_t> gather_clusters(const uint32_t* indices,
+                                             const std::vector<MeshCluster>& clusters,
+                                             const std::vector<uint32_t>& order) {
+    std::vector<uint32_t> out;
+    for (uint32_t cluster : order) {
+        const uint32_t* first = indices + clusters[cluster].first_index;
+        out.insert(out.end(), first, first + clusters[cluster].index_count);
+    }
+    return out;
+}
+
+
+VertexCacheStats AnalyzeVertexCache(const uint32_t* indices, size_t index_count,
+                                    size_t vertex_count, size_t cache_size) {
+    VertexCacheStats stats = {};
+    std::vector<size_t> inserted(vertex_count, 0);  // When each vertex last went into the cache
+    size_t time = cache_size + 1;
+
+    stats.triangles = index_count / 3;
+    for (size_t i=0; i < stats.triangles * 3; i++) {
+        uint32_t v = indices[i];
+        if (inserted[v] == 0) {
+            stats.vertices++;
+        }
+        if (time - inserted[v] > cache_size) {
+            inserted[v] = time++;
+            stats.transformed++;
+        }
+    }
+
+    stats.acmr = stats.triangles ? (double)stats.transformed / stats.triangles : 0.0;
+    stats.atvr = stats.vertices ? (double)stats.transformed / stats.vertices : 0.0;
+    return stats;
+}
+
+VertexCacheStats CombineVertexCacheStats(const VertexCacheStats& a, const VertexCacheStats& b) {
+    VertexCacheStats stats;
+    stats.triangles = a.triangles + b.triangles;
+    stats.vertices = a.vertices + b.vertices;
+    stats.transformed = a.transformed + b.transformed;
+    stats.acmr = stats.triangles ? (double)stats.transformed / stats.triangles : 0.0;
+    stats.atvr = stats.vertices ? (double)stats.transformed / stats.vertices : 0.0;
+    return stats;
+}
+
+std::vector<uint32_t> VertexCacheOrder(const uint32_t* indices, size_t index_count,
+                                       size_t vertex_count) {
+    size_t triangle_count = index_count / 3;
+    std::vector<uint32_t> order;
+    order.reserve(triangle_count);
+
+    float position_scores[FORSYTH_CACHE_SIZE];
+    float valence_scores[FORSYTH_VALENCE_TABLE];
+    for (int i=0; i < FORSYTH_CACHE_SIZE; i++) {
+        position_scores[i] = forsyth_score(i, 1) - forsyth_score(-1, 1);
+    }
+    for (uint32_t i=0; i < FORSYTH_VALENCE_TABLE; i++) {
+        valence_scores[i] = forsyth_score(-1, i);
+    }
+    auto vertex_score = [&](int position, uint32_t live) {
+        if (live == 0) {
+            return 0.0f;
+        }
+        float score = (live < FORSYTH_VALENCE_TABLE) ? valence_scores[live] : forsyth_score(-1, live);
+        return (position >= 0) ? score + position_scores[position] : score;
+    };
+
+    /* Each vertex's live triangles, removed as they're drawn */
+    std::vector<uint32_t> live(vertex_count, 0);
+    for (size_t i=0; i < triangle_count * 3; i++) {
+        live[indices[i]]++;
+    }
+    std::vector<uint32_t> first_triangle(vertex_count + 1, 0);
+    for (size_t v=0; v < vertex_count; v++) {
+        first_triangle[v + 1] = first_triangle[v] + live[v];
+    }
+    std::vector<uint32_t> triangles(triangle_count * 3);
+    std::vector<uint32_t> filled(first_triangle.begin(), first_triangle.end() - 1);
+    for (size_t i=0; i < triangle_count * 3; i++) {
+        triangles[filled[indices[i]]++] = i / 3;
+    }
+
+    std::vector<int> position(vertex_count, -1);
+    std::vector<float> scores(vertex_count);
+    for (size_t v=0; v < vertex_count; v++) {
+        scores[v] = vertex_score(-1, live[v]);
+    }
+    std::vector<float> triangle_scores(triangle_count);
+    std::vector<bool> drawn(triangle_count, false);
+    uint32_t best = FORSYTH_NO_TRIANGLE;
+    for (size_t t=0; t < triangle_count; t++) {
+        const uint32_t* corner = indices + t * 3;
+        triangle_scores[t] = scores[corner[0]] + scores[corner[1]] + scores[corner[2]];
+        if (best == FORSYTH_NO_TRIANGLE || triangle_scores[t] > triangle_scores[best]) {
+            best = t;
+        }
+    }
+
+    uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+    size_t cache_count = 0;
+    size_t next_unused = 0;
+    while (order.size() < triangle_count) {
+        /* Dead end, nothing in the cache has triangles left */
+        if (best == FORSYTH_NO_TRIANGLE) {
+            while (drawn[next_unused]) {
+                next_unused++;
+            }
+            best = next_unused;
+        }
+
+        order.push_back(best);
+        drawn[best] = true;
+        const uint32_t* corner = indices + best * 3;
+        for (int k=0; k < 3; k++) {
+            uint32_t* first = triangles.data() + first_triangle[corner[k]];
+            uint32_t* found = std::find(first, first + live[corner[k]], best);
+            *found = first[--live[corner[k]]];
+        }
+
+        /* The triangle's vertices go to the front, pushing the rest back */
+        uint32_t next_cache[FORSYTH_CACHE_SIZE + 3];
+        size_t next_count = 0;
+        for (int k=0; k < 3; k++) {
+            if (std::find(next_cache, next_cache + next_count, corner[k]) == next_cache + next_count) {
+                next_cache[next_count++] = corner[k];
+            }
+        }
+        for (size_t i=0; i < cache_count; i++) {
+            if (cache[i] != corner[0] && cache[i] != corner[1] && cache[i] != corner[2]) {
+                next_cache[next_count++] = cache[i];
+            }
+        }
+
+        /* Rescore everything that moved, then their triangles */
+        for (size_t i=0; i < next_count; i++) {
+            uint32_t v = next_cache[i];
+            position[v] = (i < FORSYTH_CACHE_SIZE) ? (int)i : -1;
+            scores[v] = vertex_score(position[v], live[v]);
+        }
+        best = FORSYTH_NO_TRIANGLE;
+        for (size_t i=0; i < std::min<size_t>(next_count, FORSYTH_CACHE_SIZE); i++) {
+            uint32_t v = next_cache[i];
+            for (uint32_t j=first_triangle[v]; j < first_triangle[v] + live[v]; j++) {
+                uint32_t t = triangles[j];
+                const uint32_t* c = indices + t * 3;
+                triangle_scores[t] = scores[c[0]] + scores[c[1]] + scores[c[2]];
+                if (best == FORSYTH_NO_TRIANGLE || triangle_scores[t] > triangle_scores[best]) {
+                    best = t;
+                }
+            }
+        }
+
+        cache_count = std::min<size_t>(next_count, FORSYTH_CACHE_SIZE);
+        std::copy(next_cache, next_cache + cache_count, cache);
+    }
+
+    return order;
+}
+
+std::vector<uint32_t> OverdrawOrder(const uint32_t* indices, const std::vector<MeshCluster>& clusters,
+                                    const glm::vec3* positions, size_t vertex_count,
+                                    float threshold) {
+    std::vector<uint32_t> order(clusters.size());
+    for (size_t i=0; i < clusters.size(); i++) {
+        order[i] = i;
+    }
+    if (clusters.size() <= 1) {
+        return order;
+    }
+
+    /* Start a new group wherever a cluster starts with all three of its
+       first triangle's vertices missing the cache.  Reordering at those
+       points costs next to nothing */
+    std::vector<size_t> inserted(vertex_count, 0);
+    std::vector<bool> used(vertex_count, false);
+    std::vector<size_t> group_starts;
+    size_t time = MESH_CACHE_SIZE + 1;
+    for (size_t i=0; i < clusters.size(); i++) {
+        const uint32_t* first = indices + clusters[i].first_index;
+        int misses = 0;
+        for (uint32_t k=0; k < clusters[i].index_count; k++) {
+            uint32_t v = first[k];
+            used[v] = true;
+            if (time - inserted[v] > MESH_CACHE_SIZE) {
+                inserted[v] = time++;
+                misses += (k < 3);
+            }
+        }
+        if (i == 0 || misses == 3) {
+            group_starts.push_back(i);
+        }
+    }
+    group_starts.push_back(clusters.size());
+
+    glm::vec3 mesh_centre(0.0f);
+    size_t used_count = 0;
+    for (size_t v=0; v < vertex_count; v++) {
+        if (used[v]) {
+            mesh_centre += positions[v];
+            used_count++;
+        }
+    }
+    mesh_centre /= (float)std::max<size_t>(used_count, 1);
+
+    /* Groups facing out from the middle go first, they're the ones most
+       likely to hide the rest */
+    struct Group {
+        size_t first;
+        size_t last;
+        float key;
+    };
+    std::vector<Group> groups;
+    for (size_t g=0; g + 1 < group_starts.size(); g++) {
+        glm::vec3 centre(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+        for (size_t i=group_starts[g]; i < group_starts[g + 1]; i++) {
+            const uint32_t* first = indices + clusters[i].first_index;
+            for (uint32_t k=0; k + 2 < clusters[i].index_count; k += 3) {
+                glm::vec3 a = positions[first[k]];
+                glm::vec3 b = positions[first[k + 1]];
+                glm::vec3 c = positions[first[k + 2]];
+                glm::vec3 cross = -glm::cross(b - a, c - a);
+                float triangle_area = glm::length(cross);
+                centre += (a + b + c) * (triangle_area / 3.0f);
+                normal += cross;
+                area += triangle_area;
+            }
+        }
+
+        float length = glm::length(normal);
+        float key = 0.0f;
+        if (area > 0.0f && length > 0.0f) {
+            key = glm::dot(centre / area - mesh_centre, normal / length);
+        }
+        groups.push_back({ group_starts[g], group_starts[g + 1], key });
+    }
+    std::stable_sort(groups.begin(), groups.end(), [](const Group& a, const Group& b) {
+        return a.key > b.key;
+    });
+
+    std::vector<uint32_t> sorted;
+    for (const Group& group : groups) {
+        for (size_t i=group.first; i < group.last; i++) {
+            sorted.push_back(i);
+        }
+    }
+
+    /* Only worth it if the cache doesn't suffer much */
+    std::vector<uint32_t> before = gather_clusters(indices, clusters, order);
+    std::vector<uint32_t> after = gather_clusters(indices, clusters, sorted);
+    double acmr_before = AnalyzeVertexCache(before.data(), before.size(), vertex_count).acmr;
+    double acmr_after = AnalyzeVertexCache(after.data(), after.size(), vertex_count).acmr;
+    return (acmr_after <= acmr_before * threshold) ? sorted : order;
+}
+
+size_t VertexFetchRemap(uint32_t* remap, const uint32_t* indices, size_t index_count,
+                        size_t vertex_count) {
+    std::fill(remap, remap + vertex_count, UINT32_MAX);
+
+    uint32_t next = 0;
+    for (size_t i=0; i < index_count; i++) {
+        if (remap[indices[i]] == UINT32_MAX) {
+            remap[indices[i]] = next++;
+        }
+    }
+
+    size_t used = next;
+    for (size_t v=0; v < vertex_count; v++) {
+        if (remap[v] == UINT32_MAX) {
+            remap[v] = next++;
+        }
+    }
+    return used;
+}
+
+std::vector<MeshCluster> BuildMeshlets(const uint32_t* indices, size_t index_count,
+                                       size_t max_vertices, size_t max_triangles) {
+    std::vector<MeshCluster> meshlets;
+    std::vector<uint32_t> vertices;  // The current meshlet's, it's small enough to search
+    MeshCluster current = { 0, 0 };
+
+    for (size_t t=0; t < index_count / 3; t++) {
+        const uint32_t* corner = indices + t * 3;
+        size_t added = 0;
+        for (int k=0; k < 3; k++) {
+            bool seen = std::find(vertices.begin(), vertices.end(), corner[k]) != vertices.end() ||
+                        (k > 0 && corner[k] == corner[0]) || (k > 1 && corner[k] == corner[1]);
+            added += !seen;
+        }
+
+        if (current.index_count / 3 + 1 > max_triangles || vertices.size() + added > max_vertices) {
+            meshlets.push_back(current);
+            current = { (uint32_t)(t * 3), 0 };
+            vertices.clear();
+        }
+
+        for (int k=0; k < 3; k++) {
+            if (std::find(vertices.begin(), vertices.end(), corner[k]) == vertices.end()) {
+                vertices.push_back(corner[k]);
+            }
+        }
+        current.index_count += 3;
+    }
+
+    if (current.index_count != 0) {
+        meshlets.push_back(current);
+    }
+    return meshlets;
+}
+
+MeshletBounds ComputeMeshletBounds(const uint32_t* indices, size_t index_count,
+                                   const glm::vec3* positions) {
+    MeshletBounds bounds;
+    bounds.mins = bounds.maxs = positions[indices[0]];
+    for (size_t i=1; i < index_count; i++) {
+        glm::vec3 v = positions[indices[i]];
+        bounds.mins = glm::vec3(std::min(bounds.mins.x, v.x), std::min(bounds.mins.y, v.y),
+                                std::min(bounds.mins.z, v.z));
+        bounds.maxs = glm::vec3(std::max(bounds.maxs.x, v.x), std::max(bounds.maxs.y, v.y),
+                                std::max(bounds.maxs.z, v.z));
+    }
+
+    bounds.centre = (bounds.mins + bounds.maxs) * 0.5f;
+    bounds.radius = 0.0f;
+    for (size_t i=0; i < index_count; i++) {
+        bounds.radius = std::max(bounds.radius, glm::length(positions[indices[i]] - bounds.centre));
+    }
+
+    /* Front faces wind clockwise, so their normals are against the cross
+       product.  Degenerate triangles can't be seen and don't count */
+    std::vector<glm::vec3> normals;
+    glm::vec3 sum(0.0f);
+    for (size_t i=0; i + 2 < index_count; i += 3) {
+        glm::vec3 a = positions[indices[i]];
+        glm::vec3 cross = -glm::cross(positions[indices[i + 1]] - a, positions[indices[i + 2]] - a);
+        float length = glm::length(cross);
+        if (length > 0.0f) {
+            normals.push_back(cross / length);
+            sum += normals.back();
+        }
+    }
+
+    bounds.cone_axis = glm::vec3(0.0f, 0.0f, 1.0f);
+    bounds.cone_cutoff = 1.0f;
+    float sum_length = glm::length(sum);
+    if (sum_length > 0.0f) {
+        bounds.cone_axis = sum / sum_length;
+        float min_dot = 1.0f;
+        for (const glm::vec3& normal : normals) {
+            min_dot = std::min(min_dot, glm::dot(normal, bounds.cone_axis));
+        }
+        if (min_dot > MESHLET_MIN_CONE_DOT) {
+            bounds.cone_cutoff = sqrtf(1.0f - min_dot * min_dot);
+        }
+    }
+
+    return bounds;
+}
+
+bool MeshletBackfacing(const MeshletBounds& bounds, const glm::vec3& camera_pos) {
+    glm::vec3 to_centre = bounds.centre - camera_pos;
+    return glm::dot(to_centre, bounds.cone_axis) >=
+           bounds.cone_cutoff * glm::length(to_centre) + bounds.radius;
+}
@@ -0,0 +1,187 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Reader for the zip file embedded in a map's pakfile lump.
+ *
+ * NOTE: Zip format reference: https://pkware.cachefly.net/webdocs/casestudies/APPNOTE.TXT
+ */
+
+#include <ctype.h>
+#include <string.h>
+#include "pak_file.h"
+
+#define ZIP_END_OF_DIR_SIG 0x06054b50
+#define ZIP_DIR_ENTRY_SIG 0x02014b50
+#define ZIP_LOCAL_HEADER_SIG 0x04034b50
+#define ZIP_END_OF_DIR_SIZE 22
+#define ZIP_DIR_ENTRY_SIZE 46
+#define ZIP_LOCAL_HEADER_SIZE 30
+#define ZIP_MAX_COMMENT 0xFFFF
+
+
+PakFile::PakFile(const LumpView<uint8_t>& data) {
+    this->data = data;
+
+    /* An empty lump just means the map doesn't pack anything */
+    if (data.empty()) {
+        return;
+    }
+
+    /* The end of directory record tells us where the central directory is */
+    size_t end_of_dir = findEndOfDirectory();
+    uint16_t entry_count = read16(end_of_dir + 10);
+    uint32_t dir_size = read32(end_of_dir + 12);
+    uint32_t dir_offset = read32(end_of_dir + 16);
+    if ((uint64_t)dir_offset + dir_size > end_of_dir) {
+        throw PakFileException("Pakfile central directory is out of bounds.");
+    }
+
+    /* Walk the central directory and index every entry */
+    entries.reserve(entry_count);
+    index.reserve(entry_count);
+    size_t pos = dir_offset;
+    for (uint16_t i=0; i < entry_count; i++) {
+        PakEntry entry;
+
+        if (read32(pos) != ZIP_DIR_ENTRY_SIG) {
+            throw PakFileException("Bad pakfile central directory entry.");
+        }
+        entry.method = read16(pos + 10);
+        entry.crc32 = read32(pos + 16);
+        entry.compressed_size = read32(pos + 20);
+        entry.size = read32(pos + 24);
+        uint16_t name_len = read16(pos + 28);
+        uint16_t extra_len = read16(pos + 30);
+        uint16_t comment_len = read16(pos + 32);
+        entry.header_offset = read32(pos + 42);
+
+        if (pos + ZIP_DIR_ENTRY_SIZE + name_len > data.size()) {
+            throw PakFileException("Pakfile entry name is out of bounds.");
+        }
+        entry.name.assign((const char*)data.Bytes() + pos + ZIP_DIR_ENTRY_SIZE, name_len);
+
+        index[NormalizePath(entry.name)] = entries.size();
+        entries.push_back(std::move(entry));
+
+        pos += ZIP_DIR_ENTRY_SIZE + name_len + extra_len + comment_len;
+    }
+}
+
+size_t PakFile::Count() const {
+    return entries.size();
+}
+
+const std::vector<PakEntry>& PakFile::Entries() const {
+    return entries;
+}
+
+const PakEntry* PakFile::Find(const std::string& path) const {
+    auto it = index.find(NormalizePath(path));
+    if (it == index.end()) {
+        return nullptr;
+    }
+    return &entries[it->second];
+}
+
+LumpView<uint8_t> PakFile::Open(const std::string& path) const {
+    const PakEntry* entry = Find(path);
+    if (entry == nullptr) {
+        throw PakFileException("File isn't in the pakfile: " + path);
+    }
+    return Open(*entry);
+}
+
+LumpView<uint8_t> PakFile::Open(const PakEntry& entry) const {
+    if (entry.method != ZIP_METHOD_STORED) {
+        throw PakFileException("Pakfile entry is compressed: " + entry.name);
+    }
+
+    /* The local header's extra field can differ from the central directory's,
+       so it has to be read to find where the data starts */
+    if (read32(entry.header_offset) != ZIP_LOCAL_HEADER_SIG) {
+        throw PakFileException("Bad pakfile local header: " + entry.name);
+    }
+    uint16_t name_len = read16(entry.header_offset + 26);
+    uint16_t extra_len = read16(entry.header_offset + 28);
+
+    size_t start = (size_t)entry.header_offset + ZIP_LOCAL_HEADER_SIZE + name_len + extra_len;
+    if (start + entry.size > data.size()) {
+        throw PakFileException("Pakfile entry data is out of bounds: " + entry.name);
+    }
+
+    return LumpView<uint8_t>(data.Bytes() + start, entry.size);
+}
+
+/**
+ * Lowercases a path and turns backslashes into forward slashes, which is the
+ * form paths are indexed by.
+ */
+std::string PakFile::NormalizePath(const std::string& path) {
+    std::string out = path;
+
+    for (char& c : out) {
+        if (c == '\\') {
+            c = '/';
+        } else {
+            c = tolower((unsigned char)c);
+        }
+    }
+
+    return out;
+}
+
+uint16_t PakFile::read16(size_t offset) const {
+    uint16_t value;
+
+    if (offset + sizeof(value) > data.size()) {
+        throw PakFileException("Pakfile read out of bounds.");
+    }
+    memcpy(&value, data.Bytes() + offset, sizeof(value));
+    return value;
+}
+
+uint32_t PakFile::read32(size_t offset) const {
+    uint32_t value;
+
+    if (offset + sizeof(value) > data.size()) {
+        throw PakFileException("Pakfile read out of bounds.");
+    }
+    memcpy(&value, data.Bytes() + offset, sizeof(value));
+    return value;
+}
+
+/**
+ * Scans backwards for the end of central directory record.  It's normally
+ * the last 22 bytes, unless the zip has a comment on the end.
+ */
+size_t PakFile::findEndOfDirectory() const {
+    if (data.size() < ZIP_END_OF_DIR_SIZE) {
+        throw PakFileException("Pakfile is too small to be a zip.");
+    }
+
+    size_t last = data.size() - ZIP_END_OF_DIR_SIZE;
+    size_t first = (last > ZIP_MAX_COMMENT) ? last - ZIP_MAX_COMMENT : 0;
+    for (size_t pos = last + 1; pos-- > first;) {
+        if (read32(pos) == ZIP_END_OF_DIR_SIG) {
+            return pos;
+        }
+    }
+
+    throw PakFileException("Couldn't find the pakfile's central directory.");
+}
@@ -0,0 +1,435 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief On disk cache of built map geometry.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <filesystem>
+#include "render_cache.h"
+
+
+/**
+ * 64 bit hash of a block of memory.  Runs four independent lanes over 32 byte
+ * blocks so hashing a big map isn't bound by a single multiply chain.
+ */
+static uint64_t hash_bytes(const uint8_t* data, size_t data_len) {
+    const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+    uint64_t lanes[4] = { prime1 + prime2, prime2, 0, 0 - prime1 };
+    uint64_t word;
+    size_t pos = 0;
+
+    auto mix = [&](uint64_t acc, uint64_t value) {
+        acc += value * prime2;
+        acc = (acc << 31) | (acc >> 33);
+        return acc * prime1;
+    };
+
+    for (; pos + 32 <= data_len; pos += 32) {
+        for (int i=0; i < 4; i++) {
+            memcpy(&word, data + pos + i * 8, sizeof(word));
+            lanes[i] = mix(lanes[i], word);
+        }
+    }
+
+    uint64_t hash = data_len;
+    for (int i=0; i < 4; i++) {
+        hash = mix(hash, lanes[i]);
+    }
+
+    /* Leftover bytes */
+    for (; pos + 8 <= data_len; pos += 8) {
+        memcpy(&word, data + pos, sizeof(word));
+        hash = mix(hash, word);
+    }
+    for (; pos < data_len; pos++) {
+        hash = mix(hash, data[pos]);
+    }
+
+    /* Final avalanche */
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    return hash;
+}
+
+/**
+ * Whether every index is below vertex_count.  Finds the largest one first so
+ * the loop has no branches to get in the way of vectorizing it.
+ */
+template <typename T>
+static bool indices_fit(const T* indices, size_t count, uint32_t vertex_count) {
+    uint32_t largest = 0;
+    for (size_t i=0; i < count; i++) {
+        largest = std::max<uint32_t>(largest, indices[i]);
+    }
+    return count == 0 || largest < vertex_count;
+}
+
+/* Whether a slice of a model's indices stays inside the model and draws off
+   its vertices */
+static bool range_fits(const MapModel& model, uint32_t first_index, uint32_t index_count,
+                       uint32_t base_vertex) {
+    return first_index >= model.first_index &&
+           first_index - model.first_index <= model.index_count &&
+           index_count <= model.index_count - (first_index - model.first_index) &&
+           base_vertex == model.first_vertex;
+}
+
+/**
+ * Rounds an offset up to the section alignment.
+ */
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + RENDER_CACHE_ALIGNMENT - 1) & ~(uint64_t)(RENDER_CACHE_ALIGNMENT - 1);
+}
+
+
+RenderCache::RenderCache(const std::string& path) try : file(path) {
+    if (file.Size() < sizeof(header)) {
+        throw RenderCacheException("Render cache is too small to hold a header.");
+    }
+    memcpy(&header, file.Data(), sizeof(header));
+
+    if (header.file_identifier != RENDER_CACHE_IDENTIFIER) {
+        throw RenderCacheException("Bad render cache identifier.");
+    }
+    if (header.version != RENDER_CACHE_VERSION) {
+        throw RenderCacheException("Render cache was written by a different version.");
+    }
+
+    /* Make sure every section is inside the file and aligned */
+    for (int i=0; i < RENDER_CACHE_TOTAL_SECTIONS; i++) {
+        const render_cache_section_t& section = header.sections[i];
+        if (section.file_offset > file.Size() || section.size > file.Size() - section.file_offset) {
+            throw RenderCacheException("Render cache section doesn't fit in the file.");
+        }
+        if (section.file_offset % RENDER_CACHE_ALIGNMENT != 0) {
+            throw RenderCacheException("Render cache section isn't aligned.");
+        }
+    }
+} catch (MappedFileException& e) {
+    throw RenderCacheException(e.what());
+}
+
+RenderCacheKey RenderCache::KeyForFile(const std::string& bsp_path) {
+    RenderCacheKey key;
+
+    try {
+        MappedFile bsp(bsp_path);
+        key.hash = hash_bytes(bsp.Data(), bsp.Size());
+        key.size = bsp.Size();
+    } catch (MappedFileException& e) {
+        throw RenderCacheException(e.what());
+    }
+
+    return key;
+}
+
+/**
+ * Where the cache for a map lives, under $XDG_CACHE_HOME/semr (or
+ * ~/.cache/semr).  The directory is created if it doesn't exist yet.
+ */
+std::string RenderCache::PathForKey(const RenderCacheKey& key) {
+    std::string dir;
+    char name[64];
+
+    if (getenv("XDG_CACHE_HOME") != nullptr) {
+        dir = std::string(getenv("XDG_CACHE_HOME")) + "/semr";
+    } else if (getenv("HOME") != nullptr) {
+        dir = std::string(getenv("HOME")) + "/.cache/semr";
+    } else {
+        dir = ".";
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+
+    snprintf(name, sizeof(name), "/%016llx.semrcache", (unsigned long long)key.hash);
+    return dir + name;
+}
+
+void RenderCache::Write(const std::string& path, const RenderCacheKey& key,
+                        const MapGeometry& geometry) {
+    render_cache_header_t out_header;
+    std::string names;
+
+    memset(&out_header, 0, sizeof(out_header));
+    out_header.file_identifier = RENDER_CACHE_IDENTIFIER;
+    out_header.version = RENDER_CACHE_VERSION;
+    out_header.source_hash = key.hash;
+    out_header.source_size = key.size;
+
+    /* Material names get packed back to back */
+    for (const std::string& material : geometry.materials) {
+        names += material;
+        names += '\0';
+    }
+
+    struct {
+        const void* data;
+        uint64_t size;
+        uint64_t count;
+    } sections[RENDER_CACHE_TOTAL_SECTIONS] = {};
+    sections[CACHE_SECTION_VERTICES] = { geometry.vertices.data(),
+        geometry.vertices.size() * sizeof(glm::vec3), geometry.vertices.size() };
+    sections[CACHE_SECTION_NORMALS] = { geometry.normals.data(),
+        geometry.normals.size() * sizeof(glm::vec3), geometry.normals.size() };
+    sections[CACHE_SECTION_LIGHTMAP_UVS] = { geometry.lightmap_uvs.data(),
+        geometry.lightmap_uvs.size() * sizeof(glm::vec2), geometry.lightmap_uvs.size() };
+    sections[CACHE_SECTION_INDICES] = { geometry.indices.data(),
+        geometry.indices.size() * sizeof(uint16_t), geometry.indices.size() };
+    sections[CACHE_SECTION_WIDE_INDICES] = { geometry.wide_indices.data(),
+        geometry.wide_indices.size() * sizeof(uint32_t), geometry.wide_indices.size() };
+    sections[CACHE_SECTION_FACE_RANGES] = { geometry.face_ranges.data(),
+        geometry.face_ranges.size() * sizeof(MapDrawRange), geometry.face_ranges.size() };
+    sections[CACHE_SECTION_MODELS] = { geometry.models.data(),
+        geometry.models.size() * sizeof(MapModel), geometry.models.size() };
+    sections[CACHE_SECTION_MESHLETS] = { geometry.meshlets.data(),
+        geometry.meshlets.size() * sizeof(MapMeshlet), geometry.meshlets.size() };
+    sections[CACHE_SECTION_FACE_MATERIALS] = { geometry.face_materials.data(),
+        geometry.face_materials.size() * sizeof(uint32_t), geometry.face_materials.size() };
+    sections[CACHE_SECTION_MATERIAL_NAMES] = { names.data(), names.size(),
+        geometry.materials.size() };
+    sections[CACHE_SECTION_BOUNDS] = { &geometry.bounds, sizeof(VertexBounds), 1 };
+    sections[CACHE_SECTION_FACE_LIGHTMAPS] = { geometry.face_lightmaps.data(),
+        geometry.face_lightmaps.size() * sizeof(FaceLightmap), geometry.face_lightmaps.size() };
+    sections[CACHE_SECTION_LIGHTMAP_PAGES] = { geometry.lightmap_pages.data(),
+        geometry.lightmap_pages.size() * sizeof(LightmapPage), geometry.lightmap_pages.size() };
+    sections[CACHE_SECTION_LIGHTMAP_TEXELS] = { geometry.lightmap_texels.data(),
+        geometry.lightmap_texels.size() * sizeof(uint32_t), geometry.lightmap_texels.size() };
+
+    /* Lay the sections out one after another, each aligned */
+    uint64_t offset = align_offset(sizeof(out_header));
+    for (int i=0; i < RENDER_CACHE_TOTAL_SECTIONS; i++) {
+        out_header.sections[i].file_offset = offset;
+        out_header.sections[i].size = sections[i].size;
+        out_header.sections[i].count = sections[i].count;
+        offset = align_offset(offset + sections[i].size);
+    }
+
+    /* Write to a temp file and move it into place, so a crash or another
+       instance never sees a half written cache */
+    std::string temp_path = path + ".tmp";
+    std::ofstream out(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.good()) {
+        throw RenderCacheException("Failed to create render cache at " + temp_path);
+    }
+
+    static const char padding[RENDER_CACHE_ALIGNMENT] = {};
+    out.write((const char*)&out_header, sizeof(out_header));
+    uint64_t written = sizeof(out_header);
+    for (int i=0; i < RENDER_CACHE_TOTAL_SECTIONS; i++) {
+        out.write(padding, out_header.sections[i].file_offset - written);
+        out.write((const char*)sections[i].data, sections[i].size);
+        written = out_header.sections[i].file_offset + sections[i].size;
+    }
+    out.close();
+
+    if (!out.good() || rename(temp_path.c_str(), path.c_str()) != 0) {
+        remove(temp_path.c_str());
+        throw RenderCacheException("Failed to write render cache to " + path);
+    }
+}
+
+bool RenderCache::Matches(const RenderCacheKey& key) const {
+    return header.source_hash == key.hash && header.source_size == key.size;
+}
+
+LumpView<glm::vec3> RenderCache::Vertices() const {
+    return section<glm::vec3>(CACHE_SECTION_VERTICES);
+}
+
+LumpView<glm::vec3> RenderCache::Normals() const {
+    LumpView<glm::vec3> normals = section<glm::vec3>(CACHE_SECTION_NORMALS);
+
+    if (normals.size() != header.sections[CACHE_SECTION_VERTICES].count) {
+        throw RenderCacheException("Render cache normals don't match its vertices.");
+    }
+    return normals;
+}
+
+LumpView<glm::vec2> RenderCache::LightmapUVs() const {
+    LumpView<glm::vec2> uvs = section<glm::vec2>(CACHE_SECTION_LIGHTMAP_UVS);
+
+    if (uvs.size() != header.sections[CACHE_SECTION_VERTICES].count) {
+        throw RenderCacheException("Render cache lightmap coordinates don't match its vertices.");
+    }
+    return uvs;
+}
+
+LumpView<uint16_t> RenderCache::Indices() const {
+    return section<uint16_t>(CACHE_SECTION_INDICES);
+}
+
+LumpView<uint32_t> RenderCache::WideIndices() const {
+    return section<uint32_t>(CACHE_SECTION_WIDE_INDICES);
+}
+
+LumpView<MapDrawRange> RenderCache::FaceRanges() const {
+    LumpView<MapDrawRange> ranges = section<MapDrawRange>(CACHE_SECTION_FACE_RANGES);
+
+    /* Faces are drawn out of their model's indices and vertices */
+    for (MapModel model : section<MapModel>(CACHE_SECTION_MODELS)) {
+        checkModel(model);
+        for (uint32_t i=model.first_face; i < model.first_face + model.face_count; i++) {
+            MapDrawRange range = ranges[i];
+            if (!range_fits(model, range.first_index, range.index_count, range.base_vertex)) {
+                throw RenderCacheException("Render cache face runs past its model.");
+            }
+        }
+    }
+    return ranges;
+}
+
+LumpView<MapModel> RenderCache::Models() const {
+    LumpView<MapModel> models = section<MapModel>(CACHE_SECTION_MODELS);
+
+    for (MapModel model : models) {
+        checkModel(model);
+
+        /* Indices count from the model's first vertex and go to the GPU
+           unchecked, so every one of them has to land on one of its vertices */
+        bool fits;
+        if (model.index_size == sizeof(uint16_t)) {
+            fits = indices_fit(Indices().Data() + model.first_index, model.index_count, model.vertex_count);
+        } else {
+            fits = indices_fit(WideIndices().Data() + model.first_index, model.index_count, model.vertex_count);
+        }
+        if (!fits) {
+            throw RenderCacheException("Render cache model indexes past its vertices.");
+        }
+    }
+    return models;
+}
+
+LumpView<MapMeshlet> RenderCache::Meshlets() const {
+    LumpView<MapMeshlet> meshlets = section<MapMeshlet>(CACHE_SECTION_MESHLETS);
+
+    /* Meshlets are drawn out of their model's indices and vertices */
+    for (MapModel model : section<MapModel>(CACHE_SECTION_MODELS)) {
+        checkModel(model);
+        for (uint32_t i=model.first_meshlet; i < model.first_meshlet + model.meshlet_count; i++) {
+            MapMeshlet meshlet = meshlets[i];
+            if (!range_fits(model, meshlet.first_index, meshlet.index_count, meshlet.base_vertex)) {
+                throw RenderCacheException("Render cache meshlet runs past its model.");
+            }
+        }
+    }
+    return meshlets;
+}
+
+LumpView<uint32_t> RenderCache::FaceMaterials() const {
+    return section<uint32_t>(CACHE_SECTION_FACE_MATERIALS);
+}
+
+std::vector<std::string> RenderCache::Materials() const {
+    const render_cache_section_t& info = header.sections[CACHE_SECTION_MATERIAL_NAMES];
+    const char* names = (const char*)file.Data() + info.file_offset;
+    std::vector<std::string> materials;
+
+    size_t pos = 0;
+    while (materials.size() < info.count) {
+        const char* end = (const char*)memchr(names + pos, '\0', info.size - pos);
+        if (end == nullptr) {
+            throw RenderCacheException("Render cache material names are truncated.");
+        }
+        materials.emplace_back(names + pos, end);
+        pos = (end - names) + 1;
+    }
+
+    return materials;
+}
+
+VertexBounds RenderCache::Bounds() const {
+    LumpView<VertexBounds> bounds = section<VertexBounds>(CACHE_SECTION_BOUNDS);
+
+    if (bounds.size() != 1) {
+        throw RenderCacheException("Render cache is missing the map bounds.");
+    }
+    return bounds[0];
+}
+
+LumpView<FaceLightmap> RenderCache::FaceLightmaps() const {
+    return section<FaceLightmap>(CACHE_SECTION_FACE_LIGHTMAPS);
+}
+
+LumpView<LightmapPage> RenderCache::LightmapPages() const {
+    LumpView<LightmapPage> pages = section<LightmapPage>(CACHE_SECTION_LIGHTMAP_PAGES);
+    uint64_t texel_count = header.sections[CACHE_SECTION_LIGHTMAP_TEXELS].count;
+
+    for (LightmapPage page : pages) {
+        if (page.first_texel > texel_count ||
+            (uint64_t)page.width * page.height > texel_count - page.first_texel) {
+            throw RenderCacheException("Render cache lightmap page runs past the texels.");
+        }
+    }
+    return pages;
+}
+
+LumpView<uint32_t> RenderCache::LightmapTexels() const {
+    return section<uint32_t>(CACHE_SECTION_LIGHTMAP_TEXELS);
+}
+
+/**
+ * Makes sure a model's faces, vertices, meshlets and indices all sit inside
+ * their sections.
+ */
+void RenderCache::checkModel(const MapModel& model) const {
+    uint64_t face_count = header.sections[CACHE_SECTION_FACE_RANGES].count;
+    uint64_t vertex_count = header.sections[CACHE_SECTION_VERTICES].count;
+    uint64_t meshlet_count = header.sections[CACHE_SECTION_MESHLETS].count;
+
+    if (model.first_face > face_count || model.face_count > face_count - model.first_face) {
+        throw RenderCacheException("Render cache model runs past the faces.");
+    }
+    if (model.first_vertex > vertex_count || model.vertex_count > vertex_count - model.first_vertex) {
+        throw RenderCacheException("Render cache model runs past the vertices.");
+    }
+    if (model.first_meshlet > meshlet_count || model.meshlet_count > meshlet_count - model.first_meshlet) {
+        throw RenderCacheException("Render cache model runs past the meshlets.");
+    }
+
+    uint64_t index_count;
+    if (model.index_size == sizeof(uint16_t)) {
+        index_count = header.sections[CACHE_SECTION_INDICES].count;
+    } else if (model.index_size == sizeof(uint32_t)) {
+        index_count = header.sections[CACHE_SECTION_WIDE_INDICES].count;
+    } else {
+        throw RenderCacheException("Render cache model has a bad index size.");
+    }
+    if (model.first_index > index_count || model.index_count > index_count - model.first_index) {
+        throw RenderCacheException("Render cache model runs past its indices.");
+    }
+}
+
+template <typename T>
+LumpView<T> RenderCache::section(uint32_t section_type) const {
+    const render_cache_section_t& info = header.sections[section_type];
+
+    if (info.size != info.count * sizeof(T)) {
+        throw RenderCacheException("Render cache section has the wrong element size.");
+    }
+    return LumpView<T>(file.Data() + info.file_offset, info.count);
+}
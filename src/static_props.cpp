@@ -0,0 +1,215 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Static props from the "sprp" game lump, grouped by model.
+ *
+ * The lump is a model dictionary (fixed length names), a list of leafs the
+ * props touch, then the props.  Each version of the lump adds fields to the
+ * end of a prop, but the ones up to the lighting origin never move, so those
+ * are read as a bsp_static_prop_t whatever the version.  The only later field
+ * we use is the uniform scale version 11 added.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "static_props.h"
+#include "game_lump.h"
+#include "bsp_parser.h"
+
+#define STATIC_PROP_MIN_VERSION 4
+#define STATIC_PROP_MAX_VERSION 11
+#define STATIC_PROP_SCALE_VERSION 11  // First version with a uniform scale
+#define STATIC_PROP_SCALE_OFFSET 76
+
+
+/**
+ * Reads a T at pos and moves pos past it.
+ */
+template <typename T>
+static T read_value(const LumpView<uint8_t>& data, size_t* pos, const char* what) {
+    T value;
+
+    if (data.size() - *pos < sizeof(T)) {
+        throw StaticPropException(std::string("Static prop lump is too small to hold ") + what + ".");
+    }
+    memcpy(&value, data.Bytes() + *pos, sizeof(T));
+    *pos += sizeof(T);
+    return value;
+}
+
+/**
+ * Smallest a prop can be in each version of the lump.
+ */
+static size_t min_prop_size(uint16_t version) {
+    static const size_t sizes[] = { 56, 60, 64, 68, 68, 72, 76, 80 };
+    return sizes[version - STATIC_PROP_MIN_VERSION];
+}
+
+/**
+ * Model to world transform, the same rotation the engine builds from a
+ * pitch/yaw/roll QAngle.
+ */
+static glm::mat4 prop_transform(const glm::vec3& origin, const glm::vec3& angles, float scale) {
+    const float to_radians = (float)M_PI / 180.0f;
+    float sp = sinf(angles.x * to_radians), cp = cosf(angles.x * to_radians);
+    float sy = sinf(angles.y * to_radians), cy = cosf(angles.y * to_radians);
+    float sr = sinf(angles.z * to_radians), cr = cosf(angles.z * to_radians);
+    glm::mat4 transform(1.0f);
+
+    transform[0] = glm::vec4(cp * cy, cp * sy, -sp, 0.0f) * scale;
+    transform[1] = glm::vec4(sr * sp * cy - cr * sy, sr * sp * sy + cr * cy, sr * cp, 0.0f) * scale;
+    transform[2] = glm::vec4(cr * sp * cy + sr * sy, cr * sp * sy - sr * cy, cr * cp, 0.0f) * scale;
+    transform[3] = glm::vec4(origin, 1.0f);
+    return transform;
+}
+
+
+StaticProps::StaticProps() {
+}
+
+StaticProps::StaticProps(const LumpView<uint8_t>& data, uint16_t version) {
+    size_t pos = 0;
+
+    if (version < STATIC_PROP_MIN_VERSION || version > STATIC_PROP_MAX_VERSION) {
+        throw StaticPropException("Unsupported static prop lump version " + std::to_string(version) + ".");
+    }
+
+    /* Model dictionary */
+    int32_t model_count = read_value<int32_t>(data, &pos, "a model count");
+    if (model_count < 0 || (uint64_t)model_count * STATIC_PROP_NAME_LENGTH > data.size() - pos) {
+        throw StaticPropException("Static prop model dictionary doesn't fit in the lump.");
+    }
+    models.reserve(model_count);
+    for (int32_t i=0; i < model_count; i++) {
+        const char* name = (const char*)data.Bytes() + pos;
+        models.emplace_back(name, strnlen(name, STATIC_PROP_NAME_LENGTH));
+        pos += STATIC_PROP_NAME_LENGTH;
+    }
+
+    /* Leaf list */
+    int32_t leaf_count = read_value<int32_t>(data, &pos, "a leaf count");
+    if (leaf_count < 0 || (uint64_t)leaf_count * sizeof(uint16_t) > data.size() - pos) {
+        throw StaticPropException("Static prop leaf list doesn't fit in the lump.");
+    }
+    leaves = LumpView<uint16_t>(data.Bytes() + pos, leaf_count).Copy();
+    pos += leaf_count * sizeof(uint16_t);
+
+    /* Props fill the rest of the lump, which tells us how big each one is */
+    int32_t count = read_value<int32_t>(data, &pos, "a prop count");
+    if (count < 0) {
+        throw StaticPropException("Static prop lump has a negative prop count.");
+    }
+    if (count == 0) {
+        return;
+    }
+    size_t prop_size = (data.size() - pos) / count;
+    if (prop_size < min_prop_size(version) || (data.size() - pos) % count != 0) {
+        throw StaticPropException("Static props don't fit the lump evenly.");
+    }
+
+    /* Count each model's instances so they can be placed straight into their
+       group, keeping lump order inside each group */
+    std::vector<uint32_t> next(models.size(), 0);
+    for (int32_t i=0; i < count; i++) {
+        bsp_static_prop_t prop;
+        memcpy(&prop, data.Bytes() + pos + i * prop_size, sizeof(prop));
+
+        if (prop.prop_type >= models.size()) {
+            throw StaticPropException("Static prop " + std::to_string(i) + " uses a model that isn't in the dictionary.");
+        }
+        if ((uint32_t)prop.first_leaf + prop.leaf_count > leaves.size()) {
+            throw StaticPropException("Static prop " + std::to_string(i) + "'s leafs aren't in the leaf list.");
+        }
+        next[prop.prop_type]++;
+    }
+
+    for (size_t model=0, first=0; model < models.size(); model++) {
+        uint32_t instance_count = next[model];
+        if (instance_count > 0) {
+            groups.push_back(StaticPropGroup{ (uint32_t)model, (uint32_t)first, instance_count });
+        }
+        next[model] = first;
+        first += instance_count;
+    }
+
+    instances.transforms.resize(count);
+    instances.origins.resize(count);
+    instances.angles.resize(count);
+    instances.fade.resize(count);
+    instances.first_leaf.resize(count);
+    instances.leaf_count.resize(count);
+    instances.skin.resize(count);
+    instances.solid.resize(count);
+    instances.flags.resize(count);
+    instances.lump_index.resize(count);
+
+    for (int32_t i=0; i < count; i++) {
+        const uint8_t* bytes = data.Bytes() + pos + i * prop_size;
+        bsp_static_prop_t prop;
+        float scale = 1.0f;
+
+        memcpy(&prop, bytes, sizeof(prop));
+        if (version >= STATIC_PROP_SCALE_VERSION) {
+            memcpy(&scale, bytes + STATIC_PROP_SCALE_OFFSET, sizeof(scale));
+        }
+
+        uint32_t out = next[prop.prop_type]++;
+        glm::vec3 origin(prop.origin[0], prop.origin[1], prop.origin[2]);
+        glm::vec3 angles(prop.angles[0], prop.angles[1], prop.angles[2]);
+        instances.transforms[out] = prop_transform(origin, angles, scale);
+        instances.origins[out] = origin;
+        instances.angles[out] = angles;
+        instances.fade[out] = glm::vec2(prop.fade_min_dist, prop.fade_max_dist);
+        instances.first_leaf[out] = prop.first_leaf;
+        instances.leaf_count[out] = prop.leaf_count;
+        instances.skin[out] = prop.skin;
+        instances.solid[out] = prop.solid;
+        instances.flags[out] = prop.flags;
+        instances.lump_index[out] = i;
+    }
+}
+
+StaticProps StaticProps::FromBSP(BSPParser* parser) {
+    const GameLumpEntry* entry = parser->GameLumps().Find(GAMELUMP_STATIC_PROPS);
+
+    if (entry == nullptr) {
+        return StaticProps();
+    }
+    return StaticProps(entry->data, entry->version);
+}
+
+size_t StaticProps::Count() const {
+    return instances.transforms.size();
+}
+
+const std::vector<std::string>& StaticProps::Models() const {
+    return models;
+}
+
+const std::vector<uint16_t>& StaticProps::Leaves() const {
+    return leaves;
+}
+
+const std::vector<StaticPropGroup>& StaticProps::Groups() const {
+    return groups;
+}
+
+const StaticPropArrays& StaticProps::Instances() const {
+    return instances;
+}
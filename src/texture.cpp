@@ -27,19 +27,6 @@
 
 
 Texture::Texture(const std::string& texture_file, bool flip) {
-
-    /* Create and bind opengl texture object */
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-
-    /* Set texture wrapping parameters */
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-    /* Set texture filtering parameters */
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
     /* Flip texture if requested */
     if (flip) {
         stbi_set_flip_vertically_on_load(true);
@@ -52,6 +39,56 @@ Texture::Texture(const std::string& texture_file, bool flip) {
         throw TextureException("Failed to load texture.");
     }
 
+    CreateFromImage(data);
+}
+
+/**
+ * Loads a texture from an image that's already in memory, such as one pulled
+ * out of a map's pakfile.
+ */
+Texture::Texture(const uint8_t* image_data, size_t image_len, bool flip) {
+    /* Flip texture if requested */
+    if (flip) {
+        stbi_set_flip_vertically_on_load(true);
+    }
+
+    /* Decode the image */
+    unsigned char* data = stbi_load_from_memory(image_data, image_len, &width,
+                                                &height, &channels, 0);
+    if (!data) {
+        throw TextureException("Failed to load texture.");
+    }
+
+    CreateFromImage(data);
+}
+
+/**
+ * Creates a texture from raw RGBA8 texels, such as a lightmap atlas page.
+ * These are clamped and not mipmapped, since their edges and smaller mips
+ * would blend in whatever sits next to them.
+ */
+Texture::Texture(const uint32_t* rgba, int width, int height) {
+    this->width = width;
+    this->height = height;
+    channels = 4;
+
+    Create((const unsigned char*)rgba, GL_CLAMP_TO_EDGE, false);
+}
+
+/**
+ * Creates the texture from an image stb_image decoded, then frees it.
+ */
+void Texture::CreateFromImage(unsigned char* data) {
+    try {
+        Create(data, GL_REPEAT, true);
+    } catch (TextureException& e) {
+        stbi_image_free(data);
+        throw;
+    }
+    stbi_image_free(data);
+}
+
+void Texture::Create(const unsigned char* data, GLenum wrap, bool mipmaps) {
     GLenum format;
     switch(channels) {
     case 1:
@@ -67,14 +104,25 @@ Texture::Texture(const std::string& texture_file, bool flip) {
         throw TextureException("Unknown number of channels: ");
     }
 
+    /* Create and bind opengl texture object */
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    /* Set texture wrapping parameters */
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+
+    /* Set texture filtering parameters */
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
     /* Load texture into GPU */
     glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
 
     /* Generate mipmaps */
-    glGenerateMipmap(GL_TEXTURE_2D);
-
-    /* Clean up data */
-    stbi_image_free(data);
+    if (mipmaps) {
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
 }
 
 void Texture::Use(GLenum active_texture) {
@@ -0,0 +1,194 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Fixed size pool of worker threads.
+ */
+
+#include <algorithm>
+#include "thread_pool.h"
+
+/* Which pool and queue the current thread works for, if any */
+static thread_local ThreadPool* current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+
+ThreadPool::ThreadPool(unsigned int num_threads) {
+    next_queue = 0;
+    queued = 0;
+    pending = 0;
+    stopping = false;
+
+    if (num_threads == 0) {
+        num_threads = std::thread::hardware_concurrency();
+    }
+    if (num_threads == 0) {
+        num_threads = 1;  // hardware_concurrency() is allowed to not know
+    }
+
+    for (unsigned int i=0; i < num_threads; i++) {
+        queues.emplace_back(new WorkQueue());
+    }
+    for (unsigned int i=0; i < num_threads; i++) {
+        workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    task_ready.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+    size_t target;
+
+    /* Keep work spawned by a task local to the worker that spawned it */
+    if (current_pool == this) {
+        target = current_worker;
+    } else {
+        target = next_queue++ % queues.size();
+    }
+
+    /* Count the task before it's visible, otherwise a worker could take
+       it, run it and count it off first */
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queued++;
+        pending++;
+    }
+    {
+        std::lock_guard<std::mutex> guard(queues[target]->lock);
+        queues[target]->tasks.push_back(std::move(task));
+    }
+    task_ready.notify_one();
+}
+
+void ThreadPool::Wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    tasks_done.wait(guard, [this] { return pending == 0; });
+
+    /* Hand the first failure back to whoever is waiting on the work */
+    if (error) {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+unsigned int ThreadPool::Size() const {
+    return workers.size();
+}
+
+/**
+ * Splits [0, count) into chunks and runs fn(first, last) on each across the
+ * pool, then waits for them.  Without a pool, or with only one thread, fn
+ * gets the whole range on the calling thread.
+ */
+void ThreadPool::ParallelFor(ThreadPool* pool, size_t count,
+                             const std::function<void(size_t, size_t)>& fn) {
+    if (pool == nullptr || pool->Size() <= 1) {
+        fn(0, count);
+        return;
+    }
+
+    size_t chunks = pool->Size() * THREAD_POOL_CHUNKS_PER_THREAD;
+    size_t chunk_size = std::max<size_t>(1, (count + chunks - 1) / chunks);
+    for (size_t first=0; first < count; first += chunk_size) {
+        size_t last = std::min(count, first + chunk_size);
+        pool->Submit([&fn, first, last] { fn(first, last); });
+    }
+    pool->Wait();
+}
+
+/**
+ * Grabs the newest task off a worker's own queue, or failing that steals the
+ * oldest task off someone else's.
+ */
+bool ThreadPool::TakeTask(size_t worker, std::function<void()>& task) {
+    for (size_t i=0; i < queues.size(); i++) {
+        WorkQueue& queue = *queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(queue.lock);
+
+        if (queue.tasks.empty()) {
+            continue;
+        }
+
+        if (i == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        return true;
+    }
+
+    return false;
+}
+
+void ThreadPool::WorkerLoop(size_t worker) {
+    current_pool = this;
+    current_worker = worker;
+
+    while (true) {
+        std::function<void()> task;
+
+        /* Sleep until there's something queued, or bail if we're shutting down */
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            task_ready.wait(guard, [this] { return stopping || queued > 0; });
+            if (queued == 0) {
+                return;
+            }
+        }
+
+        /* Someone else may beat us to it, in which case go back to sleep */
+        if (!TakeTask(worker, task)) {
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            queued--;
+        }
+
+        std::exception_ptr task_error;
+        try {
+            task();
+        } catch (...) {
+            task_error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (task_error && !error) {
+                error = task_error;
+            }
+            pending--;
+            if (pending == 0) {
+                tasks_done.notify_all();
+            }
+        }
+    }
+}
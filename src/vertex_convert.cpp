@@ -0,0 +1,279 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Bulk conversion of the vertex lump into render ready buffers.
+ *
+ * The SIMD paths load vertices straight out of the lump in blocks of 4 (SSE)
+ * or 8 (AVX2).  A block of N packed vertices is exactly 3 registers, so the
+ * interleaved output is just those registers stored back out, and the bounds
+ * are tracked per register lane and sorted back into x/y/z at the end.  For
+ * the SoA output the registers get shuffled apart into one register per axis.
+ *
+ * NaN/Inf is spotted by checking whether v - v is unordered, which is only
+ * true for non-finite values.  Non-finite vertices are rare enough (corrupt
+ * maps) that when any turn up we just redo the bounds with the scalar code,
+ * which skips them.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <float.h>
+#include "vertex_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VERTEX_CONVERT_X86
+#include <immintrin.h>
+#endif
+
+
+static void reset_bounds(VertexBounds* bounds) {
+    bounds->mins = glm::vec3(FLT_MAX);
+    bounds->maxs = glm::vec3(-FLT_MAX);
+    bounds->non_finite = 0;
+}
+
+/**
+ * Scalar conversion of vertices [start, end).  Any of the outputs can be null
+ * if only the bounds are wanted.
+ */
+static void convert_scalar(const LumpView<bsp_vertex_t>& in, size_t start, size_t end,
+                           glm::vec3* out, float* xs, float* ys, float* zs,
+                           VertexBounds* bounds) {
+    for (size_t i=start; i < end; i++) {
+        bsp_vertex_t v = in[i];
+
+        if (out != nullptr) {
+            out[i] = glm::vec3(v.x, v.y, v.z);
+        }
+        if (xs != nullptr) {
+            xs[i] = v.x;
+            ys[i] = v.y;
+            zs[i] = v.z;
+        }
+
+        if (!isfinite(v.x) || !isfinite(v.y) || !isfinite(v.z)) {
+            bounds->non_finite++;
+            continue;
+        }
+        bounds->mins = glm::vec3(fminf(bounds->mins.x, v.x), fminf(bounds->mins.y, v.y),
+                                 fminf(bounds->mins.z, v.z));
+        bounds->maxs = glm::vec3(fmaxf(bounds->maxs.x, v.x), fmaxf(bounds->maxs.y, v.y),
+                                 fmaxf(bounds->maxs.z, v.z));
+    }
+}
+
+/**
+ * Folds per lane min/max accumulators back into x/y/z bounds.  Lane l of
+ * register r holds component (r * width + l) % 3.
+ */
+static void fold_lanes(const float* mins, const float* maxs, int width,
+                       VertexBounds* bounds) {
+    for (int i=0; i < 3 * width; i++) {
+        int axis = i % 3;
+        bounds->mins[axis] = fminf(bounds->mins[axis], mins[i]);
+        bounds->maxs[axis] = fmaxf(bounds->maxs[axis], maxs[i]);
+    }
+}
+
+#ifdef VERTEX_CONVERT_X86
+
+/**
+ * Splits 4 packed vertices (x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3) into
+ * one register per axis.  _mm256_shuffle_ps works per 128 bit lane, so the
+ * same shuffles split two blocks at once in the AVX2 version.
+ */
+#define DEINTERLEAVE(SHUFFLE, a, b, c, x, y, z) do { \
+        x = SHUFFLE(a, SHUFFLE(b, c, _MM_SHUFFLE(0, 1, 0, 2)), _MM_SHUFFLE(2, 0, 3, 0)); \
+        y = SHUFFLE(SHUFFLE(a, b, _MM_SHUFFLE(0, 0, 1, 1)), \
+                    SHUFFLE(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)); \
+        z = SHUFFLE(SHUFFLE(a, b, _MM_SHUFFLE(1, 1, 2, 2)), \
+                    SHUFFLE(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)); \
+    } while (0)
+
+static size_t convert_sse(const LumpView<bsp_vertex_t>& in, glm::vec3* out,
+                          float* xs, float* ys, float* zs, VertexBounds* bounds) {
+    const float* src = (const float*)in.Bytes();
+    size_t blocks = in.size() / 4;
+    __m128 mins[3], maxs[3];
+    __m128 bad = _mm_setzero_ps();
+
+    for (int r=0; r < 3; r++) {
+        mins[r] = _mm_set1_ps(FLT_MAX);
+        maxs[r] = _mm_set1_ps(-FLT_MAX);
+    }
+
+    for (size_t block=0; block < blocks; block++) {
+        const float* p = src + block * 12;
+        __m128 regs[3] = { _mm_loadu_ps(p), _mm_loadu_ps(p + 4), _mm_loadu_ps(p + 8) };
+
+        for (int r=0; r < 3; r++) {
+            __m128 diff = _mm_sub_ps(regs[r], regs[r]);
+            bad = _mm_or_ps(bad, _mm_cmpunord_ps(diff, diff));
+            mins[r] = _mm_min_ps(mins[r], regs[r]);
+            maxs[r] = _mm_max_ps(maxs[r], regs[r]);
+        }
+
+        if (out != nullptr) {
+            float* dst = (float*)(out + block * 4);
+            _mm_storeu_ps(dst, regs[0]);
+            _mm_storeu_ps(dst + 4, regs[1]);
+            _mm_storeu_ps(dst + 8, regs[2]);
+        }
+        if (xs != nullptr) {
+            __m128 x, y, z;
+            DEINTERLEAVE(_mm_shuffle_ps, regs[0], regs[1], regs[2], x, y, z);
+            _mm_storeu_ps(xs + block * 4, x);
+            _mm_storeu_ps(ys + block * 4, y);
+            _mm_storeu_ps(zs + block * 4, z);
+        }
+    }
+
+    float lane_mins[12], lane_maxs[12];
+    for (int r=0; r < 3; r++) {
+        _mm_storeu_ps(lane_mins + r * 4, mins[r]);
+        _mm_storeu_ps(lane_maxs + r * 4, maxs[r]);
+    }
+    fold_lanes(lane_mins, lane_maxs, 4, bounds);
+    if (_mm_movemask_ps(bad) != 0) {
+        bounds->non_finite = 1;  // Flag it, the caller does the exact count
+    }
+
+    return blocks * 4;
+}
+
+__attribute__((target("avx2")))
+static size_t convert_avx2(const LumpView<bsp_vertex_t>& in, glm::vec3* out,
+                           float* xs, float* ys, float* zs, VertexBounds* bounds) {
+    const float* src = (const float*)in.Bytes();
+    size_t blocks = in.size() / 8;
+    __m256 mins[3], maxs[3];
+    __m256 bad = _mm256_setzero_ps();
+
+    for (int r=0; r < 3; r++) {
+        mins[r] = _mm256_set1_ps(FLT_MAX);
+        maxs[r] = _mm256_set1_ps(-FLT_MAX);
+    }
+
+    for (size_t block=0; block < blocks; block++) {
+        const float* p = src + block * 24;
+        __m256 regs[3] = { _mm256_loadu_ps(p), _mm256_loadu_ps(p + 8), _mm256_loadu_ps(p + 16) };
+
+        for (int r=0; r < 3; r++) {
+            __m256 diff = _mm256_sub_ps(regs[r], regs[r]);
+            bad = _mm256_or_ps(bad, _mm256_cmp_ps(diff, diff, _CMP_UNORD_Q));
+            mins[r] = _mm256_min_ps(mins[r], regs[r]);
+            maxs[r] = _mm256_max_ps(maxs[r], regs[r]);
+        }
+
+        if (out != nullptr) {
+            float* dst = (float*)(out + block * 8);
+            _mm256_storeu_ps(dst, regs[0]);
+            _mm256_storeu_ps(dst + 8, regs[1]);
+            _mm256_storeu_ps(dst + 16, regs[2]);
+        }
+        if (xs != nullptr) {
+            /* Regroup so each 128 bit lane holds one 4 vertex block */
+            __m256 a = _mm256_loadu2_m128(p + 12, p);
+            __m256 b = _mm256_loadu2_m128(p + 16, p + 4);
+            __m256 c = _mm256_loadu2_m128(p + 20, p + 8);
+            __m256 x, y, z;
+            DEINTERLEAVE(_mm256_shuffle_ps, a, b, c, x, y, z);
+            _mm256_storeu_ps(xs + block * 8, x);
+            _mm256_storeu_ps(ys + block * 8, y);
+            _mm256_storeu_ps(zs + block * 8, z);
+        }
+    }
+
+    float lane_mins[24], lane_maxs[24];
+    for (int r=0; r < 3; r++) {
+        _mm256_storeu_ps(lane_mins + r * 8, mins[r]);
+        _mm256_storeu_ps(lane_maxs + r * 8, maxs[r]);
+    }
+    fold_lanes(lane_mins, lane_maxs, 8, bounds);
+    if (_mm256_movemask_ps(bad) != 0) {
+        bounds->non_finite = 1;  // Flag it, the caller does the exact count
+    }
+
+    return blocks * 8;
+}
+
+#endif // VERTEX_CONVERT_X86
+
+bool VertexConvertPathSupported(VertexConvertPath path) {
+    switch (path) {
+    case CONVERT_BEST:
+    case CONVERT_SCALAR:
+        return true;
+#ifdef VERTEX_CONVERT_X86
+    case CONVERT_SSE:
+        return true;
+    case CONVERT_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+/**
+ * Runs the requested path over as many whole blocks as it can, then finishes
+ * off the leftovers with the scalar code.
+ */
+static VertexBounds convert(const LumpView<bsp_vertex_t>& in, glm::vec3* out,
+                            float* xs, float* ys, float* zs, VertexConvertPath path) {
+    VertexBounds bounds;
+    size_t done = 0;
+
+    reset_bounds(&bounds);
+
+    if (path == CONVERT_BEST) {
+        path = VertexConvertPathSupported(CONVERT_AVX2) ? CONVERT_AVX2 :
+               VertexConvertPathSupported(CONVERT_SSE) ? CONVERT_SSE : CONVERT_SCALAR;
+    }
+    if (!VertexConvertPathSupported(path)) {
+        path = CONVERT_SCALAR;
+    }
+
+#ifdef VERTEX_CONVERT_X86
+    if (path == CONVERT_AVX2) {
+        done = convert_avx2(in, out, xs, ys, zs, &bounds);
+    } else if (path == CONVERT_SSE) {
+        done = convert_sse(in, out, xs, ys, zs, &bounds);
+    }
+#endif
+    convert_scalar(in, done, in.size(), out, xs, ys, zs, &bounds);
+
+    /* Something wasn't finite, redo the bounds properly without it */
+    if (bounds.non_finite > 0) {
+        reset_bounds(&bounds);
+        convert_scalar(in, 0, in.size(), nullptr, nullptr, nullptr, nullptr, &bounds);
+    }
+
+    return bounds;
+}
+
+VertexBounds ConvertVertices(const LumpView<bsp_vertex_t>& in, glm::vec3* out,
+                             VertexConvertPath path) {
+    return convert(in, out, nullptr, nullptr, nullptr, path);
+}
+
+VertexBounds ConvertVerticesSoA(const LumpView<bsp_vertex_t>& in, float* xs,
+                                float* ys, float* zs, VertexConvertPath path) {
+    return convert(in, nullptr, xs, ys, zs, path);
+}
@@ -0,0 +1,167 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Per corner vertex normals for every face in a map.
+ *
+ */
+
+#include <stdlib.h>
+#include <math.h>
+#include "vertex_normals.h"
+#include "thread_pool.h"
+#include "bsp_parser.h"
+
+
+static glm::vec3 normalize_or(glm::vec3 v, glm::vec3 fallback) {
+    float length = sqrtf(v.x * v.x + v.y * v.y + v.z * v.z);
+    return length > 1e-12f ? v * (1.0f / length) : fallback;
+}
+
+
+VertexNormals::VertexNormals() {
+    recomputed = false;
+}
+
+VertexNormals::VertexNormals(const LumpView<bsp_vertnormal_t>& normals,
+                             const LumpView<bsp_vertnormal_index_t>& normal_indices,
+                             const LumpView<bsp_face_t>& faces) {
+    recomputed = false;
+    countCorners(faces);
+
+    size_t corner_count = face_corners.back();
+    if (normal_indices.size() < corner_count) {
+        throw VertexNormalException("Vertex normal index lump has " + std::to_string(normal_indices.size()) +
+                                    " entries, faces have " + std::to_string(corner_count) + " corners.");
+    }
+
+    this->normals.resize(corner_count);
+    for (size_t i=0; i < corner_count; i++) {
+        bsp_vertnormal_index_t index = normal_indices[i];
+        if (index >= normals.size()) {
+            throw VertexNormalException("Vertex normal index " + std::to_string(i) +
+                                        " is outside the vertex normal lump.");
+        }
+        bsp_vertnormal_t normal = normals[index];
+        this->normals[i] = glm::vec3(normal.x, normal.y, normal.z);
+    }
+}
+
+VertexNormals VertexNormals::Recompute(const LumpView<bsp_vertex_t>& vertices,
+                                       const LumpView<bsp_edge_t>& edges,
+                                       const LumpView<bsp_surfedge_t>& surfedges,
+                                       const LumpView<bsp_face_t>& faces,
+                                       ThreadPool* pool) {
+    VertexNormals result;
+    result.recomputed = true;
+    result.countCorners(faces);
+    const std::vector<uint32_t>& face_corners = result.face_corners;
+    size_t corner_count = face_corners.back();
+
+    /* Find each corner's vertex and each face's normal.  Faces wind
+       clockwise seen from the front, so Newell's normal gets flipped */
+    std::vector<uint16_t> corner_vertices(corner_count);
+    std::vector<glm::vec3> face_normals(faces.size());
+    ThreadPool::ParallelFor(pool, faces.size(), [&](size_t first, size_t last) {
+        for (size_t i=first; i < last; i++) {
+            bsp_face_t face = faces[i];
+            uint16_t* corners = corner_vertices.data() + face_corners[i];
+            for (uint32_t k=0; k < face.num_edges; k++) {
+                bsp_surfedge_t surfedge = surfedges[face.first_edge + k];
+                bsp_edge_t edge = edges[abs(surfedge)];
+                corners[k] = surfedge >= 0 ? edge.v[0] : edge.v[1];
+            }
+
+            glm::vec3 newell(0.0f);
+            for (uint32_t k=0; k < face.num_edges; k++) {
+                bsp_vertex_t a = vertices[corners[k]];
+                bsp_vertex_t b = vertices[corners[(k + 1) % face.num_edges]];
+                newell.x += (a.y - b.y) * (a.z + b.z);
+                newell.y += (a.z - b.z) * (a.x + b.x);
+                newell.z += (a.x - b.x) * (a.y + b.y);
+            }
+            face_normals[i] = normalize_or(-newell, glm::vec3(0.0f, 0.0f, 1.0f));
+        }
+    });
+
+    /* Faces on each vertex, bucketed by vertex */
+    std::vector<uint32_t> vertex_first(vertices.size() + 1, 0);
+    for (uint16_t vertex : corner_vertices) {
+        vertex_first[vertex + 1]++;
+    }
+    for (size_t i=0; i < vertices.size(); i++) {
+        vertex_first[i + 1] += vertex_first[i];
+    }
+    std::vector<uint32_t> vertex_faces(corner_count);
+    std::vector<uint32_t> fill(vertex_first.begin(), vertex_first.end() - 1);
+    for (size_t i=0; i < faces.size(); i++) {
+        for (uint32_t corner=face_corners[i]; corner < face_corners[i + 1]; corner++) {
+            vertex_faces[fill[corner_vertices[corner]]++] = i;
+        }
+    }
+
+    /* A face always smooths with itself, and with any other face on the
+       vertex it shares a smoothing group with */
+    result.normals.resize(corner_count);
+    ThreadPool::ParallelFor(pool, faces.size(), [&](size_t first, size_t last) {
+        for (size_t i=first; i < last; i++) {
+            uint32_t groups = faces[i].smoothing_groups;
+            for (uint32_t corner=face_corners[i]; corner < face_corners[i + 1]; corner++) {
+                uint16_t vertex = corner_vertices[corner];
+                glm::vec3 sum = face_normals[i];
+                for (uint32_t j=vertex_first[vertex]; j < vertex_first[vertex + 1]; j++) {
+                    uint32_t other = vertex_faces[j];
+                    if (other != i && (groups & faces[other].smoothing_groups) != 0) {
+                        sum = sum + face_normals[other];
+                    }
+                }
+                result.normals[corner] = normalize_or(sum, face_normals[i]);
+            }
+        }
+    });
+
+    return result;
+}
+
+VertexNormals VertexNormals::FromBSP(BSPParser* parser, ThreadPool* pool) {
+    if (parser->VertNormals().empty() || parser->VertNormalIndices().empty()) {
+        return Recompute(parser->Vertices(), parser->Edges(), parser->Surfedges(),
+                         parser->Faces(), pool);
+    }
+    return VertexNormals(parser->VertNormals(), parser->VertNormalIndices(), parser->Faces());
+}
+
+const std::vector<glm::vec3>& VertexNormals::Normals() const {
+    return normals;
+}
+
+uint32_t VertexNormals::FaceCorner(size_t face) const {
+    return face_corners[face];
+}
+
+bool VertexNormals::Recomputed() const {
+    return recomputed;
+}
+
+void VertexNormals::countCorners(const LumpView<bsp_face_t>& faces) {
+    face_corners.resize(faces.size() + 1);
+    face_corners[0] = 0;
+    for (size_t i=0; i < faces.size(); i++) {
+        face_corners[i + 1] = face_corners[i] + faces[i].num_edges;
+    }
+}
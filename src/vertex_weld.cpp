@@ -0,0 +1,93 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Merges vertices whose attributes are identical.
+ *
+ * Vertices are compared bit for bit, except that -0 counts as 0.  Anything
+ * looser would weld vertices that only look alike, and the lightmap
+ * coordinates would seam.
+ */
+
+#include <string.h>
+#include "vertex_weld.h"
+
+#define WELD_EMPTY_SLOT UINT32_MAX
+#define WELD_KEY_WORDS (sizeof(WeldVertex) / sizeof(uint32_t))
+
+static_assert(sizeof(WeldVertex) == 8 * sizeof(float), "WeldVertex must not have padding");
+
+
+/**
+ * Copy of a vertex with -0 folded into 0, so it can be hashed and compared
+ * as plain bits.
+ */
+static WeldVertex weld_key(const WeldVertex& vertex) {
+    float values[WELD_KEY_WORDS];
+    memcpy(values, &vertex, sizeof(values));
+    for (size_t i=0; i < WELD_KEY_WORDS; i++) {
+        values[i] += 0.0f;
+    }
+
+    WeldVertex key;
+    memcpy(&key, values, sizeof(key));
+    return key;
+}
+
+static uint64_t hash_key(const WeldVertex& key) {
+    uint32_t words[WELD_KEY_WORDS];
+    memcpy(words, &key, sizeof(words));
+
+    uint64_t hash = 0;
+    for (size_t i=0; i < WELD_KEY_WORDS; i++) {
+        hash = (hash ^ words[i]) * 0x9E3779B97F4A7C15ULL;
+    }
+    return hash ^ (hash >> 32);
+}
+
+
+VertexWelder::VertexWelder(size_t max_vertices) {
+    /* Keep the table at most half full so probes stay short */
+    size_t size = 16;
+    while (size < max_vertices * 2) {
+        size *= 2;
+    }
+    slots.assign(size, WELD_EMPTY_SLOT);
+    mask = size - 1;
+    vertices.reserve(max_vertices);
+}
+
+uint32_t VertexWelder::Weld(const WeldVertex& vertex) {
+    WeldVertex key = weld_key(vertex);
+
+    size_t slot = hash_key(key) & mask;
+    while (slots[slot] != WELD_EMPTY_SLOT) {
+        if (memcmp(&vertices[slots[slot]], &key, sizeof(key)) == 0) {
+            return slots[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    slots[slot] = vertices.size();
+    vertices.push_back(key);
+    return slots[slot];
+}
+
+const std::vector<WeldVertex>& VertexWelder::Vertices() const {
+    return vertices;
+}
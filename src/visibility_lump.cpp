@@ -0,0 +1,320 @@
+/*
+ * source-engine-map-renderer - A toy project for rendering source engine maps
+ * Copyright (C) 2018 nyxxxie
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Potentially visible sets from a map's visibility lump.
+ *
+ * The lump starts with a cluster count and a PVS/PAS offset pair per
+ * cluster, followed by the compressed sets.  A set is a bit per cluster
+ * where a non zero byte is stored as is and a run of zero bytes is stored as
+ * a zero followed by the length of the run.
+ */
+
+#include <string.h>
+#include "visibility_lump.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VISIBILITY_X86
+#include <immintrin.h>
+#endif
+
+#define VIS_HEADER_SIZE 4
+#define VIS_OFFSETS_SIZE 8  // PVS and PAS offset for each cluster
+
+
+#ifdef VISIBILITY_X86
+
+__attribute__((target("avx2")))
+static void union_avx2(uint64_t* dst, const uint64_t* src, size_t words) {
+    size_t i = 0;
+
+    for (; i + 4 <= words; i += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(a, b));
+    }
+    for (; i < words; i++) {
+        dst[i] |= src[i];
+    }
+}
+
+__attribute__((target("avx2")))
+static void intersect_avx2(uint64_t* dst, const uint64_t* src, size_t words) {
+    size_t i = 0;
+
+    for (; i + 4 <= words; i += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_and_si256(a, b));
+    }
+    for (; i < words; i++) {
+        dst[i] &= src[i];
+    }
+}
+
+/**
+ * Counts bits a nibble at a time with a pshufb lookup, adding the byte
+ * counts up with psadbw every 4 words.  Words past the last multiple of 4
+ * are counted one at a time.
+ */
+__attribute__((target("avx2")))
+static size_t count_avx2(const uint64_t* bits, size_t words) {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low4 = _mm256_set1_epi8(0x0F);
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 4 <= words; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(bits + i));
+        __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low4));
+        __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low4));
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256()));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, total);
+    size_t count = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < words; i++) {
+        count += __builtin_popcountll(bits[i]);
+    }
+    return count;
+}
+
+__attribute__((target("popcnt")))
+static size_t count_popcnt(const uint64_t* bits, size_t words) {
+    size_t total = 0;
+    for (size_t i=0; i < words; i++) {
+        total += __builtin_popcountll(bits[i]);
+    }
+    return total;
+}
+
+#endif // VISIBILITY_X86
+
+void ClusterBitsUnion(ClusterBits* dst, const ClusterBits& src) {
+    if (dst->size() != src.size()) {
+        throw VisibilityException("Can't union cluster sets of different sizes.");
+    }
+#ifdef VISIBILITY_X86
+    if (__builtin_cpu_supports("avx2")) {
+        union_avx2(dst->data(), src.data(), src.size());
+        return;
+    }
+#endif
+    for (size_t i=0; i < src.size(); i++) {
+        (*dst)[i] |= src[i];
+    }
+}
+
+void ClusterBitsIntersect(ClusterBits* dst, const ClusterBits& src) {
+    if (dst->size() != src.size()) {
+        throw VisibilityException("Can't intersect cluster sets of different sizes.");
+    }
+#ifdef VISIBILITY_X86
+    if (__builtin_cpu_supports("avx2")) {
+        intersect_avx2(dst->data(), src.data(), src.size());
+        return;
+    }
+#endif
+    for (size_t i=0; i < src.size(); i++) {
+        (*dst)[i] &= src[i];
+    }
+}
+
+size_t ClusterBitsCount(const ClusterBits& bits) {
+#ifdef VISIBILITY_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return count_avx2(bits.data(), bits.size());
+    }
+    if (__builtin_cpu_supports("popcnt")) {
+        return count_popcnt(bits.data(), bits.size());
+    }
+#endif
+    size_t total = 0;
+    for (uint64_t word : bits) {
+        total += __builtin_popcountll(word);
+    }
+    return total;
+}
+
+
+VisibilityLump::VisibilityLump(const LumpView<uint8_t>& data, size_t budget_bytes) {
+    int32_t count = 0;
+
+    this->data = data;
+    this->budget = budget_bytes;
+    this->stats = {};
+
+    /* No vis data at all, which is what you get if vvis was never run */
+    if (data.empty()) {
+        num_clusters = 0;
+        num_words = 0;
+        everything = std::make_shared<const ClusterBits>();
+        return;
+    }
+
+    if (data.size() < VIS_HEADER_SIZE) {
+        throw VisibilityException("Visibility lump is too small to hold a header.");
+    }
+    memcpy(&count, data.Bytes(), sizeof(count));
+    if (count < 0 || (data.size() - VIS_HEADER_SIZE) / VIS_OFFSETS_SIZE < (size_t)count) {
+        throw VisibilityException("Visibility lump has a bad cluster count.");
+    }
+
+    num_clusters = count;
+    num_words = ((num_clusters + 63) / 64 + 3) & ~(size_t)3;
+
+    /* Only the PVS offsets are kept, the PAS is unused */
+    pvs_offsets.resize(num_clusters);
+    for (size_t i=0; i < num_clusters; i++) {
+        memcpy(&pvs_offsets[i], data.Bytes() + VIS_HEADER_SIZE + i * VIS_OFFSETS_SIZE, sizeof(uint32_t));
+        if (pvs_offsets[i] >= data.size()) {
+            throw VisibilityException("Cluster " + std::to_string(i) + "'s PVS is outside the visibility lump.");
+        }
+    }
+
+    ClusterBits all(num_words, 0);
+    for (size_t i=0; i < num_clusters; i++) {
+        all[i / 64] |= 1ULL << (i % 64);
+    }
+    everything = std::make_shared<const ClusterBits>(std::move(all));
+}
+
+size_t VisibilityLump::ClusterCount() const {
+    return num_clusters;
+}
+
+size_t VisibilityLump::SetBytes() const {
+    return num_words * sizeof(uint64_t);
+}
+
+std::shared_ptr<const ClusterBits> VisibilityLump::PVS(int32_t cluster) const {
+    if (cluster < 0) {
+        return everything;
+    }
+    if ((size_t)cluster >= num_clusters) {
+        throw VisibilityException("Cluster " + std::to_string(cluster) + " doesn't exist.");
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = cached.find(cluster);
+        if (found != cached.end()) {
+            lru.splice(lru.begin(), lru, found->second);
+            stats.hits++;
+            return found->second->second;
+        }
+        stats.misses++;
+    }
+
+    /* Decompress outside the lock so other lookups aren't held up.  Two
+       threads missing on the same cluster both decompress it, and the second
+       one just finds it already cached */
+    std::shared_ptr<const ClusterBits> bits = decompress(cluster);
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto found = cached.find(cluster);
+    if (found != cached.end()) {
+        return found->second->second;
+    }
+    lru.emplace_front(cluster, bits);
+    cached[cluster] = lru.begin();
+    stats.cached_sets++;
+    stats.cached_bytes += SetBytes();
+    evict();
+
+    return bits;
+}
+
+bool VisibilityLump::CanSee(int32_t from, int32_t to) const {
+    if (from < 0 || to < 0) {
+        return true;
+    }
+    if ((size_t)to >= num_clusters) {
+        throw VisibilityException("Cluster " + std::to_string(to) + " doesn't exist.");
+    }
+    return ClusterBitsTest(*PVS(from), to);
+}
+
+ClusterBits VisibilityLump::UnionPVS(const std::vector<int32_t>& clusters) const {
+    ClusterBits result(num_words, 0);
+
+    for (int32_t cluster : clusters) {
+        ClusterBitsUnion(&result, *PVS(cluster));
+    }
+
+    return result;
+}
+
+void VisibilityLump::SetBudget(size_t budget_bytes) {
+    std::lock_guard<std::mutex> guard(lock);
+    budget = budget_bytes;
+    evict();
+}
+
+VisibilityStats VisibilityLump::Stats() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return stats;
+}
+
+/**
+ * Runs a cluster's compressed set out into a bitset.  Runs that would go
+ * past the end of the set are clipped, running off the end of the lump is
+ * an error.
+ */
+std::shared_ptr<const ClusterBits> VisibilityLump::decompress(int32_t cluster) const {
+    auto bits = std::make_shared<ClusterBits>(num_words, 0);
+    uint8_t* out = (uint8_t*)bits->data();
+    size_t row_bytes = (num_clusters + 7) / 8;
+    const uint8_t* in = data.Bytes() + pvs_offsets[cluster];
+    const uint8_t* end = data.Bytes() + data.size();
+
+    for (size_t pos=0; pos < row_bytes; ) {
+        if (in >= end) {
+            throw VisibilityException("Cluster " + std::to_string(cluster) + "'s PVS runs off the end of the lump.");
+        }
+        if (*in != 0) {
+            out[pos++] = *in++;
+            continue;
+        }
+        if (in + 1 >= end) {
+            throw VisibilityException("Cluster " + std::to_string(cluster) + "'s PVS runs off the end of the lump.");
+        }
+        pos += in[1];  // Already zeroed
+        in += 2;
+    }
+
+    /* Bits past the last cluster must stay clear for counting */
+    if (num_clusters % 8 != 0) {
+        out[row_bytes - 1] &= (1 << (num_clusters % 8)) - 1;
+    }
+
+    return bits;
+}
+
+/* Drops least recently used sets until we're under budget, lock must be held */
+void VisibilityLump::evict() const {
+    while (stats.cached_bytes > budget && !lru.empty()) {
+        cached.erase(lru.back().first);
+        lru.pop_back();
+        stats.cached_sets--;
+        stats.cached_bytes -= SetBytes();
+        stats.evictions++;
+    }
+}